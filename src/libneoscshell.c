@@ -0,0 +1,3590 @@
+/*
+ * libneoscshell - the neosc-shell command engine as a library
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <libneosc.h>
+#include <winscard.h>
+#include "libneoscshell.h"
+#include "neosc-lock.h"
+#include "neosc-metrics.h"
+#include "neosc-audit.h"
+#include "neosc-crypto.h"
+#include "neosc-journal.h"
+#include "neosc-inventory.h"
+#include "neosc-queue.h"
+#include "neosc-totp.h"
+
+#define memclear(a,b,c) \
+    do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
+
+#define MAXLEN	128
+
+#define INT1	0
+#define INT2	1
+#define INT3	2
+#define INT4	3
+#define ARR	4
+
+#define SERIAL		0
+#define SLOT		1
+#define CHALLENGE	2
+#define URL		3
+#define	TEXT		4
+#define LANG		5
+#define SCANMAP		6
+#define MODE		7
+#define CRTIMEOUT	8
+#define AUTOEJECTTIME	9
+#define TICKETFLAGS	10
+#define CONFIGFLAGS	11
+#define EXTENDEDFLAGS	12
+#define ACCESSCODE	13
+#define NEWACCESSCODE	14
+#define SECRETKEY	15
+#define PRIVATEID	16
+#define PUBLICID	17
+#define OMP		18
+#define TT		19
+#define MUI		20
+#define IMF		21
+#define PASSWORD	22
+#define NEWPASSWORD	23
+#define OTPNAME		24
+#define OTPMODE		25
+#define SHAMODE		26
+#define OTPDIGITS	27
+#define TOTPMARGIN	28
+#define TIMEOUT		29
+#define VERIFY		30
+#define NFCGRACE	31
+
+#define TOTALVARS	32
+
+#define TOTPSTEP	30
+
+#define NFCDEFGRACE	2000
+#define NFCPOLL		50
+
+#define MAXLINE		1024
+
+#define SETMODE		0
+#define SETNDEF		1
+#define RESETSLOT	2
+#define CONFIG		3
+#define OATHADD		4
+#define OATHDEL		5
+#define VARIABLE	6
+
+#define PROBENEO	0x01
+#define PROBEUSB	0x02
+#define PROBEOATH	0x04
+
+#define MAXMEMO		32
+
+#define MAXCAPS		16
+
+#define TAPREADERS	16
+#define TAPSTATE	(SCARD_STATE_PRESENT|SCARD_STATE_EMPTY|0xffff0000)
+
+#define CAPNFC		0x01
+#define CAPNDEF		0x02
+#define CAPMGR		0x04
+#define MEMOCHAL	64
+
+#define HMACLT64	0x04
+#define CHALBTN		0x08
+#define OTPCHAL		6
+
+typedef struct
+{
+	char *name;
+	int type;
+	int valid;
+	int len;
+	int tmpl;
+	char format[MAXLEN+1];
+	union
+	{
+		int value;
+		unsigned char data[MAXLEN+1];
+	};
+} VAR;
+
+typedef struct
+{
+	int serial;
+	int slot;
+	int pgmseq;
+	int uses;
+	int len;
+	time_t expiry;
+	unsigned char challenge[MEMOCHAL];
+	unsigned char response[NEOSC_SHA1_SIZE];
+} MEMO;
+
+typedef struct
+{
+	int serial;
+	int major;
+	int minor;
+	int build;
+	int caps;
+} CAPS;
+
+typedef struct
+{
+	int enable;
+	int keyvalue;
+	int lockprio;
+	int lockfd;
+	int home;
+	int applet;
+	int keepoath;
+	int sessionserial;
+	int sessionok;
+	void *session;
+	NEOSC_OATH_INFO sessioninfo;
+	long lockwait;
+	long long locktime;
+	char *lockd;
+	char *cachedir;
+	char *metricsfile;
+	void *metrics;
+	void *audit;
+	int clone;
+	void *journal;
+	int step;
+	int jactive;
+	int jpgmseq;
+	void *inventory;
+	pthread_mutex_t invmtx;
+	void *publish;
+	FILE *out;
+	NEOSC_OATH_RESPONSE *totp;
+	int totptotal;
+	int totpserial;
+	time_t totpstep;
+	MEMO *memo;
+	int memottl;
+	int memouses;
+	int mismatches;
+	int nfctried;
+	int nfclost;
+	int recoveries;
+	int facts;
+	int factkey;
+	int factserial;
+	int factmajor;
+	int factminor;
+	int factbuild;
+	int capnext;
+	CAPS caps[MAXCAPS];
+	int masterlen;
+	unsigned char *master;
+	VAR var[TOTALVARS];
+} SHELL;
+
+typedef struct
+{
+	int valid;
+	int config[2];
+	int touch[2];
+	int mode;
+	int crtimeout;
+	int autoejecttime;
+	int ndefok;
+	int total;
+	int codes;
+	NEOSC_NDEF ndef;
+	NEOSC_OATH_LIST *list;
+	NEOSC_OATH_RESPONSE *results;
+} STATE;
+
+typedef struct
+{
+	int neo;
+	NEOSC_STATUS status;
+} CACHE;
+
+typedef struct
+{
+	SCARDCONTEXT ctx;
+	int total;
+	char *names;
+	DWORD len;
+	SCARD_READERSTATE rs[TAPREADERS+1];
+} READERS;
+
+static const VAR vartemplate[TOTALVARS]=
+{
+	{"serial",INT4,0,0},
+	{"slot",INT1,0,0},
+	{"challenge",ARR,0,0},
+	{"url",ARR,0,0},
+	{"text",ARR,0,0},
+	{"lang",ARR,0,0},
+	{"scanmap",ARR,0,0},
+	{"mode",INT1,0,0},
+	{"crtimeout",INT1,0,0},
+	{"autoejecttime",INT2,0,0},
+	{"ticketflags",INT1,0,0},
+	{"configflags",INT1,0,0},
+	{"extendedflags",INT1,0,0},
+	{"accesscode",ARR,0,0},
+	{"newaccesscode",ARR,0,0},
+	{"secretkey",ARR,0,0},
+	{"privateid",ARR,0,0},
+	{"publicid",ARR,0,0},
+	{"omp",INT1,0,0},
+	{"tt",INT1,0,0},
+	{"mui",INT4,0,0},
+	{"imf",INT4,0,0},
+	{"password",ARR,0,0},
+	{"newpassword",ARR,0,0},
+	{"otpname",ARR,0,0},
+	{"otpmode",INT1,0,0},
+	{"shamode",INT1,0,0},
+	{"otpdigits",INT1,0,0},
+	{"totpmargin",INT1,0,0},
+	{"timeout",INT2,0,0},
+	{"verify",INT1,0,0},
+	{"nfcgrace",INT2,0,0},
+};
+
+static void emit(SHELL *sh,char *key,char *sep,char *fmt,...)
+{
+	va_list ap;
+
+	if(key)
+	{
+		fputs(key,sh->out);
+		fputs(sh->keyvalue?"=":sep,sh->out);
+	}
+	else if(sh->keyvalue)fputs("value=",sh->out);
+	va_start(ap,fmt);
+	vfprintf(sh->out,fmt,ap);
+	va_end(ap);
+	fputc('\n',sh->out);
+}
+
+/* key=value mode uses identifier keys, the text keys contain blanks */
+
+static void emitconfig(SHELL *sh,int config1,int config2,int touch1,
+	int touch2,int ledinv)
+{
+	static char *key[2][5]=
+	{
+		{"config 1 valid","config 2 valid","config 1 needs button",
+			"config 2 needs button","led behaviour"},
+		{"config1_valid","config2_valid","config1_needs_button",
+			"config2_needs_button","led_behaviour"},
+	};
+	char **k=key[sh->keyvalue?1:0];
+
+	emit(sh,k[0],": ","%s",config1?"yes":"no");
+	emit(sh,k[1],": ","%s",config2?"yes":"no");
+	emit(sh,k[2],": ","%s",touch1?"yes":"no");
+	emit(sh,k[3],": ","%s",touch2?"yes":"no");
+	emit(sh,k[4],": ","%s",ledinv?"inverted":"normal");
+}
+
+static void varhelp(FILE *out)
+{
+	int i;
+
+	fprintf(out,"Variables:\n\n");
+	for(i=0;i<TOTALVARS;i++)fprintf(out,"\t%s (%s)\n",
+		vartemplate[i].name,
+		vartemplate[i].type==ARR?"array":"number");
+	fprintf(out,"\n"
+	"If set, timeout is the deadline in seconds for every following\n"
+	"command. A command exceeding it terminates the shell after\n"
+	"wiping all variables, which releases the device.\n"
+	"\n"
+	"nfcgrace is the time in milliseconds (default 2000, 0 disables)\n"
+	"within which a failed read command for the first NFC attached\n"
+	"device is retried once the card answers again after being\n"
+	"reset or removed by an RF dropout. Writes, calc-otp and\n"
+	"calc-yubiotp are never retried as they advance counters.\n"
+	"\n"
+	"Commands working with variables:\n"
+	"\n"
+	"set <variable> <value>\n"
+	"\n"
+	"\tSets a variable to the specified value.\n"
+	"\tThe value may be prefixed by a modifier.\n"
+	"\tIf no modifier is specified the value must be a decimal number.\n"
+	"\tModifier are:\n"
+	"\n"
+	"\th:\t\ta hexadecimal number\n"
+	"\tm:\t\ta modified hexadecimal (modhex) number\n"
+	"\tb32:\t\ta base32 encoded number\n"
+	"\tb64:\t\ta base64 encoded number\n"
+	"\tt:<time>\ta time value, either 'now' for the current time or\n"
+	"\t\t\ta time specified as 'yyyy-mm-dd HH:MM:SS'\n"
+	"\t\t\t(array only)\n"
+	"\ts:\t\ta character string (array only)\n"
+	"\tr:<digits>\ta random of <digits> length (array only)\n"
+	"\tf:<template>\ta value including modifier that is evaluated\n"
+	"\t\t\twhen a device command is executed, %%{<variable>}\n"
+	"\t\t\tis replaced by the variable (string or decimal),\n"
+	"\t\t\t%%{<variable>:x} by its hex and %%{<variable>:m}\n"
+	"\t\t\tby its modhex representation, %%{serial} and\n"
+	"\t\t\t%%{version} are read from the device if required,\n"
+	"\t\t\t%%%% is a literal %%, e.g. f:s:user@host-%%{serial}\n"
+	"\t\t\t%%{derive:<length>} by <length> bytes in hex\n"
+	"\t\t\tderived from the master key (-K) for this\n"
+	"\t\t\tvariable, the serial read from the device and\n"
+	"\t\t\tthe slot (if set)\n"
+	"\tk:<length>\tshort for f:h:%%{derive:<length>} (array only)\n"
+	"\t\t\tserial, timeout and nfcgrace cannot be templates\n"
+	"\n"
+	"clear <variable>\n"
+	"\n"
+	"\tUnsets a variable.\n"
+	"\n"
+	"show <variable>\n"
+	"\n"
+	"\tPrints a variable as hexadecimal number.\n"
+	"\n"
+	"print <variable>\n"
+	"\n"
+	"\tPrints a variable as decimal number (number only).\n"
+	"\n"
+	"modhex <variable>\n"
+	"\n"
+	"\tPrints a variable as modified hexadecimal number (array only).\n"
+	"\n"
+	"base32 <variable>\n"
+	"\n"
+	"\tPrints a variable base32 encoded (array only).\n"
+	"\n"
+	"base64 <variable>\n"
+	"\n"
+	"\tPrints a variable base64 encoded (array only).\n");
+}
+
+static void neohelp(FILE *out)
+{
+	fprintf(out,"NEO Applet (CCID mode):\n\n"
+	"Usage: neo <command>\n\n"
+	"\tshow-info\t\tshow applet info\n"
+	"\tshow-status\t\tshow applet status\n"
+	"\tshow-serial\t\tshow device serial number\n"
+	"\tshow-ndef\t\tshow ndef data (NFC only)\n"
+	"\tcalc-yubiotp\t\tcalculate Yubico OTP (NFC only)\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\tcalc-hmac\t\tcalculate HMCA_SHA1 challenge-response\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tchallenge\trequired, 1 to 64 bytes\n"
+	"\t\totpdigits\toptional, if set (6-8) print otp format\n"
+	"\t\t\t\tresults may be memoized (-m), requires serial\n"
+	"\tcalc-otp\t\tcalcuate Yubico OTP challenge-response\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tchallenge\trequired, 6 bytes\n"
+	"\tset-ndef\t\tconfigure NDEF message\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\turl\t\t(this or 'text' and 'lang'), the url to store\n"
+	"\t\ttext\t\t(this and 'lang' or 'url'), the text to store\n"
+	"\t\tlang\t\t(this and 'text' or 'url'), language to store\n"
+	"\tset-scanmap\t\tconfigure device scan code map\n"
+	"\t\tscanmap\t\toptional, 45 byte scan map\n"
+	"\tshow-caps\t\tshow device model and capabilities\n"
+	"\tset-mode\t\tconfigure device operation mode (YubiKey NEO\n"
+	"\t\t\t\tmethod until the model is known)\n"
+	"\tset-mode-mgr\t\tconfigure device operation mode (YubiKey 4\n"
+	"\t\t\t\tmethod until the model is known)\n"
+	"\t\tmode\t\trequired, operation mode (0-6)\n"
+	"\t\tcrtimeout\trequired, challenge-response timeout\n"
+	"\t\tautoejecttime\trequired, auto eject time\n"
+	"\treset-slot\t\treset configuration of a slot\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\tswap-slots\t\texchange both slots\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\tupdate-slot\t\tupdate configuration options for a slot\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tticketflags\trequired, ticket flags\n"
+	"\t\tconfigflags\trequired, configuration flags\n"
+	"\t\textendedflags\trequired, extended flags\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\tconfig-hmac\t\tconfigure HMAC-SHA1 challenge-response\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tsecretkey\trequired, hash secret key (20 bytes)\n"
+	"\t\tticketflags\trequired, ticket flags\n"
+	"\t\tconfigflags\trequired, configuration flags\n"
+	"\t\textendedflags\trequired, extended flags\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\t\tverify\t\toptional, if set verify with one challenge\n"
+	"\tconfig-otp\t\tconfigure Yubico OTP challenge-response\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
+	"\t\tticketflags\trequired, ticket flags\n"
+	"\t\tconfigflags\trequired, configuration flags\n"
+	"\t\textendedflags\trequired, extended flags\n"
+	"\t\tprivateid\toptional, private identity (6 bytes)\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\t\tverify\t\toptional, if set verify with one challenge\n"
+	"\tconfig-hotp\t\tconfigure HOTP for a slot\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tsecretkey\trequired, hash secret key (20 bytes)\n"
+	"\t\tomp\t\trequired, (0-255, 0 if not used)\n"
+	"\t\ttt\t\trequired, (0-255, 0 if not used)\n"
+	"\t\tmui\t\trequired, (0-99999999, -1 if not used)\n"
+	"\t\timf\t\trequired, (0-0xffff0, increments of 16)\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\tconfig-yubiotp\t\tconfigure Yubico OTP for a slot\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
+	"\t\tticketflags\trequired, ticket flags\n"
+	"\t\tconfigflags\trequired, configuration flags\n"
+	"\t\textendedflags\trequired, extended flags\n"
+	"\t\tprivateid\toptional, private identity (6 bytes)\n"
+	"\t\tpublicid\toptional, public identity (1-16 bytes)\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\tconfig-password\t\tconfigure static password for a slot\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
+	"\t\tticketflags\trequired, ticket flags\n"
+	"\t\tconfigflags\trequired, configuration flags\n"
+	"\t\textendedflags\trequired, extended flags\n"
+	"\t\tprivateid\trequired, private identity (6 bytes)\n"
+	"\t\tpublicid\toptional, public identity (1-16 bytes)\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n");
+}
+
+static void ndefhelp(FILE *out)
+{
+	fprintf(out,"NDEF Applet (CCID mode):\n\n"
+	"Usage: ndef <command>\n\n"
+	"\tshow-cc\t\t\tshow ndef cc data (NFC only)\n"
+	"\tshow-ndef\t\tshow ndef data (NFC only)\n");
+}
+
+static void oathhelp(FILE *out)
+{
+	fprintf(out,"OATH Applet (CCID mode):\n\n"
+	"Usage: oath <command>\n\n"
+	"\tshow-info\t\tshow applet info\n"
+	"\treset-all\t\treset applet\n"
+	"\tset-password\t\tset/change/clear applet password\n"
+	"\t\tpassword\toptional, current password (if any)\n"
+	"\t\tnewpassword\toptional, new password (if any)\n"
+	"\tcalc-otp\t\tcalculate named OTP entry\n"
+	"\t\totpname\t\trequired, name of entry to be processed\n"
+	"\t\tpassword\toptional, current password (if any)\n"
+	"\tcalc-all-totp\t\tcalculate all TOTP entries\n"
+	"\t\tpassword\toptional, current password (if any)\n"
+	"\t\ttotpmargin\toptional, seconds before the end of the time\n"
+	"\t\t\t\tstep within which the next step is calculated\n"
+	"\t\t\t\ttoo and served from memory after the step\n"
+	"\t\t\t\tboundary, prints remaining validity if set\n"
+	"\tpublish-totp\t\tpublish the TOTP entries of the current and\n"
+	"\t\t\t\tthe next time step to shared memory (-O)\n"
+	"\t\tpassword\toptional, current password (if any)\n"
+	"\tlist-all\t\tlist all OTP entries\n"
+	"\t\tpassword\toptional, current password (if any)\n"
+	"\tdelete-entry\t\tdelete an OTP entry\n"
+	"\t\totpname\t\trequired, name of entry to be processed\n"
+	"\t\tpassword\toptional, current password (if any)\n"
+	"\tadd-change-entry\tadd or modify an OTP entry\n"
+	"\t\totpname\t\trequired, name of entry to be processed\n"
+	"\t\totpmode\t\trequired, 0 for HOTP, 1 for TOTP\n"
+	"\t\tshamode\t\trequired, 0 for SHA1, 1 for SHA256\n"
+	"\t\totpdigits\trequired, output digit amount (6-8)\n"
+	"\t\timf\t\trequired, initial moving factor for HOTP\n"
+	"\t\tsecretkey\trequired, 20 bytes for SHA1, 32 for SHA256\n"
+	"\t\tpassword\toptional, current password (if any)\n");
+}
+
+static void usbhelp(FILE *out)
+{
+	fprintf(out,"NEO Applet (OTP mode):\n\n"
+	"Usage: usb <command>\n\n"
+	"\tshow-status\t\tshow applet status\n"
+	"\tshow-serial\t\tshow device serial number\n"
+	"\tcalc-hmac\t\tcalculate HMCA_SHA1 challenge-response\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tchallenge\trequired, 1 to 64 bytes\n"
+	"\t\totpdigits\toptional, if set (6-8) print otp format\n"
+	"\t\t\t\tresults may be memoized (-m), requires serial\n"
+	"\tcalc-otp\t\tcalcuate Yubico OTP challenge-response\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tchallenge\trequired, 6 bytes\n"
+	"\tset-ndef\t\tconfigure NDEF message\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\turl\t\t(this or 'text' and 'lang'), the url to store\n"
+	"\t\ttext\t\t(this and 'lang' or 'url'), the text to store\n"
+	"\t\tlang\t\t(this and 'text' or 'url'), language to store\n"
+	"\tset-scanmap\t\tconfigure device scan code map\n"
+	"\t\tscanmap\t\toptional, 45 byte scan map\n"
+	"\tset-mode\t\tconfigure device operation mode\n"
+	"\t\tmode\t\trequired, operation mode (0-6)\n"
+	"\t\tcrtimeout\trequired, challenge-response timeout\n"
+	"\t\tautoejecttime\trequired, auto eject time\n"
+	"\treset-slot\t\treset configuration of a slot\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\tswap-slots\t\texchange both slots\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\tupdate-slot\t\tupdate configuration options for a slot\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tticketflags\trequired, ticket flags\n"
+	"\t\tconfigflags\trequired, configuration flags\n"
+	"\t\textendedflags\trequired, extended flags\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\tconfig-hmac\t\tconfigure HMAC-SHA1 challenge-response\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tsecretkey\trequired, hash secret key (20 bytes)\n"
+	"\t\tticketflags\trequired, ticket flags\n"
+	"\t\tconfigflags\trequired, configuration flags\n"
+	"\t\textendedflags\trequired, extended flags\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\t\tverify\t\toptional, if set verify with one challenge\n"
+	"\tconfig-otp\t\tconfigure Yubico OTP challenge-response\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
+	"\t\tticketflags\trequired, ticket flags\n"
+	"\t\tconfigflags\trequired, configuration flags\n"
+	"\t\textendedflags\trequired, extended flags\n"
+	"\t\tprivateid\toptional, private identity (6 bytes)\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\t\tverify\t\toptional, if set verify with one challenge\n"
+	"\tconfig-hotp\t\tconfigure HOTP for a slot\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tsecretkey\trequired, hash secret key (20 bytes)\n"
+	"\t\tomp\t\trequired, (0-255, 0 if not used)\n"
+	"\t\ttt\t\trequired, (0-255, 0 if not used)\n"
+	"\t\tmui\t\trequired, (0-99999999, -1 if not used)\n"
+	"\t\timf\t\trequired, (0-0xffff0, increments of 16)\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\tconfig-yubiotp\t\tconfigure Yubico OTP for a slot\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
+	"\t\tticketflags\trequired, ticket flags\n"
+	"\t\tconfigflags\trequired, configuration flags\n"
+	"\t\textendedflags\trequired, extended flags\n"
+	"\t\tprivateid\toptional, private identity (6 bytes)\n"
+	"\t\tpublicid\toptional, public identity (1-16 bytes)\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
+	"\tconfig-password\t\tconfigure static password for a slot\n"
+	"\t\tslot\t\trequired, slot number(0 or 1)\n"
+	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
+	"\t\tticketflags\trequired, ticket flags\n"
+	"\t\tconfigflags\trequired, configuration flags\n"
+	"\t\textendedflags\trequired, extended flags\n"
+	"\t\tprivateid\trequired, private identity (6 bytes)\n"
+	"\t\tpublicid\toptional, public identity (1-16 bytes)\n"
+	"\t\taccesscode\toptional, current access code (6 bytes)\n"
+	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n");
+}
+
+static void applyhelp(FILE *out)
+{
+	fprintf(out,"Desired state:\n\n"
+	"Usage: apply <file>\n\n"
+	"\tExecutes the state file line by line, empty lines and lines\n"
+	"\tstarting with '#' are ignored. Allowed are 'set' and 'clear'\n"
+	"\tas well as the following commands which are skipped if the\n"
+	"\tdevice already is in the declared state:\n\n"
+	"\tneo set-mode\t\tmode, crtimeout and autoejecttime match\n"
+	"\tneo set-mode-mgr\tmode, crtimeout and autoejecttime match\n"
+	"\tneo set-ndef\t\tslot 0 only, stored url or text matches\n"
+	"\tneo reset-slot\t\tslot is not configured\n"
+	"\tusb reset-slot\t\tslot is not configured\n"
+	"\tneo config-*\t\tslot is configured and needs a button touch\n"
+	"\t\t\t\texactly if configflags ask for it (always for\n"
+	"\t\t\t\thotp, yubiotp and password)\n"
+	"\tusb config-*\t\tsame as neo config-*\n"
+	"\toath add-change-entry\tTOTP entry without touch and with same\n"
+	"\t\t\t\tshamode and digits exists\n"
+	"\toath delete-entry\tentry does not exist\n\n"
+	"\tSlot and OATH secrets cannot be read back, to change them\n"
+	"\treset the slot or delete the entry first. Everything that\n"
+	"\tcannot be checked on the device (slot 1 NDEF, HOTP entries)\n"
+	"\tis always written.\n");
+}
+
+static void queuehelp(FILE *out)
+{
+	fprintf(out,"Command queue:\n\n"
+	"Usage: queue\n\n"
+	"\tAll neo, ndef, oath and usb commands of a process for the same\n"
+	"\tserial number are queued. When the device becomes free the\n"
+	"\toldest command of the highest class is executed next:\n\n"
+	"\tinteractive\tcalc-otp, calc-hmac, calc-yubiotp, calc-all-totp,\n"
+	"\t\t\tpublish-totp, show-serial\n"
+	"\tnormal\t\tall other show commands and list-all\n"
+	"\tbulk\t\tall writes\n\n"
+	"\t'queue' prints the number of commands and the average and\n"
+	"\tmaximum queue wait in microseconds per class.\n");
+}
+
+static void help(SHELL *sh,char *item)
+{
+	if(item)
+	{
+		if(!strcmp(item,"var"))varhelp(sh->out);
+		else if(!strcmp(item,"neo"))neohelp(sh->out);
+		else if(!strcmp(item,"ndef"))ndefhelp(sh->out);
+		else if(!strcmp(item,"oath"))oathhelp(sh->out);
+		else if(!strcmp(item,"usb"))usbhelp(sh->out);
+		else if(!strcmp(item,"apply"))applyhelp(sh->out);
+		else if(!strcmp(item,"queue"))queuehelp(sh->out);
+		else item=NULL;
+	}
+
+	if(!item)
+	{
+		fprintf(sh->out,"Help items:\n"
+		"\n"
+		"var\thelp related to variables\n"
+		"neo\thelp for neo applet commands (ccid mode)\n"
+		"ndef\thelp for ndef applet commands (ccid mode)\n"
+		"oath\thelp for oath applet commands (ccid mode)\n"
+		"usb\thelp for usb related commands (otp mode)\n"
+		"apply\thelp for applying a desired state file\n"
+		"queue\thelp for the device command queue\n");
+		return;
+	}
+}
+
+static long long mark(SHELL *sh)
+{
+	return sh->metrics?neosc_metrics_now():0;
+}
+
+static long long metric(SHELL *sh,int kind,long long start)
+{
+	long long t;
+
+	if(!sh->metrics)return 0;
+	t=neosc_metrics_now();
+	neosc_metrics_time(sh->metrics,kind,
+		sh->var[SERIAL].valid?sh->var[SERIAL].value:0,NULL,t-start);
+	return t;
+}
+
+static void cachestat(SHELL *sh,char *name,int hit)
+{
+	if(sh->metrics)neosc_metrics_count(sh->metrics,
+		hit?NEOSC_METRIC_HIT:NEOSC_METRIC_MISS,
+		sh->var[SERIAL].valid?sh->var[SERIAL].value:0,name,0);
+}
+
+static void sessionend(SHELL *sh)
+{
+	if(!sh->session)return;
+	neosc_pcsc_close(sh->session);
+	sh->session=NULL;
+	sh->sessionok=0;
+	memclear(&sh->sessioninfo,0,sizeof(sh->sessioninfo));
+}
+
+/*
+ * Without a serial number every open may reach another device, so the
+ * device facts and all templates evaluated with them are dropped.
+ */
+static void newcard(SHELL *sh,int serial)
+{
+	int i;
+
+	if(serial>0)return;
+	sh->facts=0;
+	for(i=0;i<TOTALVARS;i++)if(sh->var[i].tmpl==2)sh->var[i].tmpl=1;
+}
+
+static int devlock(SHELL *sh,int serial,void **ctx)
+{
+	long long t;
+
+	sh->lockfd=-1;
+	sh->lockwait=0;
+	sh->applet=0;
+	sh->nfctried=1;
+
+	if(sh->lockd)
+	{
+		if((sh->lockfd=neosc_lockd_acquire(sh->lockd,serial,
+			sh->lockprio,&sh->lockwait))==-1)goto err1;
+		sh->locktime+=sh->lockwait;
+		if(sh->metrics)neosc_metrics_time(sh->metrics,
+			NEOSC_METRIC_LOCKWAIT,serial,NULL,sh->lockwait);
+	}
+	if(sh->session&&sh->sessionserial==serial)
+	{
+		t=neosc_metrics_now();
+		if(!neosc_pcsc_lock(sh->session))
+		{
+			*ctx=sh->session;
+			sh->locktime+=neosc_metrics_now()-t;
+			metric(sh,NEOSC_METRIC_LOCK,t);
+			return 0;
+		}
+		sessionend(sh);
+	}
+	t=mark(sh);
+	if(neosc_pcsc_open(ctx,serial))goto err2;
+	newcard(sh,serial);
+	metric(sh,NEOSC_METRIC_OPEN,t);
+	t=neosc_metrics_now();
+	if(neosc_pcsc_lock(*ctx))goto err3;
+	sh->locktime+=neosc_metrics_now()-t;
+	metric(sh,NEOSC_METRIC_LOCK,t);
+	return 0;
+
+err3:	neosc_pcsc_close(*ctx);
+err2:	neosc_lockd_release(sh->lockfd);
+	sh->lockfd=-1;
+	sh->nfclost=1;
+err1:	return -1;
+}
+
+/*
+ * libneosc cannot tell which applet was active before, so the configured
+ * home applet is restored if a different one was selected meanwhile.
+ */
+static void devunlock(SHELL *sh,void *ctx)
+{
+	if(sh->home&&sh->applet&&sh->applet!=sh->home)
+	{
+		switch(sh->home)
+		{
+		case NEOSC_SHELL_APPLET_NEO:
+			neosc_neo_select(ctx,NULL);
+			break;
+		case NEOSC_SHELL_APPLET_NDEF:
+			neosc_ndef_select(ctx);
+			break;
+		case NEOSC_SHELL_APPLET_OATH:
+			neosc_oath_select(ctx,NULL);
+			break;
+		case NEOSC_SHELL_APPLET_PGP:
+			neosc_pgp_select(ctx);
+			break;
+		case NEOSC_SHELL_APPLET_PIV:
+			neosc_piv_select(ctx);
+			break;
+		}
+		sh->applet=sh->home;
+	}
+	if(sh->applet&&sh->applet!=NEOSC_SHELL_APPLET_OATH)sh->sessionok=0;
+	neosc_pcsc_unlock(ctx);
+	if(ctx!=sh->session)neosc_pcsc_close(ctx);
+	neosc_lockd_release(sh->lockfd);
+	sh->lockfd=-1;
+}
+
+static time_t uptime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec;
+}
+
+/*
+ * HMAC-SHA1 responses are only memoized for a known serial, the slot
+ * configuration is considered unchanged as long as pgmseq is unchanged.
+ */
+static int memoget(SHELL *sh,int serial,int pgmseq,unsigned char *bfr)
+{
+	int i;
+	time_t now;
+	MEMO *m;
+
+	if(!sh->memo||serial<=0||sh->var[CHALLENGE].len>MEMOCHAL)return -1;
+
+	for(now=uptime(),i=0;i<MAXMEMO;i++)
+	{
+		m=&sh->memo[i];
+		if(!m->uses)continue;
+		if(m->expiry<=now||(m->serial==serial&&m->pgmseq!=pgmseq))
+		{
+			memclear(m,0,sizeof(MEMO));
+			continue;
+		}
+		if(m->serial!=serial||m->slot!=sh->var[SLOT].value||
+			m->len!=sh->var[CHALLENGE].len||
+			memcmp(m->challenge,sh->var[CHALLENGE].data,m->len))
+			continue;
+		memcpy(bfr,m->response,NEOSC_SHA1_SIZE);
+		if(!--m->uses)memclear(m,0,sizeof(MEMO));
+		cachestat(sh,"hmac",1);
+		return 0;
+	}
+	cachestat(sh,"hmac",0);
+	return -1;
+}
+
+static void memoput(SHELL *sh,int serial,int pgmseq,unsigned char *bfr)
+{
+	int i;
+	int j;
+	MEMO *m;
+
+	if(!sh->memo||serial<=0||sh->var[CHALLENGE].len>MEMOCHAL)return;
+
+	for(i=0,j=1;j<MAXMEMO;j++)if(sh->memo[j].expiry<sh->memo[i].expiry)
+		i=j;
+	m=&sh->memo[i];
+	m->serial=serial;
+	m->slot=sh->var[SLOT].value;
+	m->pgmseq=pgmseq;
+	m->uses=sh->memouses;
+	m->expiry=uptime()+sh->memottl;
+	m->len=sh->var[CHALLENGE].len;
+	memcpy(m->challenge,sh->var[CHALLENGE].data,m->len);
+	memcpy(m->response,bfr,NEOSC_SHA1_SIZE);
+}
+
+static void memofree(SHELL *sh)
+{
+	if(!sh->memo)return;
+	memclear(sh->memo,0,MAXMEMO*sizeof(MEMO));
+	munlock(sh->memo,MAXMEMO*sizeof(MEMO));
+	munmap(sh->memo,MAXMEMO*sizeof(MEMO));
+	sh->memo=NULL;
+}
+
+static unsigned char *masteralloc(void)
+{
+	void *p;
+
+	if((p=mmap(NULL,NEOSC_CRYPTO_MAXKEY,PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS,-1,0))==MAP_FAILED)return NULL;
+	if(mlock(p,NEOSC_CRYPTO_MAXKEY))
+	{
+		munmap(p,NEOSC_CRYPTO_MAXKEY);
+		return NULL;
+	}
+	madvise(p,NEOSC_CRYPTO_MAXKEY,MADV_DONTDUMP);
+	return p;
+}
+
+static void masterfree(SHELL *sh)
+{
+	if(!sh->master)return;
+	memclear(sh->master,0,NEOSC_CRYPTO_MAXKEY);
+	munlock(sh->master,NEOSC_CRYPTO_MAXKEY);
+	munmap(sh->master,NEOSC_CRYPTO_MAXKEY);
+	sh->master=NULL;
+	sh->masterlen=0;
+}
+
+static void listfree(NEOSC_OATH_LIST *list,int total)
+{
+	int i;
+
+	for(i=0;i<total;i++)
+	{
+		memclear(list[i].name,0,sizeof(list[i].name));
+		memclear(&list[i].otpmode,0,sizeof(list[i].otpmode));
+		memclear(&list[i].shamode,0,sizeof(list[i].shamode));
+	}
+	if(list)free(list);
+}
+
+static int cacheload(SHELL *sh,int serial,CACHE *cache)
+{
+	int len;
+	FILE *fp;
+	NEOSC_STATUS *s=&cache->status;
+	char path[PATH_MAX];
+	char line[256];
+
+	memset(cache,0,sizeof(CACHE));
+
+	if(!sh->cachedir||serial<=0)return -1;
+	snprintf(path,sizeof(path),"%s/%d",sh->cachedir,serial);
+	if(!(fp=fopen(path,"re")))return -1;
+
+	while(fgets(line,sizeof(line),fp))
+	{
+		if((len=strlen(line))&&line[len-1]=='\n')line[--len]=0;
+
+		if(sscanf(line,"neo %d %d %d %d %d %d %d %d %d %d",
+			&s->pgmseq,&s->major,&s->minor,&s->build,
+			&s->touchlevel,&s->config1,&s->config2,&s->touch1,
+			&s->touch2,&s->ledinv)==10)cache->neo=1;
+		else goto fail;
+	}
+
+	fclose(fp);
+	memclear(line,0,sizeof(line));
+	return 0;
+
+fail:	fclose(fp);
+	memclear(line,0,sizeof(line));
+	memset(cache,0,sizeof(CACHE));
+	return -1;
+}
+
+static void cachesave(SHELL *sh,int serial,CACHE *cache)
+{
+	FILE *fp;
+	NEOSC_STATUS *s=&cache->status;
+	char path[PATH_MAX];
+	char tmp[PATH_MAX];
+
+	if(!sh->cachedir||serial<=0)return;
+	snprintf(path,sizeof(path),"%s/%d",sh->cachedir,serial);
+	snprintf(tmp,sizeof(tmp),"%s/.%d.tmp",sh->cachedir,serial);
+	if(!(fp=fopen(tmp,"we")))return;
+	fchmod(fileno(fp),0600);
+
+	if(cache->neo)fprintf(fp,"neo %d %d %d %d %d %d %d %d %d %d\n",
+		s->pgmseq,s->major,s->minor,s->build,s->touchlevel,
+		s->config1,s->config2,s->touch1,s->touch2,s->ledinv);
+
+	if(fclose(fp))goto err;
+	if(rename(tmp,path))goto err;
+	return;
+
+err:	unlink(tmp);
+}
+
+static void cachefree(CACHE *cache)
+{
+	memclear(cache,0,sizeof(CACHE));
+}
+
+static int oathlist(SHELL *sh,NEOSC_OATH_LIST *list,int total)
+{
+	int i;
+	char txt[16];
+
+	for(i=0;i<total;i++)
+	{
+		snprintf(txt,sizeof(txt),"%s-%s",
+		    list[i].otpmode==NEOSC_OATH_HOTP?"hotp":"totp",
+		    list[i].shamode==NEOSC_OATH_SHA1?"sha1":"sha256");
+		emit(sh,txt,": ","%s",list[i].name);
+	}
+	return 0;
+}
+
+static int invserial(SHELL *sh,void *ctx,int usb)
+{
+	int serial;
+
+	if(sh->var[SERIAL].valid&&sh->var[SERIAL].value>0)
+		return sh->var[SERIAL].value;
+	if(usb?neosc_usb_read_serial(ctx,&serial):
+		neosc_neo_read_serial(ctx,&serial))return -1;
+	return serial;
+}
+
+static void neoinventory(SHELL *sh,void *ctx,NEOSC_NEO_INFO *info)
+{
+	int serial;
+
+	if((serial=invserial(sh,ctx,0))<=0)return;
+	pthread_mutex_lock(&sh->invmtx);
+	neosc_inventory_device(sh->inventory,serial,info->major,info->minor,
+		info->build,info->pgmseq,(info->config1?NEOSC_INV_SLOT1:0)|
+		(info->config2?NEOSC_INV_SLOT2:0)|
+		(info->touch1?NEOSC_INV_TOUCH1:0)|
+		(info->touch2?NEOSC_INV_TOUCH2:0));
+	neosc_inventory_mode(sh->inventory,serial,info->mode);
+	neosc_inventory_sync(sh->inventory);
+	pthread_mutex_unlock(&sh->invmtx);
+}
+
+static void usbinventory(SHELL *sh,void *ctx,NEOSC_STATUS *status,int mode)
+{
+	int serial;
+
+	if((serial=invserial(sh,ctx,1))<=0)return;
+	pthread_mutex_lock(&sh->invmtx);
+	neosc_inventory_device(sh->inventory,serial,status->major,
+		status->minor,status->build,status->pgmseq,
+		(status->config1?NEOSC_INV_SLOT1:0)|
+		(status->config2?NEOSC_INV_SLOT2:0)|
+		(status->touch1?NEOSC_INV_TOUCH1:0)|
+		(status->touch2?NEOSC_INV_TOUCH2:0));
+	neosc_inventory_mode(sh->inventory,serial,mode);
+	neosc_inventory_sync(sh->inventory);
+	pthread_mutex_unlock(&sh->invmtx);
+}
+
+static void oathinventory(SHELL *sh,int serial,NEOSC_OATH_LIST *list,
+	int total)
+{
+	int i;
+
+	if(!sh->inventory||serial<=0)return;
+	pthread_mutex_lock(&sh->invmtx);
+	neosc_inventory_oath(sh->inventory,serial,NULL);
+	for(i=0;i<total;i++)neosc_inventory_oath(sh->inventory,serial,
+		list[i].name);
+	neosc_inventory_sync(sh->inventory);
+	pthread_mutex_unlock(&sh->invmtx);
+}
+
+static int varparse(VAR *v,char *value)
+{
+	int r=-1;
+	int j;
+	int k;
+	int len=MAXLEN;
+	unsigned long long val;
+	char *eptr;
+	struct tm tm;
+	unsigned char bfr[2*MAXLEN+1];
+
+	if(!strncmp(value,"h:",2))
+	{
+		if(neosc_util_hex_decode(value+2,strlen(value+2),bfr,
+			&len))goto fail;
+	}
+	else if(!strncmp(value,"m:",2))
+	{
+		if(neosc_util_modhex_decode(value+2,strlen(value+2),bfr,
+			&len))goto fail;
+	}
+	else if(!strncmp(value,"b64:",4))
+	{
+		if(neosc_util_base64_decode(value+4,strlen(value+4),bfr,
+			&len))goto fail;
+	}
+	else if(!strncmp(value,"b32:",4))
+	{
+		if(neosc_util_base32_decode(value+4,strlen(value+4),bfr,
+			&len))goto fail;
+	}
+	else if(!strncmp(value,"t:",2))
+	{
+		if(v->type!=ARR)goto fail;
+		if(!strcmp(value+2,"now"))val=time(NULL);
+		else
+		{
+			memset(&tm,0,sizeof(tm));
+			if(strptime(value+2,"%n%Y-%m-%d%n%T",&tm))
+				goto fail;
+			val=mktime(&tm);
+		}
+		neosc_util_time_to_array((time_t)val,bfr,8);
+		len=8;
+	}
+	else if(!strncmp(value,"s:",2))
+	{
+		if(v->type!=ARR)goto fail;
+		if((len=strlen(value+2))>MAXLEN)goto fail;
+		strcpy((char *)bfr,value+2);
+	}
+	else if(!strncmp(value,"r:",2))
+	{
+		if(v->type!=ARR)goto fail;
+		val=strtoull(value+2,&eptr,10);
+		if(eptr==value+2||*eptr)goto fail;
+		if(val>MAXLEN)goto fail;
+		len=(int)val;
+		if(neosc_util_random(bfr,len))goto fail;
+	}
+	else
+	{
+		val=strtoull(value,&eptr,10);
+		if(eptr==value||*eptr)goto fail;
+		for(len=8,k=0,j=56;k<8;k++,j-=8)
+			bfr[k]=(unsigned char)(val>>j);
+	}
+	if(v->type==ARR)
+	{
+		memcpy(v->data,bfr,len);
+		v->len=len;
+		v->data[len]=0;
+	}
+	else
+	{
+		for(v->value=0,j=0;j<len;j++)
+		{
+			v->value<<=8;
+			v->value|=bfr[j];
+		}
+		switch(v->type)
+		{
+		case INT1:
+			j=~0xff;
+			break;
+		case INT2:
+			j=~0xffff;
+			break;
+		case INT3:
+			j=~0xffff;
+			break;
+		case INT4:
+			j=~0xffffff;
+			break;
+		}
+		if((*value=='-'?-v->value:v->value)&j)goto fail;
+	}
+	v->valid=1;
+	r=0;
+
+fail:	memclear(&tm,0,sizeof(tm));
+	memclear(&val,0,sizeof(val));
+	memclear(bfr,0,sizeof(bfr));
+	return r;
+}
+
+static int getfacts(SHELL *sh,void *ctx,int usb)
+{
+	int key;
+	NEOSC_NEO_INFO info;
+	NEOSC_STATUS status;
+	VAR *var=sh->var;
+
+	key=var[SERIAL].valid?var[SERIAL].value:0;
+	if(sh->facts&&sh->factkey==key)return 0;
+
+	if(usb)
+	{
+		if(neosc_usb_read_serial(ctx,&sh->factserial))return -1;
+		if(neosc_usb_read_status(ctx,&status))return -1;
+		sh->factmajor=status.major;
+		sh->factminor=status.minor;
+		sh->factbuild=status.build;
+		memclear(&status,0,sizeof(status));
+	}
+	else
+	{
+		sh->applet=NEOSC_SHELL_APPLET_NEO;
+		if(neosc_neo_select(ctx,&info))return -1;
+		if(neosc_neo_read_serial(ctx,&sh->factserial))return -1;
+		sh->factmajor=info.major;
+		sh->factminor=info.minor;
+		sh->factbuild=info.build;
+		memclear(&info,0,sizeof(info));
+	}
+
+	sh->factkey=key;
+	sh->facts=1;
+	return 0;
+}
+
+/*
+ * Only the NEO has NFC and the NDEF applet and sets the mode through
+ * the OTP applet, the YubiKey 4 has neither and uses the manager applet.
+ * The model is taken from the NEO applet select and kept per serial for
+ * the lifetime of the context, the NFC and YubiKey 4 selectors imply it.
+ */
+static int capsknown(SHELL *sh,int serial)
+{
+	int i;
+
+	switch(serial)
+	{
+	case NEOSC_NFC_YUBIKEY:
+		return CAPNFC|CAPNDEF;
+	case NEOSC_U2F_YUBIKEY4:
+	case NEOSC_NOU2F_YUBIKEY4:
+		return CAPMGR;
+	}
+	if(serial>0)for(i=0;i<MAXCAPS;i++)if(sh->caps[i].serial==serial)
+		return sh->caps[i].caps;
+	return -1;
+}
+
+static int capsput(SHELL *sh,int serial,NEOSC_NEO_INFO *info)
+{
+	int i;
+	int caps;
+
+	caps=info->major>=4?CAPMGR:CAPNFC|CAPNDEF;
+	if(serial<=0)return caps;
+
+	for(i=0;i<MAXCAPS;i++)if(sh->caps[i].serial==serial)break;
+	if(i==MAXCAPS)
+	{
+		i=sh->capnext;
+		sh->capnext=(sh->capnext+1)%MAXCAPS;
+	}
+	sh->caps[i].serial=serial;
+	sh->caps[i].major=info->major;
+	sh->caps[i].minor=info->minor;
+	sh->caps[i].build=info->build;
+	sh->caps[i].caps=caps;
+	return caps;
+}
+
+static int subst(SHELL *sh,void *ctx,int usb,int idx,int depth)
+{
+	int r=-1;
+	int i;
+	int n;
+	int len;
+	int fmt;
+	int serial;
+	char *p;
+	char *e;
+	unsigned char num[4];
+	unsigned char key[MAXLEN/2];
+	char name[32];
+	char res[MAXLEN+1];
+	VAR *var=sh->var;
+
+	if(depth>TOTALVARS)return -1;
+
+	for(n=0,p=var[idx].format;*p;)
+	{
+		if(*p!='%'||(p[1]!='%'&&p[1]!='{'))
+		{
+			if(n==MAXLEN)goto fail;
+			res[n++]=*p++;
+			continue;
+		}
+		else if(p[1]=='%')
+		{
+			if(n==MAXLEN)goto fail;
+			res[n++]='%';
+			p+=2;
+			continue;
+		}
+
+		if(!(e=strchr(p+2,'}'))||e-p-2>=sizeof(name))goto fail;
+		memcpy(name,p+2,e-p-2);
+		name[e-p-2]=0;
+		p=e+1;
+
+		len=MAXLEN+1-n;
+
+		if(!strncmp(name,"derive:",7))
+		{
+			if(!sh->master||(i=atoi(name+7))<=0||i>MAXLEN/2)
+				goto fail;
+			/* the serial number is always read from the card */
+
+			if(getfacts(sh,ctx,usb)||(serial=sh->factserial)<=0)
+				goto fail;
+			if(var[SERIAL].valid&&var[SERIAL].value>0&&
+				var[SERIAL].value!=serial)goto fail;
+			if(neosc_crypto_derive(sh->master,sh->masterlen,
+				var[idx].name,serial,var[SLOT].valid?
+				var[SLOT].value:-1,key,i))goto fail;
+			if(neosc_util_hex_encode(key,i,res+n,&len))goto fail;
+			if(len<0||n+len>MAXLEN)goto fail;
+			n+=len;
+			continue;
+		}
+
+		fmt=0;
+		if((e=strchr(name,':')))
+		{
+			if(!strcmp(e+1,"x"))fmt=1;
+			else if(!strcmp(e+1,"m"))fmt=2;
+			else goto fail;
+			*e=0;
+		}
+
+		if(!strcmp(name,"version"))
+		{
+			if(fmt||getfacts(sh,ctx,usb))goto fail;
+			len=snprintf(res+n,len,"%d.%d.%d",sh->factmajor,
+				sh->factminor,sh->factbuild);
+		}
+		else if(!strcmp(name,"serial"))
+		{
+			if(var[SERIAL].valid&&var[SERIAL].value>0)
+				i=var[SERIAL].value;
+			else if(getfacts(sh,ctx,usb))goto fail;
+			else i=sh->factserial;
+			num[0]=(unsigned char)(i>>24);
+			num[1]=(unsigned char)(i>>16);
+			num[2]=(unsigned char)(i>>8);
+			num[3]=(unsigned char)i;
+			switch(fmt)
+			{
+			case 0:	len=snprintf(res+n,len,"%d",i);
+				break;
+			case 1:	if(neosc_util_hex_encode(num,4,res+n,&len))
+					goto fail;
+				break;
+			case 2:	if(neosc_util_modhex_encode(num,4,res+n,&len))
+					goto fail;
+				break;
+			}
+		}
+		else
+		{
+			for(i=0;i<TOTALVARS;i++)if(!strcmp(var[i].name,name))
+				break;
+			if(i==TOTALVARS||i==idx||!var[i].valid)goto fail;
+			if(var[i].tmpl==1)if(subst(sh,ctx,usb,i,depth+1))
+				goto fail;
+			if(var[i].type!=ARR)
+			{
+				num[0]=(unsigned char)(var[i].value>>24);
+				num[1]=(unsigned char)(var[i].value>>16);
+				num[2]=(unsigned char)(var[i].value>>8);
+				num[3]=(unsigned char)var[i].value;
+			}
+			switch(fmt|(var[i].type==ARR?4:0))
+			{
+			case 0:	len=snprintf(res+n,len,"%d",var[i].value);
+				break;
+			case 1:	if(neosc_util_hex_encode(num+3-var[i].type,
+					var[i].type+1,res+n,&len))goto fail;
+				break;
+			case 2:	if(neosc_util_modhex_encode(num+3-var[i].type,
+					var[i].type+1,res+n,&len))goto fail;
+				break;
+			case 4:	if(var[i].len>=len||
+				    memchr(var[i].data,0,var[i].len))goto fail;
+				memcpy(res+n,var[i].data,var[i].len);
+				len=var[i].len;
+				break;
+			case 5:	if(neosc_util_hex_encode(var[i].data,
+					var[i].len,res+n,&len))goto fail;
+				break;
+			case 6:	if(neosc_util_modhex_encode(var[i].data,
+					var[i].len,res+n,&len))goto fail;
+				break;
+			}
+		}
+
+		if(len<0||n+len>MAXLEN)goto fail;
+		n+=len;
+	}
+
+	res[n]=0;
+	if(varparse(&var[idx],res))goto fail;
+	var[idx].tmpl=2;
+	r=0;
+
+fail:	memclear(res,0,sizeof(res));
+	memclear(num,0,sizeof(num));
+	memclear(key,0,sizeof(key));
+	return r;
+}
+
+static int expand(SHELL *sh,void *ctx,int usb)
+{
+	int i;
+
+	for(i=0;i<TOTALVARS;i++)if(sh->var[i].valid&&sh->var[i].tmpl==1)
+		if(subst(sh,ctx,usb,i,0))return -1;
+	return 0;
+}
+
+static int varhandler(SHELL *sh,int mode,char *name,char *value)
+{
+	int r=-1;
+	int i;
+	int j;
+	int len;
+	unsigned char bfr[2*MAXLEN+1];
+	VAR *var=sh->var;
+
+	for(i=0;i<TOTALVARS;i++)if(!strcmp(var[i].name,name))break;
+	if(i==TOTALVARS)goto fail;
+
+	if(mode>1&&var[i].valid&&var[i].tmpl==1)
+	{
+		emit(sh,"f",":","%s",var[i].format);
+		r=0;
+		goto fail;
+	}
+
+	/*
+	 * serial, timeout and nfcgrace are used before a device is opened,
+	 * i.e. before templates can be evaluated
+	 */
+
+	switch(mode)
+	{
+	case 0:	if((!strncmp(value,"f:",2)||!strncmp(value,"k:",2))&&
+			(i==SERIAL||i==TIMEOUT||i==NFCGRACE))goto fail;
+		if(!strncmp(value,"f:",2))
+		{
+			if(strlen(value+2)>MAXLEN)goto fail;
+			strcpy(var[i].format,value+2);
+			var[i].tmpl=1;
+			var[i].len=0;
+			var[i].valid=1;
+		}
+		else if(!strncmp(value,"k:",2))
+		{
+			if(var[i].type!=ARR||!sh->master)goto fail;
+			if((len=atoi(value+2))<=0||len>MAXLEN/2)goto fail;
+			sprintf(var[i].format,"h:%%{derive:%d}",len);
+			var[i].tmpl=1;
+			var[i].len=0;
+			var[i].valid=1;
+		}
+		else
+		{
+			if(varparse(&var[i],value))goto fail;
+			var[i].tmpl=0;
+		}
+		for(j=0;j<TOTALVARS;j++)if(var[j].tmpl==2)var[j].tmpl=1;
+		break;
+
+	case 1:	var[i].valid=0;
+		var[i].len=0;
+		var[i].tmpl=0;
+		for(j=0;j<TOTALVARS;j++)if(var[j].tmpl==2)var[j].tmpl=1;
+		break;
+
+	case 2:	if(!var[i].valid)strcpy((char *)bfr,"<undef>");
+		else switch(var[i].type)
+		{
+		case INT1:
+			sprintf((char *)bfr,"h:%02x",var[i].value);
+			break;
+		case INT2:
+			sprintf((char *)bfr,"h:%04x",var[i].value);
+			break;
+		case INT3:
+			sprintf((char *)bfr,"h:%06x",var[i].value);
+			break;
+		case INT4:
+			sprintf((char *)bfr,"h:%08x",var[i].value);
+			break;
+		case ARR:
+			strcpy((char *)bfr,"h:");
+			len=sizeof(bfr)-2;
+			if(neosc_util_hex_encode(var[i].data,var[i].len,
+				(char *)bfr+2,&len))goto fail;
+			break;
+		}
+		emit(sh,NULL,NULL,"%s",(char *)bfr);
+		break;
+
+	case 3:	if(var[i].type==ARR)goto fail;
+		else if(!var[i].valid)strcpy((char *)bfr,"<undef>");
+		else sprintf((char *)bfr,"%d",var[i].value);
+		emit(sh,NULL,NULL,"%s",(char *)bfr);
+		break;
+
+	case 4:	len=sizeof(bfr);
+		if(var[i].type!=ARR)goto fail;
+		else if(!var[i].valid)strcpy((char *)bfr,"<undef>");
+		else if(neosc_util_modhex_encode(var[i].data,var[i].len,
+			(char *)bfr,&len))goto fail;
+		emit(sh,"m",":","%s",(char *)bfr);
+		break;
+
+	case 5:	len=sizeof(bfr);
+		if(var[i].type!=ARR)goto fail;
+		else if(!var[i].valid)strcpy((char *)bfr,"<undef>");
+		else if(neosc_util_base32_encode(var[i].data,var[i].len,
+			(char *)bfr,&len))goto fail;
+		emit(sh,"b32",":","%s",(char *)bfr);
+		break;
+
+	case 6:	len=sizeof(bfr);
+		if(var[i].type!=ARR)goto fail;
+		else if(!var[i].valid)strcpy((char *)bfr,"<undef>");
+		else if(neosc_util_base64_encode(var[i].data,var[i].len,
+			(char *)bfr,&len))goto fail;
+		emit(sh,"b64",":","%s",(char *)bfr);
+		break;
+
+	default:goto fail;
+	}
+
+	r=0;
+
+fail:	memclear(bfr,0,sizeof(bfr));
+	return r;
+}
+
+/*
+ * A freshly written challenge-response slot is checked with a single
+ * random challenge against the locally computed response. HMAC-SHA1 is
+ * deterministic, a Yubico OTP response contains a counter and is thus
+ * decrypted with the written key and its checksum tested instead. In
+ * challenge-response mode the private identity field of the response
+ * holds the challenge, which is compared as well.
+ */
+static void verify(SHELL *sh,void *ctx,int usb,int otp)
+{
+	int r;
+	int len;
+	unsigned char chal[MEMOCHAL];
+	unsigned char exp[NEOSC_CRYPTO_HMAC_SIZE];
+	unsigned char bfr[MAXLEN];
+	VAR *var=sh->var;
+
+	if(otp)len=OTPCHAL;
+	else len=(var[CONFIGFLAGS].value&HMACLT64)?MEMOCHAL/2:MEMOCHAL;
+
+	if(!var[SECRETKEY].valid||neosc_util_random(chal,len))goto fail;
+	if(otp&&var[SECRETKEY].len!=NEOSC_CRYPTO_AES_SIZE)goto fail;
+
+	if(otp)r=usb?neosc_usb_read_otp(ctx,var[SLOT].value,chal,len,bfr,
+		sizeof(bfr)):neosc_neo_read_otp(ctx,var[SLOT].value,chal,len,
+		bfr,sizeof(bfr));
+	else r=usb?neosc_usb_read_hmac(ctx,var[SLOT].value,chal,len,bfr,
+		sizeof(bfr)):neosc_neo_read_hmac(ctx,var[SLOT].value,chal,len,
+		bfr,sizeof(bfr));
+	if(r)goto fail;
+
+	if(otp)r=neosc_crypto_otp_check(var[SECRETKEY].data,chal,bfr);
+	else
+	{
+		neosc_crypto_hmac_sha1(var[SECRETKEY].data,var[SECRETKEY].len,
+			chal,len,exp);
+		r=memcmp(exp,bfr,NEOSC_CRYPTO_HMAC_SIZE)?-1:0;
+	}
+
+	if(r)sh->mismatches++;
+	emit(sh,"verify",": ","%s",r?"mismatch":"ok");
+	goto out;
+
+fail:	sh->mismatches++;
+	emit(sh,"verify",": ","failed");
+out:	memclear(chal,0,sizeof(chal));
+	memclear(exp,0,sizeof(exp));
+	memclear(bfr,0,sizeof(bfr));
+}
+
+/*
+ * Called right before a slot write of a journaled step with the current
+ * program sequence. If an interrupted run already sent this write, a
+ * changed program sequence proves that it landed and it is skipped.
+ */
+static int landed(SHELL *sh,int pgmseq)
+{
+	int serial;
+
+	if(sh->jactive!=1)return 0;
+	if(sh->jpgmseq!=-1&&sh->jpgmseq!=pgmseq)
+	{
+		emit(sh,"journal",": ","landed");
+		return 1;
+	}
+	serial=sh->var[SERIAL].valid?sh->var[SERIAL].value:0;
+	neosc_journal_begin(sh->journal,serial,sh->step,pgmseq);
+	return 0;
+}
+
+/*
+ * Checked before the device is opened to save the access for plain values
+ * and again after expand() as a template may yield any mode.
+ */
+static int unsafe(SHELL *sh,int setmode)
+{
+	if(!setmode||!sh->var[MODE].valid||sh->var[MODE].tmpl==1)return 0;
+	return sh->var[MODE].value==0x03&&sh->enable<3;
+}
+
+static int neohandler(SHELL *sh,char *cmd)
+{
+	int mode=-1;
+	int serial=0;
+	int r=-1;
+	int val;
+	int len;
+	int caps;
+	long long t;
+	void *ctx;
+	NEOSC_NEO_INFO info;
+	NEOSC_STATUS status;
+	NEOSC_NDEF ndefdata;
+	CACHE cache;
+	unsigned char bfr[MAXLEN];
+	char txt[2*MAXLEN+1];
+	VAR *var=sh->var;
+
+	memset(&cache,0,sizeof(cache));
+
+	if(var[SERIAL].valid)serial=var[SERIAL].value;
+
+	if(!strcmp(cmd,"show-info"))mode=0;
+	else if(!strcmp(cmd,"show-status"))mode=1;
+	else if(!strcmp(cmd,"show-ndef"))mode=2;
+	else if(!strcmp(cmd,"calc-yubiotp"))
+	{
+		if(!var[SLOT].valid)goto err1;
+		mode=3;
+	}
+	else if(!strcmp(cmd,"calc-hmac"))
+	{
+		if(!var[SLOT].valid)goto err1;
+		if(!var[CHALLENGE].valid)goto err1;
+		mode=4;
+	}
+	else if(!strcmp(cmd,"calc-otp"))
+	{
+		if(!var[SLOT].valid)goto err1;
+		if(!var[CHALLENGE].valid)goto err1;
+		mode=5;
+	}
+	else if(!strcmp(cmd,"set-ndef"))
+	{
+		if(!var[SLOT].valid)goto err1;
+		mode=6;
+	}
+	else if(!strcmp(cmd,"set-scanmap"))mode=7;
+	else if(!strcmp(cmd,"set-mode"))
+	{
+		if(!var[MODE].valid)goto err1;
+		if(unsafe(sh,1))goto err1;
+		if(!var[CRTIMEOUT].valid)goto err1;
+		if(!var[AUTOEJECTTIME].valid)goto err1;
+		mode=8;
+	}
+	else if(!strcmp(cmd,"set-mode-mgr"))
+	{
+		if(!var[MODE].valid)goto err1;
+		if(unsafe(sh,1))goto err1;
+		if(!var[CRTIMEOUT].valid)goto err1;
+		if(!var[AUTOEJECTTIME].valid)goto err1;
+		mode=18;
+	}
+	else if(!strcmp(cmd,"reset-slot"))
+	{
+		if(!(sh->enable&1))goto err1;
+		if(!var[SLOT].valid)goto err1;
+		mode=9;
+	}
+	else if(!strcmp(cmd,"swap-slots"))mode=10;
+	else if(!strcmp(cmd,"update-slot"))
+	{
+		if(!var[SLOT].valid)goto err1;
+		if(!var[TICKETFLAGS].valid)goto err1;
+		if(!var[CONFIGFLAGS].valid)goto err1;
+		if(!var[EXTENDEDFLAGS].valid)goto err1;
+		mode=11;
+	}
+	else if(!strcmp(cmd,"config-hmac"))
+	{
+		if(!var[SLOT].valid)goto err1;
+		if(!var[TICKETFLAGS].valid)goto err1;
+		if(!var[CONFIGFLAGS].valid)goto err1;
+		if(!var[EXTENDEDFLAGS].valid)goto err1;
+		mode=12;
+	}
+	else if(!strcmp(cmd,"config-otp"))
+	{
+		if(!var[SLOT].valid)goto err1;
+		if(!var[TICKETFLAGS].valid)goto err1;
+		if(!var[CONFIGFLAGS].valid)goto err1;
+		if(!var[EXTENDEDFLAGS].valid)goto err1;
+		mode=13;
+	}
+	else if(!strcmp(cmd,"config-hotp"))
+	{
+		if(!var[SLOT].valid)goto err1;
+		if(!var[TICKETFLAGS].valid)goto err1;
+		if(!var[CONFIGFLAGS].valid)goto err1;
+		if(!var[EXTENDEDFLAGS].valid)goto err1;
+		if(!var[OMP].valid)goto err1;
+		if(!var[TT].valid)goto err1;
+		if(!var[MUI].valid)goto err1;
+		if(!var[IMF].valid)goto err1;
+		mode=14;
+	}
+	else if(!strcmp(cmd,"config-yubiotp"))
+	{
+		if(!var[SLOT].valid)goto err1;
+		if(!var[TICKETFLAGS].valid)goto err1;
+		if(!var[CONFIGFLAGS].valid)goto err1;
+		if(!var[EXTENDEDFLAGS].valid)goto err1;
+		mode=15;
+	}
+	else if(!strcmp(cmd,"config-password"))
+	{
+		if(!var[SLOT].valid)goto err1;
+		if(!var[TICKETFLAGS].valid)goto err1;
+		if(!var[CONFIGFLAGS].valid)goto err1;
+		if(!var[EXTENDEDFLAGS].valid)goto err1;
+		mode=16;
+	}
+	else if(!strcmp(cmd,"show-serial"))mode=17;
+	else if(!strcmp(cmd,"show-caps"))mode=19;
+	else goto err1;
+
+	if((caps=capsknown(sh,serial))!=-1)
+	{
+		if((mode==2||mode==3)&&!(caps&CAPNFC))goto err1;
+		if(mode==8||mode==18)mode=(caps&CAPMGR)?18:8;
+	}
+
+	if(devlock(sh,serial,&ctx))goto err1;
+	if(expand(sh,ctx,0))goto err2;
+	if(unsafe(sh,mode==8||mode==18))goto err2;
+	t=mark(sh);
+	if(mode==18&&caps!=-1)
+	{
+		sh->applet=-1;
+		if(neosc_neo_select_mgr(ctx))goto err2;
+	}
+	else
+	{
+		sh->applet=NEOSC_SHELL_APPLET_NEO;
+		if(neosc_neo_select(ctx,&info))goto err2;
+		caps=capsput(sh,serial,&info);
+		if((mode==2||mode==3)&&!(caps&CAPNFC))goto err2;
+		if((mode==8||mode==18)&&(mode=(caps&CAPMGR)?18:8)==18)
+		{
+			sh->applet=-1;
+			if(neosc_neo_select_mgr(ctx))goto err2;
+		}
+	}
+	metric(sh,NEOSC_METRIC_SELECT,t);
+
+	if(mode>=9&&mode<=16&&landed(sh,info.pgmseq))
+	{
+		r=0;
+		goto err2;
+	}
+
+	switch(mode)
+	{
+	case 0:	emit(sh,"version",": ","%d.%d.%d",info.major,info.minor,
+			info.build);
+		emit(sh,"pgmseq",": ","%d",info.pgmseq);
+		emit(sh,"touchlevel",": ","%d",info.touchlevel);
+		emit(sh,"mode",": ","%d",info.mode);
+		emit(sh,"crtimeout",": ","%d",info.crtimeout);
+		emit(sh,"autoejecttime",": ","%d",info.autoejecttime);
+		emitconfig(sh,info.config1,info.config2,info.touch1,info.touch2,
+			info.ledinv);
+		r=0;
+		break;
+
+	case 1:	if(cacheload(sh,serial,&cache)||!cache.neo||
+			cache.status.pgmseq!=info.pgmseq)
+		{
+			if(sh->cachedir)cachestat(sh,"meta",0);
+			if((r=neosc_neo_read_status(ctx,&status)))break;
+			cache.neo=1;
+			cache.status=status;
+			cachesave(sh,serial,&cache);
+		}
+		else
+		{
+			cachestat(sh,"meta",1);
+			status=cache.status;
+			r=0;
+		}
+		emit(sh,"version",": ","%d.%d.%d",status.major,status.minor,
+			status.build);
+		emit(sh,"pgmseq",": ","%d",status.pgmseq);
+		emit(sh,"touchlevel",": ","%d",status.touchlevel);
+		emitconfig(sh,status.config1,status.config2,status.touch1,status.touch2,
+			status.ledinv);
+		break;
+
+	case 2:	if((r=neosc_neo_read_ndef(ctx,&ndefdata)))break;
+		if(ndefdata.type==NEOSC_NDEF_TEXT)
+		{
+			emit(sh,"language",": ","%s",ndefdata.language);
+			emit(sh,"text",": ","%s",ndefdata.payload);
+		}
+		else emit(sh,"url",": ","%s",ndefdata.payload);
+		break;
+
+	case 3:	if((r=neosc_neo_read_yubiotp(ctx,var[SLOT].value,txt,
+			sizeof(txt))))break;
+		emit(sh,"otp",":","%s",txt);
+		break;
+
+	case 4:	if(memoget(sh,serial,info.pgmseq,bfr))
+		{
+			if((r=neosc_neo_read_hmac(ctx,var[SLOT].value,
+			    var[CHALLENGE].data,var[CHALLENGE].len,bfr,
+			    sizeof(bfr))))break;
+			memoput(sh,serial,info.pgmseq,bfr);
+		}
+		if(var[OTPDIGITS].valid)
+		{
+			if((r=neosc_util_sha1_to_otp(bfr,NEOSC_SHA1_SIZE,
+				var[OTPDIGITS].value,&val)))break;
+			switch(var[OTPDIGITS].value)
+			{
+			case 6:	emit(sh,"otp",":","%06d",val);
+				break;
+			case 7:	emit(sh,"otp",":","%07d",val);
+				break;
+			case 8:	emit(sh,"otp",":","%08d",val);
+				break;
+			default:r=-1;
+				break;
+			}
+		}
+		else
+		{
+			len=sizeof(txt);
+			if((r=neosc_util_hex_encode(bfr,NEOSC_SHA1_SIZE,txt,
+				&len)))break;
+			emit(sh,"h",":","%s",txt);
+		}
+		break;
+
+	case 5:	if((r=neosc_neo_read_otp(ctx,var[SLOT].value,
+		    var[CHALLENGE].data,var[CHALLENGE].len,bfr,sizeof(bfr))))
+			break;
+		len=sizeof(txt);
+		if((r=neosc_util_modhex_encode(bfr,16,txt,&len)))break;
+		emit(sh,"m",":","%s",txt);
+		break;
+
+	case 6:	r=neosc_neo_write_ndef(ctx,var[SLOT].value,
+			var[URL].valid?(char *)var[URL].data:NULL,
+			var[TEXT].valid?(char *)var[TEXT].data:NULL,
+			var[LANG].valid?(char *)var[LANG].data:NULL,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+
+	case 7:	r=neosc_neo_write_scanmap(ctx,
+			var[SCANMAP].valid?var[SCANMAP].data:NULL,
+			var[SCANMAP].len);
+		break;
+
+	case 8:	r=neosc_neo_setmode(ctx,var[MODE].value,var[CRTIMEOUT].value,
+			var[AUTOEJECTTIME].value);
+		break;
+
+	case 9:	r=neosc_neo_reset(ctx,var[SLOT].value);
+		break;
+
+	case 10:r=neosc_neo_swap(ctx,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+
+	case 11:r=neosc_neo_update(ctx,var[SLOT].value,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+
+	case 12:r=neosc_neo_hmac(ctx,var[SLOT].value,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		if(!r&&var[VERIFY].valid&&var[VERIFY].value)
+			verify(sh,ctx,0,0);
+		break;
+
+	case 13:r=neosc_neo_otp(ctx,var[SLOT].value,
+			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
+			var[PRIVATEID].len,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		if(!r&&var[VERIFY].valid&&var[VERIFY].value)
+			verify(sh,ctx,0,1);
+		break;
+
+	case 14:r=neosc_neo_hotp(ctx,var[SLOT].value,var[OMP].value,
+			var[TT].value,var[MUI].value,var[IMF].value,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+
+	case 15:r=neosc_neo_yubiotp(ctx,var[SLOT].value,
+			var[PUBLICID].valid?var[PUBLICID].data:NULL,
+			var[PUBLICID].len,
+			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
+			var[PRIVATEID].len,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+
+	case 16:r=neosc_neo_passwd(ctx,var[SLOT].value,
+			var[PUBLICID].valid?var[PUBLICID].data:NULL,
+			var[PUBLICID].len,
+			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
+			var[PRIVATEID].len,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+
+	case 17:if((r=neosc_neo_read_serial(ctx,&val)))break;
+		emit(sh,"serial",": ","%d",val);
+		break;
+
+	case 18:r=neosc_neo_setmode_mgr(ctx,var[MODE].value,
+			var[CRTIMEOUT].value,var[AUTOEJECTTIME].value);
+		break;
+
+	case 19:emit(sh,"model",": ","%s",
+			(caps&CAPMGR)?"YubiKey 4":"YubiKey NEO");
+		emit(sh,"version",": ","%d.%d.%d",info.major,info.minor,
+			info.build);
+		emit(sh,"nfc",": ","%s",(caps&CAPNFC)?"yes":"no");
+		emit(sh,"ndef",": ","%s",(caps&CAPNDEF)?"yes":"no");
+		emit(sh,"set-mode",": ","%s",(caps&CAPMGR)?"manager":"otp");
+		r=0;
+		break;
+	}
+
+	if(sh->inventory&&mode!=18)
+	{
+		if(mode<8||mode>16)neoinventory(sh,ctx,&info);
+		else if(!r&&!neosc_neo_select(ctx,&info))
+			neoinventory(sh,ctx,&info);
+	}
+
+err2:	devunlock(sh,ctx);
+err1:	cachefree(&cache);
+	memclear(&info,0,sizeof(info));
+	memclear(&status,0,sizeof(status));
+	memclear(&ndefdata,0,sizeof(ndefdata));
+	memclear(&serial,0,sizeof(serial));
+	memclear(&val,0,sizeof(val));
+	memclear(bfr,0,sizeof(bfr));
+	memclear(txt,0,sizeof(txt));
+	return r;
+}
+
+static int ndefhandler(SHELL *sh,char *cmd)
+{
+	int r=-1;
+	int mode=-1;
+	int serial=0;
+	int caps;
+	long long t;
+	void *ctx;
+	NEOSC_NDEF_CC ccdata;
+	NEOSC_NDEF ndefdata;
+	VAR *var=sh->var;
+
+	if(var[SERIAL].valid)serial=var[SERIAL].value;
+
+	if(!strcmp(cmd,"show-cc"))mode=0;
+	else if(!strcmp(cmd,"show-ndef"))mode=1;
+	else goto err1;
+
+	if((caps=capsknown(sh,serial))!=-1&&!(caps&CAPNDEF))goto err1;
+
+	if(devlock(sh,serial,&ctx))goto err1;
+	if(expand(sh,ctx,0))goto err2;
+	t=mark(sh);
+	sh->applet=NEOSC_SHELL_APPLET_NDEF;
+	if(neosc_ndef_select(ctx))goto err2;
+	metric(sh,NEOSC_METRIC_SELECT,t);
+
+	switch(mode)
+	{
+	case 0:	if((r=neosc_ndef_read_cc(ctx,&ccdata)))break;
+		emit(sh,"version",": ","%02x",ccdata.version);
+		emit(sh,"mle",": ","%04x",ccdata.mle);
+		emit(sh,"mlc",": ","%04x",ccdata.mlc);
+		emit(sh,"fileid",": ","%04x",ccdata.fileid);
+		emit(sh,"ndef_max",": ","%04x",ccdata.ndef_max);
+		emit(sh,"rcond",": ","%02x",ccdata.rcond);
+		emit(sh,"wcond",": ","%02x",ccdata.wcond);
+		break;
+
+	case 1:	if((r=neosc_ndef_read_ndef(ctx,&ndefdata)))break;
+		if(ndefdata.type==NEOSC_NDEF_TEXT)
+		{
+			emit(sh,"language",": ","%s",ndefdata.language);
+			emit(sh,"text",": ","%s",ndefdata.payload);
+		}
+		else emit(sh,"url",": ","%s",ndefdata.payload);
+		break;
+	}
+
+err2:	devunlock(sh,ctx);
+err1:	memclear(&serial,0,sizeof(serial));
+	memclear(&ccdata,0,sizeof(ccdata));
+	memclear(&ndefdata,0,sizeof(ndefdata));
+	return r;
+}
+
+static void totpfree(NEOSC_OATH_RESPONSE *results,int total)
+{
+	int i;
+
+	for(i=0;i<total;i++)
+	{
+		memclear(results[i].name,0,strlen(results[i].name));
+		memclear(&results[i].digits,0,sizeof(results[i].digits));
+		memclear(&results[i].value,0,sizeof(results[i].value));
+	}
+	if(results)free(results);
+}
+
+static void totpflush(SHELL *sh)
+{
+	if(sh->totp)totpfree(sh->totp,sh->totptotal);
+	sh->totp=NULL;
+	sh->totptotal=0;
+}
+
+static int totpshow(SHELL *sh,NEOSC_OATH_RESPONSE *results,int total,
+	int left)
+{
+	int i;
+	int r=0;
+
+	if(left)emit(sh,"valid",": ","%d",left);
+	for(i=0;i<total;i++)switch(results[i].digits)
+	{
+	case 6:	emit(sh,"totp",": ","%06d %s",results[i].value,
+			results[i].name);
+		break;
+	case 7:	emit(sh,"totp",": ","%07d %s",results[i].value,
+			results[i].name);
+		break;
+	case 8:	emit(sh,"totp",": ","%08d %s",results[i].value,
+			results[i].name);
+		break;
+	default:r=-1;
+		break;
+	}
+	return r;
+}
+
+/*
+ * HOTP entries and entries requiring touch carry no value and are
+ * skipped, the codes of the next time step are paired by name.
+ */
+static int publish(SHELL *sh,int serial,time_t now,
+	NEOSC_OATH_RESPONSE *results,int total,NEOSC_OATH_RESPONSE *next,
+	int nexttotal)
+{
+	int i;
+	int j;
+	int n;
+	NEOSC_TOTP_ENTRY entry[NEOSC_TOTP_MAX];
+
+	for(n=0,i=0;i<total&&n<NEOSC_TOTP_MAX;i++)
+	{
+		if(results[i].digits<6||results[i].digits>8)continue;
+		for(j=0;j<nexttotal;j++)if(!strcmp(results[i].name,next[j].name))
+			break;
+		if(j==nexttotal||next[j].digits!=results[i].digits)continue;
+		strncpy(entry[n].name,results[i].name,NEOSC_TOTP_NAMELEN-1);
+		entry[n].name[NEOSC_TOTP_NAMELEN-1]=0;
+		entry[n].digits=results[i].digits;
+		entry[n].value=results[i].value;
+		entry[n].next=next[j].value;
+		entry[n++].spare=0;
+	}
+	neosc_totp_publish(sh->publish,serial,now-now%TOTPSTEP+TOTPSTEP,
+		TOTPSTEP,entry,n);
+	emit(sh,"published",": ","%d",n);
+	memclear(entry,0,sizeof(entry));
+	return 0;
+}
+
+static int oathselect(SHELL *sh,void *ctx,NEOSC_OATH_INFO *info)
+{
+	long long t;
+
+	if(ctx==sh->session)sh->sessionok=0;
+	t=mark(sh);
+	sh->applet=NEOSC_SHELL_APPLET_OATH;
+	if(neosc_oath_select(ctx,info))return -1;
+	metric(sh,NEOSC_METRIC_SELECT,t);
+	return 0;
+}
+
+/*
+ * With keepoath set the card handle of a successful unlock is kept open,
+ * later commands skip select and unlock until another applet is selected.
+ */
+static int oathunlock(SHELL *sh,void *ctx,int serial,int mode,
+	NEOSC_OATH_INFO *info)
+{
+	if(!sh->var[PASSWORD].valid)return -1;
+	if(neosc_oath_unlock(ctx,(char *)sh->var[PASSWORD].data,info))
+		return -1;
+	if(!sh->keepoath||serial<=0||mode<3)return 0;
+
+	if(ctx!=sh->session)
+	{
+		sessionend(sh);
+		sh->session=ctx;
+		sh->sessionserial=serial;
+	}
+	sh->sessioninfo=*info;
+	sh->sessionok=1;
+	return 0;
+}
+
+static int oathhandler(SHELL *sh,char *cmd)
+{
+	int r=-1;
+	int mode=-1;
+	int fast;
+	int serial=0;
+	int len;
+	int total;
+	int left=0;
+	time_t now=0;
+	void *ctx;
+	NEOSC_OATH_LIST *list;
+	NEOSC_OATH_RESPONSE *results;
+	NEOSC_OATH_RESPONSE *next;
+	NEOSC_OATH_RESPONSE result;
+	NEOSC_OATH_INFO info;
+	char txt[2*MAXLEN+1];
+	VAR *var=sh->var;
+
+
+	if(var[SERIAL].valid)serial=var[SERIAL].value;
+
+	if(!strcmp(cmd,"show-info"))mode=0;
+	else if(!strcmp(cmd,"reset-all"))
+	{
+		if(!(sh->enable&1))goto err1;
+		mode=1;
+	}
+	else if(!strcmp(cmd,"set-password"))mode=2;
+	else if(!strcmp(cmd,"calc-otp"))mode=3;
+	else if(!strcmp(cmd,"calc-all-totp"))
+	{
+		now=time(NULL);
+		if(var[TOTPMARGIN].valid)left=TOTPSTEP-now%TOTPSTEP;
+		if(sh->totp&&serial>0&&sh->totpserial==serial&&
+			sh->totpstep==now/TOTPSTEP)
+		{
+			cachestat(sh,"totp",1);
+			r=totpshow(sh,sh->totp,sh->totptotal,left);
+			goto err1;
+		}
+		if(var[TOTPMARGIN].valid&&serial>0)cachestat(sh,"totp",0);
+		mode=4;
+	}
+	else if(!strcmp(cmd,"list-all"))mode=5;
+	else if(!strcmp(cmd,"delete-entry"))mode=6;
+	else if(!strcmp(cmd,"add-change-entry"))
+	{
+		if(!var[OTPMODE].valid)goto err1;
+		if(!var[SHAMODE].valid)goto err1;
+		if(!var[OTPDIGITS].valid)goto err1;
+		if(!var[IMF].valid)goto err1;
+		mode=7;
+	}
+	else if(!strcmp(cmd,"publish-totp"))
+	{
+		if(!sh->publish)goto err1;
+		now=time(NULL);
+		mode=8;
+	}
+	else goto err1;
+
+	if(devlock(sh,serial,&ctx))goto err1;
+	if(expand(sh,ctx,0))goto err2;
+	if((fast=ctx==sh->session&&sh->sessionok&&
+		((mode>=3&&mode<=6)||mode==8)))
+		info=sh->sessioninfo;
+	else if(oathselect(sh,ctx,&info))goto err2;
+
+	if(mode==1||mode==6||mode==7)totpflush(sh);
+
+	if(info.protected&&mode>1&&!fast)
+		if(oathunlock(sh,ctx,serial,mode,&info))goto err2;
+
+again:
+	switch(mode)
+	{
+	case 0:	len=sizeof(txt);
+		if(neosc_util_hex_encode(info.identity,8,txt,&len))break;
+		emit(sh,"version",": ","%d.%d.%d",info.major,info.minor,
+			info.build);
+		emit(sh,"identity",": ","%s",txt);
+		emit(sh,"protected",": ","%s",info.protected?"yes":"no");
+		r=0;
+		break;
+
+	case 1:	r=neosc_oath_reset(ctx);
+		break;
+
+	case 2:	r=neosc_oath_chgpass(ctx,
+			var[NEWPASSWORD].valid?(char *)var[NEWPASSWORD].data:"",
+			&info);
+		break;
+
+	case 3:	if((r=neosc_oath_calc_single(ctx,
+			var[OTPNAME].valid?(char *)var[OTPNAME].data:NULL,
+			time(NULL),&result)))break;
+		switch(result.digits)
+		{
+		case 6:	emit(sh,"otp",": ","%06d",result.value);
+			break;
+		case 7:	emit(sh,"otp",": ","%07d",result.value);
+			break;
+		case 8:	emit(sh,"otp",": ","%08d",result.value);
+			break;
+		default:r=-1;
+			break;
+		}
+		break;
+
+	case 4:	if((r=neosc_oath_calc_all(ctx,now,&results,&total)))
+			break;
+		r=totpshow(sh,results,total,left);
+		totpfree(results,total);
+		if(r||!left||left>var[TOTPMARGIN].value||serial<=0)break;
+		if(neosc_oath_calc_all(ctx,now+TOTPSTEP,&next,&total))break;
+		totpflush(sh);
+		sh->totp=next;
+		sh->totptotal=total;
+		sh->totpserial=serial;
+		sh->totpstep=now/TOTPSTEP+1;
+		break;
+
+	case 5:	if((r=neosc_oath_list_all(ctx,&list,&total)))break;
+		r=oathlist(sh,list,total);
+		oathinventory(sh,serial,list,total);
+		listfree(list,total);
+		break;
+
+	case 6:	r=neosc_oath_delete(ctx,
+			var[OTPNAME].valid?(char *)var[OTPNAME].data:NULL);
+		break;
+
+	case 7:	if((r=neosc_oath_add(ctx,
+			var[OTPNAME].valid?(char *)var[OTPNAME].data:NULL,
+			var[OTPMODE].value,var[SHAMODE].value,
+			var[OTPDIGITS].value,(unsigned int)var[IMF].value,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len)))break;
+		if((r=neosc_util_qrurl(
+			var[OTPNAME].valid?(char *)var[OTPNAME].data:NULL,
+			var[OTPMODE].value,var[SHAMODE].value,
+			var[OTPDIGITS].value,(unsigned int)var[IMF].value,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len,txt,sizeof(txt))))break;
+		emit(sh,"url",": ","%s",txt);
+		break;
+
+	case 8:	if((r=neosc_oath_calc_all(ctx,now,&results,&total)))break;
+		if((r=neosc_oath_calc_all(ctx,now+TOTPSTEP,&next,&len)))
+		{
+			totpfree(results,total);
+			break;
+		}
+		r=publish(sh,serial,now,results,total,next,len);
+		totpfree(results,total);
+		totpfree(next,len);
+		break;
+	}
+
+	/* a failure may be due to the applet being locked again */
+
+	if(r&&fast)
+	{
+		fast=0;
+		r=-1;
+		if(oathselect(sh,ctx,&info))goto err2;
+		if(info.protected)if(oathunlock(sh,ctx,serial,mode,&info))
+			goto err2;
+		goto again;
+	}
+
+	if(sh->inventory&&!r&&mode==1)oathinventory(sh,serial,NULL,0);
+	else if(sh->inventory&&!r&&(mode==6||mode==7)&&
+		!neosc_oath_list_all(ctx,&list,&total))
+	{
+		oathinventory(sh,serial,list,total);
+		listfree(list,total);
+	}
+
+err2:	devunlock(sh,ctx);
+err1:	if(r&&mode==8)neosc_totp_clear(sh->publish);
+	memclear(&serial,0,sizeof(serial));
+	memclear(&total,0,sizeof(total));
+	memclear(&info,0,sizeof(info));
+	memclear(&result,0,sizeof(result));
+	memclear(txt,0,sizeof(txt));
+	return r;
+}
+
+static int usbhandler(SHELL *sh,char *cmd)
+{
+	int mode=-1;
+	int serial=0;
+	int r=-1;
+	int val;
+	int len;
+	int usbmode;
+	long long t;
+	void *ctx;
+	NEOSC_STATUS status;
+	unsigned char bfr[MAXLEN];
+	char txt[2*MAXLEN+1];
+	VAR *var=sh->var;
+
+	if(var[SERIAL].valid)serial=var[SERIAL].value;
+
+	if(!strcmp(cmd,"show-status"))mode=1;
+	else if(!strcmp(cmd,"show-serial"))mode=2;
+	else if(!strcmp(cmd,"show-mode"))mode=3;
+	else if(!strcmp(cmd,"calc-hmac"))
+	{
+		if(!var[SLOT].valid)goto fail;
+		if(!var[CHALLENGE].valid)goto fail;
+		mode=4;
+	}
+	else if(!strcmp(cmd,"calc-otp"))
+	{
+		if(!var[SLOT].valid)goto fail;
+		if(!var[CHALLENGE].valid)goto fail;
+		mode=5;
+	}
+	else if(!strcmp(cmd,"set-ndef"))
+	{
+		if(!var[SLOT].valid)goto fail;
+		mode=6;
+	}
+	else if(!strcmp(cmd,"set-scanmap"))mode=7;
+	else if(!strcmp(cmd,"set-mode"))
+	{
+		if(!var[MODE].valid)goto fail;
+		if(unsafe(sh,1))goto fail;
+		if(!var[CRTIMEOUT].valid)goto fail;
+		if(!var[AUTOEJECTTIME].valid)goto fail;
+		mode=8;
+	}
+	else if(!strcmp(cmd,"reset-slot"))
+	{
+		if(!(sh->enable&1))goto fail;
+		if(!var[SLOT].valid)goto fail;
+		mode=9;
+	}
+	else if(!strcmp(cmd,"swap-slots"))mode=10;
+	else if(!strcmp(cmd,"update-slot"))
+	{
+		if(!var[SLOT].valid)goto fail;
+		if(!var[TICKETFLAGS].valid)goto fail;
+		if(!var[CONFIGFLAGS].valid)goto fail;
+		if(!var[EXTENDEDFLAGS].valid)goto fail;
+		mode=11;
+	}
+	else if(!strcmp(cmd,"config-hmac"))
+	{
+		if(!var[SLOT].valid)goto fail;
+		if(!var[TICKETFLAGS].valid)goto fail;
+		if(!var[CONFIGFLAGS].valid)goto fail;
+		if(!var[EXTENDEDFLAGS].valid)goto fail;
+		mode=12;
+	}
+	else if(!strcmp(cmd,"config-otp"))
+	{
+		if(!var[SLOT].valid)goto fail;
+		if(!var[TICKETFLAGS].valid)goto fail;
+		if(!var[CONFIGFLAGS].valid)goto fail;
+		if(!var[EXTENDEDFLAGS].valid)goto fail;
+		mode=13;
+	}
+	else if(!strcmp(cmd,"config-hotp"))
+	{
+		if(!var[SLOT].valid)goto fail;
+		if(!var[TICKETFLAGS].valid)goto fail;
+		if(!var[CONFIGFLAGS].valid)goto fail;
+		if(!var[EXTENDEDFLAGS].valid)goto fail;
+		if(!var[OMP].valid)goto fail;
+		if(!var[TT].valid)goto fail;
+		if(!var[MUI].valid)goto fail;
+		if(!var[IMF].valid)goto fail;
+		mode=14;
+	}
+	else if(!strcmp(cmd,"config-yubiotp"))
+	{
+		if(!var[SLOT].valid)goto fail;
+		if(!var[TICKETFLAGS].valid)goto fail;
+		if(!var[CONFIGFLAGS].valid)goto fail;
+		if(!var[EXTENDEDFLAGS].valid)goto fail;
+		mode=15;
+	}
+	else if(!strcmp(cmd,"config-password"))
+	{
+		if(!var[SLOT].valid)goto fail;
+		if(!var[TICKETFLAGS].valid)goto fail;
+		if(!var[CONFIGFLAGS].valid)goto fail;
+		if(!var[EXTENDEDFLAGS].valid)goto fail;
+		mode=16;
+	}
+	else goto fail;
+
+	t=mark(sh);
+	if(neosc_usb_open(&ctx,serial,&usbmode))goto fail;
+	newcard(sh,serial);
+	metric(sh,NEOSC_METRIC_OPEN,t);
+	if(expand(sh,ctx,1))goto close;
+	if(unsafe(sh,mode==8))goto close;
+
+	if(mode>=9&&mode<=16&&sh->jactive==1)
+	{
+		if((r=neosc_usb_read_status(ctx,&status)))goto close;
+		if(landed(sh,status.pgmseq))goto close;
+		r=-1;
+	}
+
+	switch(mode)
+	{
+	case 1:	if((r=neosc_usb_read_status(ctx,&status)))break;
+		emit(sh,"version",": ","%d.%d.%d",status.major,status.minor,
+			status.build);
+		emit(sh,"pgmseq",": ","%d",status.pgmseq);
+		emit(sh,"touchlevel",": ","%d",status.touchlevel);
+		emitconfig(sh,status.config1,status.config2,status.touch1,status.touch2,
+			status.ledinv);
+		break;
+
+	case 2:	if((r=neosc_usb_read_serial(ctx,&val)))break;
+		emit(sh,"serial",": ","%d",val);
+		break;
+
+	case 3:	emit(sh,"mode",": ","%d",usbmode);
+		r=0;
+		break;
+
+	case 4:	memset(&status,0,sizeof(status));
+		if(sh->memo&&serial>0)
+			if((r=neosc_usb_read_status(ctx,&status)))break;
+		if(memoget(sh,serial,status.pgmseq,bfr))
+		{
+			if((r=neosc_usb_read_hmac(ctx,var[SLOT].value,
+			    var[CHALLENGE].data,var[CHALLENGE].len,bfr,
+			    sizeof(bfr))))break;
+			memoput(sh,serial,status.pgmseq,bfr);
+		}
+		if(var[OTPDIGITS].valid)
+		{
+			if((r=neosc_util_sha1_to_otp(bfr,NEOSC_SHA1_SIZE,
+				var[OTPDIGITS].value,&val)))break;
+			switch(var[OTPDIGITS].value)
+			{
+			case 6:	emit(sh,"otp",":","%06d",val);
+				break;
+			case 7:	emit(sh,"otp",":","%07d",val);
+				break;
+			case 8:	emit(sh,"otp",":","%08d",val);
+				break;
+			default:r=-1;
+				break;
+			}
+		}
+		else
+		{
+			len=sizeof(txt);
+			if((r=neosc_util_hex_encode(bfr,NEOSC_SHA1_SIZE,txt,
+				&len)))break;
+			emit(sh,"h",":","%s",txt);
+		}
+		break;
+
+	case 5:	if((r=neosc_usb_read_otp(ctx,var[SLOT].value,
+		    var[CHALLENGE].data,var[CHALLENGE].len,bfr,sizeof(bfr))))
+			break;
+		len=sizeof(txt);
+		if((r=neosc_util_modhex_encode(bfr,16,txt,&len)))break;
+		emit(sh,"m",":","%s",txt);
+		break;
+
+	case 6:	r=neosc_usb_write_ndef(ctx,var[SLOT].value,
+			var[URL].valid?(char *)var[URL].data:NULL,
+			var[TEXT].valid?(char *)var[TEXT].data:NULL,
+			var[LANG].valid?(char *)var[LANG].data:NULL,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+
+	case 7:	r=neosc_usb_write_scanmap(ctx,
+			var[SCANMAP].valid?var[SCANMAP].data:NULL,
+			var[SCANMAP].len);
+		break;
+
+	case 8:	r=neosc_usb_setmode(ctx,var[MODE].value,var[CRTIMEOUT].value,
+			var[AUTOEJECTTIME].value);
+		break;
+
+	case 9:	r=neosc_usb_reset(ctx,var[SLOT].value);
+		break;
+
+	case 10:r=neosc_usb_swap(ctx,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+
+	case 11:r=neosc_usb_update(ctx,var[SLOT].value,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+
+	case 12:r=neosc_usb_hmac(ctx,var[SLOT].value,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		if(!r&&var[VERIFY].valid&&var[VERIFY].value)
+			verify(sh,ctx,1,0);
+		break;
+
+	case 13:r=neosc_usb_otp(ctx,var[SLOT].value,
+			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
+			var[PRIVATEID].len,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		if(!r&&var[VERIFY].valid&&var[VERIFY].value)
+			verify(sh,ctx,1,1);
+		break;
+
+	case 14:r=neosc_usb_hotp(ctx,var[SLOT].value,var[OMP].value,
+			var[TT].value,var[MUI].value,var[IMF].value,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+
+	case 15:r=neosc_usb_yubiotp(ctx,var[SLOT].value,
+			var[PUBLICID].valid?var[PUBLICID].data:NULL,
+			var[PUBLICID].len,
+			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
+			var[PRIVATEID].len,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+
+	case 16:r=neosc_usb_passwd(ctx,var[SLOT].value,
+			var[PUBLICID].valid?var[PUBLICID].data:NULL,
+			var[PUBLICID].len,
+			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
+			var[PRIVATEID].len,
+			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
+			var[SECRETKEY].len,var[TICKETFLAGS].value,
+			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
+			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
+			var[NEWACCESSCODE].len,
+			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
+			var[ACCESSCODE].len);
+		break;
+	}
+
+	if(sh->inventory&&!r)
+	{
+		if(mode==1)usbinventory(sh,ctx,&status,usbmode);
+		else if(mode>=8&&mode<=16&&!neosc_usb_read_status(ctx,&status))
+			usbinventory(sh,ctx,&status,
+				mode==8?var[MODE].value:usbmode);
+	}
+
+close:	neosc_usb_close(ctx);
+
+fail:	memclear(&status,0,sizeof(status));
+	memclear(&serial,0,sizeof(serial));
+	memclear(&val,0,sizeof(val));
+	memclear(bfr,0,sizeof(bfr));
+	memclear(txt,0,sizeof(txt));
+	return r;
+}
+
+static int cmdclass(char *cmd)
+{
+	if(!strcmp(cmd,"calc-otp")||!strcmp(cmd,"calc-hmac")||
+		!strcmp(cmd,"calc-yubiotp")||!strcmp(cmd,"calc-all-totp")||
+		!strcmp(cmd,"publish-totp")||!strcmp(cmd,"show-serial"))
+		return NEOSC_QUEUE_INTERACTIVE;
+	if(!strncmp(cmd,"show-",5)||!strcmp(cmd,"list-all"))
+		return NEOSC_QUEUE_NORMAL;
+	return NEOSC_QUEUE_BULK;
+}
+
+static int queuestats(SHELL *sh)
+{
+	int i;
+	unsigned long n;
+	long long sum;
+	long long max;
+
+	for(i=0;i<NEOSC_QUEUE_CLASSES;i++)
+	{
+		neosc_queue_stats(i,&n,&sum,&max);
+		emit(sh,neosc_queue_name(i),": ","%lu %lld %lld",n,
+			n?sum/(long long)n:0,max);
+	}
+	return 0;
+}
+
+/*
+ * libneosc offers no reconnect, so a card reset or removed by a short RF
+ * dropout on an NFC reader is reopened and reselected by the handler.
+ * This is polled while the card does not answer and tried once more if
+ * it answers but the command fails, all within the grace window. Writes
+ * and commands advancing an on-card counter (Yubico OTP, OTP
+ * challenge-response and HOTP) are not retried as they may have landed.
+ */
+static int attempt(SHELL *sh,int (*handler)(SHELL *sh,char *cmd),
+	char *group,char *cmd,int cls)
+{
+	int r;
+	int grace=NFCDEFGRACE;
+	long long deadline;
+	struct timespec ts;
+	char label[32];
+
+	sh->nfctried=0;
+	sh->nfclost=0;
+	if(!(r=handler(sh,cmd)))return 0;
+
+	if(sh->var[NFCGRACE].valid&&!sh->var[NFCGRACE].tmpl)
+		grace=sh->var[NFCGRACE].value;
+	if(!sh->var[SERIAL].valid||sh->var[SERIAL].value!=NEOSC_NFC_YUBIKEY||
+		cls==NEOSC_QUEUE_BULK||!strcmp(cmd,"calc-otp")||
+		!strcmp(cmd,"calc-yubiotp")||!sh->nfctried||grace<=0)return r;
+
+	deadline=neosc_metrics_now()+grace*1000LL;
+	ts.tv_sec=0;
+	ts.tv_nsec=NFCPOLL*1000000L;
+
+	do
+	{
+		sessionend(sh);
+		if(sh->nfclost)nanosleep(&ts,NULL);
+		sh->nfclost=0;
+		r=handler(sh,cmd);
+	} while(r&&sh->nfclost&&neosc_metrics_now()<deadline);
+
+	if(r)return r;
+	sh->recoveries++;
+	if(sh->metrics)
+	{
+		snprintf(label,sizeof(label),"%s %s",group,cmd);
+		neosc_metrics_count(sh->metrics,NEOSC_METRIC_RECOVERY,0,
+			label,0);
+	}
+	return 0;
+}
+
+static int devcmd(SHELL *sh,int (*handler)(SHELL *sh,char *cmd),char *group,
+	char *cmd)
+{
+	int r;
+	int cls;
+	int serial;
+	long long t;
+	void *entry;
+	char label[32];
+
+	serial=sh->var[SERIAL].valid?sh->var[SERIAL].value:0;
+	cls=cmdclass(cmd);
+	t=neosc_queue_enter(serial,cls,&entry);
+	if(t>0)sh->locktime+=t;
+	if(sh->metrics&&t>=0)neosc_metrics_time(sh->metrics,
+		NEOSC_METRIC_QUEUE,serial,neosc_queue_name(cls),t);
+
+	if(!sh->metrics&&!sh->audit)
+	{
+		r=attempt(sh,handler,group,cmd,cls);
+		neosc_queue_leave(entry);
+		return r;
+	}
+
+	if(strspn(cmd,"abcdefghijklmnopqrstuvwxyz0123456789-")!=strlen(cmd)||
+		snprintf(label,sizeof(label),"%s %s",group,cmd)>=sizeof(label))
+		snprintf(label,sizeof(label),"%s invalid",group);
+
+	t=neosc_metrics_now();
+	r=attempt(sh,handler,group,cmd,cls);
+	t=neosc_metrics_now()-t;
+	neosc_queue_leave(entry);
+
+	if(sh->audit)neosc_audit_log(sh->audit,serial,label,
+		sh->var[SLOT].valid?sh->var[SLOT].value:-1,r,t);
+	if(!sh->metrics)return r;
+
+	neosc_metrics_time(sh->metrics,NEOSC_METRIC_COMMAND,serial,label,t);
+	if(r)neosc_metrics_count(sh->metrics,NEOSC_METRIC_ERROR,serial,
+		label,r);
+	neosc_metrics_export(sh->metricsfile,0);
+	return r;
+}
+
+static int parseline(SHELL *sh,char *line);
+
+static void statefree(STATE *st)
+{
+	listfree(st->list,st->total);
+	if(st->results)totpfree(st->results,st->codes);
+	memclear(st,0,sizeof(STATE));
+}
+
+static int probe(SHELL *sh,STATE *st,int what)
+{
+	int r=-1;
+	int serial=0;
+	int usbmode;
+	void *ctx;
+	NEOSC_NEO_INFO info;
+	NEOSC_STATUS status;
+	NEOSC_OATH_INFO oinfo;
+	VAR *var=sh->var;
+
+	if(st->valid&what)return 0;
+	if(var[SERIAL].valid)serial=var[SERIAL].value;
+
+	switch(what)
+	{
+	case PROBEUSB:
+		if(neosc_usb_open(&ctx,serial,&usbmode))return -1;
+		newcard(sh,serial);
+		if(!expand(sh,ctx,1)&&!(r=neosc_usb_read_status(ctx,&status)))
+		{
+			st->config[0]=status.config1;
+			st->config[1]=status.config2;
+			st->touch[0]=status.touch1;
+			st->touch[1]=status.touch2;
+		}
+		neosc_usb_close(ctx);
+		break;
+
+	case PROBENEO:
+		if(devlock(sh,serial,&ctx))return -1;
+		sh->applet=NEOSC_SHELL_APPLET_NEO;
+		if(!expand(sh,ctx,0)&&!(r=neosc_neo_select(ctx,&info)))
+		{
+			st->config[0]=info.config1;
+			st->config[1]=info.config2;
+			st->touch[0]=info.touch1;
+			st->touch[1]=info.touch2;
+			st->mode=info.mode;
+			st->crtimeout=info.crtimeout;
+			st->autoejecttime=info.autoejecttime;
+			st->ndefok=!neosc_neo_read_ndef(ctx,&st->ndef);
+		}
+		devunlock(sh,ctx);
+		break;
+
+	case PROBEOATH:
+		if(devlock(sh,serial,&ctx))return -1;
+		if(expand(sh,ctx,0)||oathselect(sh,ctx,&oinfo))goto unlock;
+		if(oinfo.protected)if(!var[PASSWORD].valid||
+			neosc_oath_unlock(ctx,(char *)var[PASSWORD].data,&oinfo))
+			goto unlock;
+		listfree(st->list,st->total);
+		if(st->results)totpfree(st->results,st->codes);
+		st->list=NULL;
+		st->results=NULL;
+		st->total=0;
+		st->codes=0;
+		if(!(r=neosc_oath_list_all(ctx,&st->list,&st->total)))
+			r=neosc_oath_calc_all(ctx,time(NULL),&st->results,
+				&st->codes);
+unlock:		devunlock(sh,ctx);
+		break;
+	}
+
+	if(!r)st->valid|=what;
+	return r;
+}
+
+static int classify(char *group,char *cmd)
+{
+	if(!strcmp(group,"set")||!strcmp(group,"clear"))return VARIABLE;
+	if(!cmd)return -1;
+	if(!strcmp(group,"neo"))
+	{
+		if(!strcmp(cmd,"set-mode")||!strcmp(cmd,"set-mode-mgr"))
+			return SETMODE;
+		if(!strcmp(cmd,"set-ndef"))return SETNDEF;
+	}
+	else if(!strcmp(group,"oath"))
+	{
+		if(!strcmp(cmd,"add-change-entry"))return OATHADD;
+		if(!strcmp(cmd,"delete-entry"))return OATHDEL;
+		return -1;
+	}
+	else if(strcmp(group,"usb"))return -1;
+	if(!strcmp(cmd,"reset-slot"))return RESETSLOT;
+	if(!strncmp(cmd,"config-",7))return CONFIG;
+	return -1;
+}
+
+/*
+ * Only what the device reports can be compared, anything else is
+ * treated as out of sync. The NDEF record of the second slot cannot be
+ * read back and a HOTP or touch entry has no code from which the number
+ * of digits could be taken without advancing or blocking the entry.
+ */
+static int insync(SHELL *sh,STATE *st,int kind,char *cmd,int usb)
+{
+	int i;
+	int j;
+	int touch;
+	VAR *var=sh->var;
+
+	switch(kind)
+	{
+	case SETMODE:
+		if(probe(sh,st,PROBENEO))return -1;
+		if(!var[MODE].valid||!var[CRTIMEOUT].valid||
+			!var[AUTOEJECTTIME].valid)return 0;
+		return st->mode==var[MODE].value&&
+			st->crtimeout==var[CRTIMEOUT].value&&
+			st->autoejecttime==var[AUTOEJECTTIME].value;
+
+	case SETNDEF:
+		if(probe(sh,st,PROBENEO))return -1;
+		if(!var[SLOT].valid||var[SLOT].value||!st->ndefok)return 0;
+		if(var[URL].valid)return st->ndef.type==NEOSC_NDEF_URL&&
+			!strcmp(st->ndef.payload,(char *)var[URL].data);
+		if(!var[TEXT].valid||!var[LANG].valid)return 0;
+		return st->ndef.type==NEOSC_NDEF_TEXT&&
+			!strcmp(st->ndef.payload,(char *)var[TEXT].data)&&
+			!strcmp(st->ndef.language,(char *)var[LANG].data);
+
+	case RESETSLOT:
+	case CONFIG:
+		if(probe(sh,st,usb?PROBEUSB:PROBENEO))return -1;
+		if(!var[SLOT].valid||var[SLOT].value<0||var[SLOT].value>1)
+			return 0;
+		i=var[SLOT].value;
+		if(kind==RESETSLOT)return !st->config[i];
+		if(!st->config[i]||!var[CONFIGFLAGS].valid)return 0;
+		if(!strcmp(cmd,"config-hmac")||!strcmp(cmd,"config-otp"))
+			touch=(var[CONFIGFLAGS].value&CHALBTN)?1:0;
+		else touch=1;
+		return (st->touch[i]?1:0)==touch;
+
+	case OATHADD:
+	case OATHDEL:
+		if(probe(sh,st,PROBEOATH))return -1;
+		if(!var[OTPNAME].valid)return 0;
+		for(i=0;i<st->total;i++)
+			if(!strcmp(st->list[i].name,(char *)var[OTPNAME].data))
+				break;
+		if(kind==OATHDEL)return i==st->total;
+		if(i==st->total||!var[OTPMODE].valid||!var[SHAMODE].valid||
+			!var[OTPDIGITS].valid)return 0;
+		if(st->list[i].otpmode!=var[OTPMODE].value||
+			st->list[i].shamode!=var[SHAMODE].value||
+			st->list[i].otpmode!=NEOSC_OATH_TOTP)return 0;
+		for(j=0;j<st->codes;j++)
+			if(!strcmp(st->results[j].name,st->list[i].name))break;
+		return j<st->codes&&
+			st->results[j].digits==var[OTPDIGITS].value;
+	}
+	return -1;
+}
+
+/*
+ * The file is checked completely before anything is executed, so a
+ * typo in the last line does not leave a half applied device.
+ */
+static int apply(SHELL *sh,char *file)
+{
+	int r=0;
+	int n;
+	int len;
+	int kind;
+	int pass;
+	int writes=0;
+	int skips=0;
+	char *group;
+	char *cmd;
+	char *sptr;
+	FILE *fp;
+	STATE st;
+	char line[MAXLINE];
+	char copy[MAXLINE];
+
+	memset(&st,0,sizeof(st));
+	if(!(fp=fopen(file,"re")))return -1;
+
+	for(pass=0;pass<2&&!r;pass++)for(rewind(fp),n=1;
+		fgets(line,sizeof(line),fp);n++)
+	{
+		if(!(len=strlen(line))||line[len-1]!='\n')
+		{
+			if(!feof(fp))
+			{
+				emit(sh,"invalid",": ","line %d",n);
+				r=-1;
+				break;
+			}
+		}
+		else line[--len]=0;
+
+		strcpy(copy,line);
+		if(!(group=strtok_r(copy," \t\r",&sptr))||*group=='#')continue;
+		cmd=strtok_r(NULL," \t\r",&sptr);
+
+		if((kind=classify(group,cmd))==-1)
+		{
+			emit(sh,"invalid",": ","line %d",n);
+			r=-1;
+			break;
+		}
+		if(!pass)continue;
+
+		if(kind!=VARIABLE)switch(insync(sh,&st,kind,cmd,
+			!strcmp(group,"usb")))
+		{
+		case 1:	emit(sh,"skip",": ","%s %s",group,cmd);
+			skips++;
+			continue;
+		case 0:	emit(sh,"write",": ","%s %s",group,cmd);
+			writes++;
+			st.valid=0;
+			break;
+		default:r=-1;
+			break;
+		}
+		if(r||(r=parseline(sh,line)))
+		{
+			emit(sh,"failed",": ","line %d",n);
+			break;
+		}
+	}
+
+	memclear(line,0,sizeof(line));
+	memclear(copy,0,sizeof(copy));
+	statefree(&st);
+	fclose(fp);
+	if(!r)emit(sh,"writes",": ","%d (%d skipped)",writes,skips);
+	return r;
+}
+
+static int journaled(SHELL *sh,int (*handler)(SHELL *sh,char *cmd),
+	char *group,char *cmd)
+{
+	int r;
+	int serial;
+
+	if(!sh->journal||sh->jactive)
+		return group?devcmd(sh,handler,group,cmd):handler(sh,cmd);
+
+	serial=sh->var[SERIAL].valid?sh->var[SERIAL].value:0;
+	switch(neosc_journal_state(sh->journal,serial,sh->step,&sh->jpgmseq))
+	{
+	case NEOSC_JOURNAL_DONE:
+		emit(sh,"journal",": ","done");
+		return 0;
+	case NEOSC_JOURNAL_NONE:
+		sh->jpgmseq=-1;
+		break;
+	}
+
+	sh->jactive=group?1:2;
+	r=group?devcmd(sh,handler,group,cmd):handler(sh,cmd);
+	sh->jactive=0;
+	neosc_journal_end(sh->journal,serial,sh->step,r);
+	return r;
+}
+
+static int parseline(SHELL *sh,char *line)
+{
+	char *cmd=NULL;
+	char *varname=NULL;
+	char *varvalue=NULL;
+	char *sptr;
+
+	if(!(cmd=strtok_r(line," \t\r\n",&sptr)))return 0;
+
+	if(!strcmp(cmd,"set"))
+	{
+		if(!(varname=strtok_r(NULL," \t\r\n",&sptr)))return -1;
+		if(!(varvalue=strtok_r(NULL,"\r\n",&sptr)))return -1;
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return varhandler(sh,0,varname,varvalue);
+	}
+	else if(!strcmp(cmd,"clear"))
+	{
+		if(!(varname=strtok_r(NULL," \t\r\n",&sptr)))return -1;
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return varhandler(sh,1,varname,varvalue);
+	}
+	else if(!strcmp(cmd,"show"))
+	{
+		if(!(varname=strtok_r(NULL," \t\r\n",&sptr)))return -1;
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return varhandler(sh,2,varname,varvalue);
+	}
+	else if(!strcmp(cmd,"print"))
+	{
+		if(!(varname=strtok_r(NULL," \t\r\n",&sptr)))return -1;
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return varhandler(sh,3,varname,varvalue);
+	}
+	else if(!strcmp(cmd,"modhex"))
+	{
+		if(!(varname=strtok_r(NULL," \t\r\n",&sptr)))return -1;
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return varhandler(sh,4,varname,varvalue);
+	}
+	else if(!strcmp(cmd,"base32"))
+	{
+		if(!(varname=strtok_r(NULL," \t\r\n",&sptr)))return -1;
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return varhandler(sh,5,varname,varvalue);
+	}
+	else if(!strcmp(cmd,"base64"))
+	{
+		if(!(varname=strtok_r(NULL," \t\r\n",&sptr)))return -1;
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return varhandler(sh,6,varname,varvalue);
+	}
+	else if(!strcmp(cmd,"neo"))
+	{
+		if(!(varname=strtok_r(NULL," \t\r\n",&sptr)))return -1;
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return journaled(sh,neohandler,cmd,varname);
+	}
+	else if(!strcmp(cmd,"ndef"))
+	{
+		if(!(varname=strtok_r(NULL," \t\r\n",&sptr)))return -1;
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return journaled(sh,ndefhandler,cmd,varname);
+	}
+	else if(!strcmp(cmd,"oath"))
+	{
+		if(!(varname=strtok_r(NULL," \t\r\n",&sptr)))return -1;
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return journaled(sh,oathhandler,cmd,varname);
+	}
+	else if(!strcmp(cmd,"usb"))
+	{
+		if(!(varname=strtok_r(NULL," \t\r\n",&sptr)))return -1;
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return journaled(sh,usbhandler,cmd,varname);
+	}
+	else if(!strcmp(cmd,"apply"))
+	{
+		if(!(varname=strtok_r(NULL,"\r\n",&sptr)))return -1;
+		return journaled(sh,apply,NULL,varname);
+	}
+	else if(!strcmp(cmd,"queue"))
+	{
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return queuestats(sh);
+	}
+	else if(!strcmp(cmd,"help"))
+	{
+		if(sh->keyvalue)return -1;
+		varname=strtok_r(NULL," \t\r\n",&sptr);
+		if(varname)if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		help(sh,varname);
+		return 0;
+	}
+	else if(!strcmp(cmd,"quit"))
+	{
+		if(strtok_r(NULL,"\r\n",&sptr))return -1;
+		return 1;
+	}
+	else return -1;
+}
+
+int neosc_shell_create(void **ctx,int flags)
+{
+	SHELL *sh;
+
+	if(!(sh=malloc(sizeof(SHELL))))return -1;
+	memset(sh,0,sizeof(SHELL));
+	sh->enable=flags&(NEOSC_SHELL_RESET|NEOSC_SHELL_BRICK);
+	sh->keyvalue=(flags&NEOSC_SHELL_KEYVALUE)?1:0;
+	sh->lockfd=-1;
+	sh->out=stdout;
+	memcpy(sh->var,vartemplate,sizeof(sh->var));
+	*ctx=sh;
+	return 0;
+}
+
+void neosc_shell_destroy(void *ctx)
+{
+	SHELL *sh=ctx;
+
+	if(sh->lockd)free(sh->lockd);
+	if(sh->cachedir)free(sh->cachedir);
+	if(sh->metrics)
+	{
+		neosc_metrics_destroy(sh->metrics);
+		neosc_metrics_export(sh->metricsfile,1);
+		free(sh->metricsfile);
+	}
+	totpflush(sh);
+	memofree(sh);
+	masterfree(sh);
+	sessionend(sh);
+	if(sh->audit&&!sh->clone)neosc_audit_close(sh->audit);
+	if(sh->journal)neosc_journal_close(sh->journal);
+	if(sh->inventory)
+	{
+		neosc_inventory_close(sh->inventory);
+		pthread_mutex_destroy(&sh->invmtx);
+	}
+	if(sh->publish)neosc_totp_close(sh->publish);
+	memclear(sh,0,sizeof(SHELL));
+	free(sh);
+}
+
+/*
+ * The audit ring is shared as its writes are lock free, the metrics of
+ * the clone get their own block. Journal, inventory, publisher, memo and
+ * OATH session stay with the original context.
+ */
+int neosc_shell_clone(void *ctx,void **clone)
+{
+	SHELL *sh=ctx;
+	SHELL *cl;
+
+	if(!(cl=malloc(sizeof(SHELL))))goto err1;
+	memset(cl,0,sizeof(SHELL));
+	cl->enable=sh->enable;
+	cl->keyvalue=sh->keyvalue;
+	cl->lockprio=sh->lockprio;
+	cl->lockfd=-1;
+	cl->home=sh->home;
+	cl->keepoath=sh->keepoath;
+	cl->out=stdout;
+	if(sh->lockd)if(!(cl->lockd=strdup(sh->lockd)))goto err2;
+	if(sh->cachedir)if(!(cl->cachedir=strdup(sh->cachedir)))goto err3;
+	if(sh->metrics)
+	{
+		if(!(cl->metricsfile=strdup(sh->metricsfile)))goto err4;
+		if(!(cl->metrics=neosc_metrics_create()))goto err5;
+	}
+	cl->audit=sh->audit;
+	cl->clone=1;
+	cl->capnext=sh->capnext;
+	memcpy(cl->caps,sh->caps,sizeof(cl->caps));
+	if(sh->master)
+	{
+		if(!(cl->master=masteralloc()))goto err6;
+		memcpy(cl->master,sh->master,sh->masterlen);
+		cl->masterlen=sh->masterlen;
+	}
+	memcpy(cl->var,sh->var,sizeof(cl->var));
+	*clone=cl;
+	return 0;
+
+err6:	if(cl->metrics)neosc_metrics_destroy(cl->metrics);
+err5:	free(cl->metricsfile);
+err4:	if(cl->cachedir)free(cl->cachedir);
+err3:	if(cl->lockd)free(cl->lockd);
+err2:	free(cl);
+err1:	return -1;
+}
+
+void neosc_shell_serial(void *ctx,int serial)
+{
+	SHELL *sh=ctx;
+
+	sh->var[SERIAL].value=serial;
+	sh->var[SERIAL].valid=1;
+}
+
+int neosc_shell_lockd(void *ctx,char *path,int prio)
+{
+	SHELL *sh=ctx;
+
+	if(prio<NEOSC_LOCKD_MINPRIO||prio>NEOSC_LOCKD_MAXPRIO)return -1;
+	if(sh->lockd)free(sh->lockd);
+	if(!(sh->lockd=strdup(path?path:NEOSC_LOCKD_SOCKET)))return -1;
+	sh->lockprio=prio;
+	return 0;
+}
+
+int neosc_shell_cache(void *ctx,char *dir)
+{
+	SHELL *sh=ctx;
+
+	if(sh->cachedir)free(sh->cachedir);
+	if(!(sh->cachedir=strdup(dir)))return -1;
+	return 0;
+}
+
+int neosc_shell_metrics(void *ctx,char *file)
+{
+	SHELL *sh=ctx;
+
+	if(sh->metrics)return -1;
+	if(!(sh->metricsfile=strdup(file)))return -1;
+	if(!(sh->metrics=neosc_metrics_create()))
+	{
+		free(sh->metricsfile);
+		sh->metricsfile=NULL;
+		return -1;
+	}
+	return 0;
+}
+
+int neosc_shell_flush(void *ctx)
+{
+	SHELL *sh=ctx;
+
+	if(!sh->metricsfile)return 0;
+	return neosc_metrics_flush(sh->metricsfile);
+}
+
+int neosc_shell_memoize(void *ctx,int ttl,int uses)
+{
+	void *p;
+	SHELL *sh=ctx;
+
+	memofree(sh);
+	if(!ttl)return 0;
+	if(ttl<0||uses<=0)return -1;
+
+	if((p=mmap(NULL,MAXMEMO*sizeof(MEMO),PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS,-1,0))==MAP_FAILED)return -1;
+	if(mlock(p,MAXMEMO*sizeof(MEMO)))
+	{
+		munmap(p,MAXMEMO*sizeof(MEMO));
+		return -1;
+	}
+	madvise(p,MAXMEMO*sizeof(MEMO),MADV_DONTDUMP);
+	sh->memo=p;
+	sh->memottl=ttl;
+	sh->memouses=uses;
+	return 0;
+}
+
+int neosc_shell_masterkey(void *ctx,char *file)
+{
+	SHELL *sh=ctx;
+
+	masterfree(sh);
+	if(!(sh->master=masteralloc()))return -1;
+	if((sh->masterlen=neosc_crypto_loadkey(file,sh->master))==-1)
+	{
+		masterfree(sh);
+		return -1;
+	}
+	return 0;
+}
+
+int neosc_shell_home(void *ctx,int applet)
+{
+	SHELL *sh=ctx;
+
+	if(applet<0||applet>NEOSC_SHELL_APPLET_PIV)return -1;
+	sh->home=applet;
+	return 0;
+}
+
+void neosc_shell_keepoath(void *ctx,int enable)
+{
+	SHELL *sh=ctx;
+
+	sh->keepoath=enable;
+	if(!enable)sessionend(sh);
+}
+
+int neosc_shell_audit(void *ctx,char *file)
+{
+	SHELL *sh=ctx;
+
+	if(sh->audit)return -1;
+	if(!(sh->audit=neosc_audit_open(file,1)))return -1;
+	return 0;
+}
+
+int neosc_shell_journal(void *ctx,char *file,int resume)
+{
+	SHELL *sh=ctx;
+
+	if(sh->journal)return -1;
+	if(!(sh->journal=neosc_journal_open(file,resume)))return -1;
+	return 0;
+}
+
+int neosc_shell_inventory(void *ctx,char *file)
+{
+	SHELL *sh=ctx;
+
+	if(sh->inventory)return -1;
+	if(!(sh->inventory=neosc_inventory_open(file)))return -1;
+	pthread_mutex_init(&sh->invmtx,NULL);
+	return 0;
+}
+
+int neosc_shell_publish(void *ctx,char *name)
+{
+	SHELL *sh=ctx;
+
+	if(sh->publish)return -1;
+	if(!(sh->publish=neosc_totp_create(name,0600)))return -1;
+	return 0;
+}
+
+/*
+ * The reader list is followed via the PnP notification pseudo reader
+ * which comes last. Returns 1 if the list changed, in which case the
+ * current states are taken as the reference, 0 if not and -1 on error.
+ */
+static int readerlist(READERS *rd)
+{
+	int i;
+	char *p;
+	char *names=NULL;
+	DWORD len=SCARD_AUTOALLOCATE;
+	LONG r;
+
+	if((r=SCardListReaders(rd->ctx,NULL,(LPSTR)&names,&len))==
+		SCARD_E_NO_READERS_AVAILABLE)
+	{
+		names=NULL;
+		len=0;
+	}
+	else if(r!=SCARD_S_SUCCESS)return -1;
+
+	if(rd->total!=-1&&len==rd->len&&(!len||!memcmp(names,rd->names,len)))
+	{
+		if(names)SCardFreeMemory(rd->ctx,names);
+		return 0;
+	}
+	if(rd->names)SCardFreeMemory(rd->ctx,rd->names);
+	rd->names=names;
+	rd->len=len;
+
+	memset(rd->rs,0,sizeof(rd->rs));
+	for(rd->total=0,p=names;p&&*p&&rd->total<TAPREADERS;p+=strlen(p)+1)
+		rd->rs[rd->total++].szReader=p;
+	rd->rs[rd->total].szReader="\\\\?PnP?\\Notification";
+
+	r=SCardGetStatusChange(rd->ctx,0,rd->rs,rd->total+1);
+	if(r!=SCARD_S_SUCCESS&&r!=SCARD_E_TIMEOUT)return -1;
+	for(i=0;i<=rd->total;i++)
+		rd->rs[i].dwCurrentState=rd->rs[i].dwEventState&
+			~SCARD_STATE_CHANGED;
+	return 1;
+}
+
+/*
+ * Blocks until a card is inserted or removed or the reader list changes,
+ * the reader list is additionally checked every 'timeout' milliseconds.
+ * Changes of other state bits, e.g. caused by opening the card, are
+ * ignored. Returns 1 on a change and -1 on error.
+ */
+static int readerwait(READERS *rd,int timeout)
+{
+	int i;
+	int c;
+	LONG r;
+
+	while(1)
+	{
+		r=SCardGetStatusChange(rd->ctx,timeout,rd->rs,rd->total+1);
+		if(r==SCARD_E_TIMEOUT)
+		{
+			if((c=readerlist(rd)))return c;
+			continue;
+		}
+		if(r==SCARD_E_UNKNOWN_READER)return readerlist(rd)==1?1:-1;
+		if(r!=SCARD_S_SUCCESS)return -1;
+
+		for(c=0,i=0;i<=rd->total;i++)
+		{
+			if((rd->rs[i].dwEventState^rd->rs[i].dwCurrentState)&
+				TAPSTATE)c|=i<rd->total?1:2;
+			rd->rs[i].dwCurrentState=rd->rs[i].dwEventState&
+				~SCARD_STATE_CHANGED;
+		}
+		if(c&2)return readerlist(rd)==-1?-1:1;
+		if(c)return 1;
+	}
+}
+
+/*
+ * Presence is tested with the open that is needed anyway, once at start
+ * and after every card event. The handle of a successful open is kept as
+ * the session, which the next command locks without reopening.
+ */
+int neosc_shell_tap(void *ctx,int present,int interval)
+{
+	int r=-1;
+	int serial;
+	SHELL *sh=ctx;
+	void *card;
+	READERS rd;
+
+	if(!sh->var[SERIAL].valid||interval<=0)goto err1;
+	serial=sh->var[SERIAL].value;
+
+	sessionend(sh);
+
+	memset(&rd,0,sizeof(rd));
+	rd.total=-1;
+	if(SCardEstablishContext(SCARD_SCOPE_SYSTEM,NULL,NULL,&rd.ctx)!=
+		SCARD_S_SUCCESS)goto err1;
+	if(readerlist(&rd)==-1)goto err2;
+
+	while(1)
+	{
+		if(!neosc_pcsc_open(&card,serial))
+		{
+			if(present)
+			{
+				newcard(sh,serial);
+				sh->session=card;
+				sh->sessionserial=serial;
+				break;
+			}
+			neosc_pcsc_close(card);
+		}
+		else if(!present)break;
+		if(readerwait(&rd,interval)==-1)goto err2;
+	}
+	r=0;
+
+err2:	if(rd.names)SCardFreeMemory(rd.ctx,rd.names);
+	SCardReleaseContext(rd.ctx);
+err1:	return r;
+}
+
+long long neosc_shell_locktime(void *ctx)
+{
+	SHELL *sh=ctx;
+
+	return sh->locktime;
+}
+
+int neosc_shell_mismatches(void *ctx)
+{
+	SHELL *sh=ctx;
+
+	return sh->mismatches;
+}
+
+int neosc_shell_recoveries(void *ctx)
+{
+	SHELL *sh=ctx;
+
+	return sh->recoveries;
+}
+
+int neosc_shell_timeout(void *ctx)
+{
+	SHELL *sh=ctx;
+
+	if(!sh->var[TIMEOUT].valid||sh->var[TIMEOUT].tmpl)return 0;
+	return sh->var[TIMEOUT].value;
+}
+
+/*
+ * Safe while a command runs: the segment is unlinked, so a publish
+ * racing the wipe cannot reach new readers, and the inventory is only
+ * merged between complete device updates under the inventory mutex.
+ */
+void neosc_shell_release(void *ctx)
+{
+	SHELL *sh=ctx;
+
+	if(sh->publish)neosc_totp_wipe(sh->publish);
+	if(!sh->inventory)return;
+	pthread_mutex_lock(&sh->invmtx);
+	neosc_inventory_commit(sh->inventory);
+	pthread_mutex_unlock(&sh->invmtx);
+}
+
+void neosc_shell_wipe(void *ctx)
+{
+	int i;
+	SHELL *sh=ctx;
+
+	neosc_shell_release(sh);
+
+	for(i=0;i<sh->totptotal;i++)
+	{
+		memclear(sh->totp[i].name,0,strlen(sh->totp[i].name));
+		memclear(&sh->totp[i].digits,0,sizeof(sh->totp[i].digits));
+		memclear(&sh->totp[i].value,0,sizeof(sh->totp[i].value));
+	}
+	if(sh->memo)memclear(sh->memo,0,MAXMEMO*sizeof(MEMO));
+	if(sh->master)memclear(sh->master,0,NEOSC_CRYPTO_MAXKEY);
+	memclear(sh->var,0,sizeof(sh->var));
+}
+
+int neosc_shell_exec(void *ctx,FILE *out,char *line)
+{
+	int r;
+	SHELL *sh=ctx;
+
+	sh->out=out?out:stdout;
+	sh->step++;
+	sh->locktime=0;
+	r=parseline(sh,line);
+	sh->out=stdout;
+	return r;
+}
@@ -0,0 +1,142 @@
+/*
+ * libneoscshell - the neosc-shell command engine as a library
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _LIBNEOSCSHELL_H
+#define _LIBNEOSCSHELL_H
+
+#include <stdio.h>
+
+/* flags for neosc_shell_create */
+
+#define NEOSC_SHELL_RESET	0x01	/* allow commands that reset data   */
+#define NEOSC_SHELL_BRICK	0x02	/* allow commands that may brick    */
+#define NEOSC_SHELL_KEYVALUE	0x04	/* print results as key=value lines */
+
+/* home applets for neosc_shell_home */
+
+#define NEOSC_SHELL_APPLET_NONE	0
+#define NEOSC_SHELL_APPLET_NEO	1
+#define NEOSC_SHELL_APPLET_NDEF	2
+#define NEOSC_SHELL_APPLET_OATH	3
+#define NEOSC_SHELL_APPLET_PGP	4
+#define NEOSC_SHELL_APPLET_PIV	5
+
+/*
+ * Every context carries its own variable set, contexts may be used
+ * concurrently from different threads. Device commands of all contexts
+ * for the same serial number are queued by class (interactive reads,
+ * other reads, writes) and started in class order, see 'help queue'.
+ * neosc_shell_exec() modifies
+ * the line passed and returns 0 on success, 1 for 'quit', -1 for a
+ * syntax or precondition error or the libneosc error code otherwise.
+ * Output is written to 'out' (stdout if NULL). neosc_shell_clone()
+ * creates a new context with a copy of the variables and the settings of
+ * 'ctx' except journal, inventory, publisher and memoization, it must be
+ * destroyed before 'ctx' when sharing its audit ring. neosc_shell_lockd()
+ * makes all card access of the context go through the neosc-lockd
+ * broker listening at 'path' (default socket if NULL).
+ * neosc_shell_cache() enables the per serial metadata cache in 'dir'.
+ * neosc_shell_metrics() collects latency, error and cache counters of
+ * the context and writes those of all such contexts of the process in
+ * Prometheus text format to 'file', at most once per second.
+ * neosc_shell_flush() writes counters whose export was suppressed by
+ * that limit, it is meant to be called about once per second while idle.
+ * neosc_shell_memoize() keeps HMAC-SHA1 challenge-response results in
+ * locked memory for 'ttl' seconds and at most 'uses' further requests,
+ * a 'ttl' of 0 disables this again (the default).
+ * neosc_shell_home() makes every command that selected another applet
+ * reselect the given home applet before the card lock is released.
+ * neosc_shell_keepoath() keeps the card handle of an unlocked OATH applet
+ * open, so calc, list and delete commands for the same serial neither
+ * select nor unlock again as long as no other applet was selected.
+ * neosc_shell_audit() appends a record of every device command to the
+ * audit ring file 'file' (see neosc-auditlog).
+ * neosc_shell_journal() appends the state of every neo, ndef, oath, usb
+ * and apply command, keyed by serial number and step (the number of the
+ * neosc_shell_exec() call), to the journal 'file' which must not exist.
+ * If 'resume' is set the journal of an interrupted run is read instead
+ * and steps already completed are skipped, an interrupted slot write is
+ * skipped if the program sequence of the device changed since.
+ * neosc_shell_inventory() records version, program sequence, mode, slot
+ * state and OATH entry names of every device seen by a command in the
+ * inventory database 'file' (see neosc-query). Updates are merged into
+ * the file in batches (see neosc-inventory.h), by neosc_shell_release()
+ * and by neosc_shell_destroy(). OATH names require a serial number.
+ * neosc_shell_publish() creates the shared memory segment 'name' (see
+ * neosc-totp.h), owned by the caller and readable by the caller only,
+ * which 'oath publish-totp' fills with the codes of the current and the
+ * next time step. The segment is wiped when the command fails, e.g.
+ * due to the device being removed, and it is wiped and removed by
+ * neosc_shell_release() and neosc_shell_destroy().
+ * neosc_shell_masterkey() loads the raw master key (16 to 64 bytes) from
+ * 'file' into locked memory. Array variables set to 'k:<length>' then
+ * receive a key derived per device from it, see neosc-crypto.h.
+ * neosc_shell_tap() waits until the device of the 'serial' variable is
+ * present (or absent if 'present' is 0). It blocks in PC/SC until a card
+ * is inserted or removed and then opens the device once, the reader list
+ * is rechecked every 'interval' milliseconds in case the PC/SC daemon
+ * does not report new readers. A device found present stays open, so
+ * the following command starts right away without opening the card
+ * again.
+ * neosc_shell_locktime() returns the microseconds the last call of
+ * neosc_shell_exec() waited in the engine queue, for the lock broker and
+ * for the PC/SC transaction lock of the device.
+ * neosc_shell_mismatches() returns the number of slots that failed the
+ * optional verification after being written.
+ * neosc_shell_recoveries() returns the number of commands for the first
+ * NFC attached device that succeeded only after the card was reopened
+ * within the grace window of the 'nfcgrace' variable.
+ * neosc_shell_timeout() returns the value of the 'timeout' variable
+ * in seconds or 0 if unset, enforcing it is up to the caller.
+ * neosc_shell_release() wipes and removes the published segment and
+ * merges pending inventory updates. It may be called from a watchdog
+ * right before _exit() while the context executes a command.
+ * neosc_shell_wipe() additionally clears all variables and cached results
+ * in place and is meant to be called from a watchdog right before
+ * _exit() for a context not executing a command. In both cases the
+ * context must not be used afterwards except for destruction.
+ */
+
+extern int neosc_shell_create(void **ctx,int flags);
+extern void neosc_shell_destroy(void *ctx);
+extern int neosc_shell_clone(void *ctx,void **clone);
+extern void neosc_shell_serial(void *ctx,int serial);
+extern int neosc_shell_lockd(void *ctx,char *path,int prio);
+extern int neosc_shell_cache(void *ctx,char *dir);
+extern int neosc_shell_metrics(void *ctx,char *file);
+extern int neosc_shell_flush(void *ctx);
+extern int neosc_shell_memoize(void *ctx,int ttl,int uses);
+extern int neosc_shell_home(void *ctx,int applet);
+extern void neosc_shell_keepoath(void *ctx,int enable);
+extern int neosc_shell_audit(void *ctx,char *file);
+extern int neosc_shell_journal(void *ctx,char *file,int resume);
+extern int neosc_shell_inventory(void *ctx,char *file);
+extern int neosc_shell_publish(void *ctx,char *name);
+extern int neosc_shell_masterkey(void *ctx,char *file);
+extern int neosc_shell_tap(void *ctx,int present,int interval);
+extern long long neosc_shell_locktime(void *ctx);
+extern int neosc_shell_mismatches(void *ctx);
+extern int neosc_shell_recoveries(void *ctx);
+extern int neosc_shell_timeout(void *ctx);
+extern void neosc_shell_release(void *ctx);
+extern void neosc_shell_wipe(void *ctx);
+extern int neosc_shell_exec(void *ctx,FILE *out,char *line);
+
+#endif
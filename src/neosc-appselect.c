@@ -21,35 +21,151 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <time.h>
 #include <libneosc.h>
+#include "neosc-lock.h"
+#include "neosc-audit.h"
+
+#define MAXDEV	64
+
+typedef struct
+{
+	pthread_t tid;
+	int running;
+	int serial;
+	int mode;
+	int err;
+} JOB;
+
+static char *lockd=NULL;
+static int prio=-1;
+static void *audit=NULL;
+
+static const char *applet[6]=
+{
+	"",
+	"appselect neo",
+	"appselect ndef",
+	"appselect oath",
+	"appselect openpgp",
+	"appselect piv",
+};
+
+static const char *errtxt[4]=
+{
+	"ok",
+	"device open error",
+	"device lock error",
+	"applet select error",
+};
 
 static void usage(void)
 {
     fprintf(stderr,
-	"Usage: neosc-appselect [-s <serial>|-u|-n] -N|-d|-o|-O|-p|-h\n"
+	"Usage: neosc-appselect [-s <serial> [-s ...]|-u|-n] -N|-d|-o|-O|-p|-h\n"
 	"-N             select NEO applet\n"
 	"-d             select NDEF applet\n"
 	"-o             select OATH applet\n"
 	"-O             select OpenPGP applet\n"
 	"-p             select PIV applet\n"
-	"-s <serial>    use YubiKey with given serial number\n"
+	"-s <serial>    use YubiKey with given serial number (may be repeated\n"
+	"               to switch several YubiKeys in parallel)\n"
 	"-u             use first USB attached YubiKey without serial number\n"
 	"-n             use first NFC attached YubiKey\n"
 	"-U		use first U2F enabled YubiKey 4 (nano)\n"
 	"-C		use first U2F disabled YubiKey 4 (nano)\n"
+	"-L <socket>    serialize card access through the neosc-lockd broker\n"
+	"-P <prio>      broker priority (0-9, lower is served first, default 5)\n"
+	"-A <file>      log the operation to the audit ring <file>\n"
 	"-h             this help text\n");
     exit(1);
 }
 
+static int appselect(int serial,int mode)
+{
+	int r=3;
+	int lock=-1;
+	long waited;
+	void *ctx;
+
+	if(lockd||prio!=-1)if((lock=neosc_lockd_acquire(lockd,serial,
+		prio!=-1?prio:NEOSC_LOCKD_DEFPRIO,&waited))==-1)return 2;
+
+	if(neosc_pcsc_open(&ctx,serial))
+	{
+		neosc_lockd_release(lock);
+		return 1;
+	}
+
+	if(neosc_pcsc_lock(ctx))
+	{
+		neosc_pcsc_close(ctx);
+		neosc_lockd_release(lock);
+		return 2;
+	}
+
+	switch(mode)
+	{
+	case 1:	if(neosc_neo_select(ctx,NULL))goto err;
+		break;
+	case 2:	if(neosc_ndef_select(ctx))goto err;
+		break;
+	case 3:	if(neosc_oath_select(ctx,NULL))goto err;
+		break;
+	case 4:	if(neosc_pgp_select(ctx))goto err;
+		break;
+	case 5:	if(neosc_piv_select(ctx))goto err;
+		break;
+	}
+
+	r=0;
+
+err:	neosc_pcsc_unlock(ctx);
+	neosc_pcsc_close(ctx);
+	neosc_lockd_release(lock);
+	return r;
+}
+
+static long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec*1000000LL+ts.tv_nsec/1000;
+}
+
+static int audited(int serial,int mode)
+{
+	int r;
+	long long t;
+
+	if(!audit)return appselect(serial,mode);
+	t=now();
+	r=appselect(serial,mode);
+	neosc_audit_log(audit,serial,(char *)applet[mode],-1,r,now()-t);
+	return r;
+}
+
+static void *worker(void *data)
+{
+	JOB *job=data;
+
+	job->err=audited(job->serial,job->mode);
+	return NULL;
+}
+
 int main(int argc,char *argv[])
 {
 	int c;
-	int r=1;
+	int i;
+	int r=0;
 	int mode=0;
+	int total=0;
 	int serial=NEOSC_ANY_YUBIKEY;
-	void *ctx;
+	JOB job[MAXDEV];
 
-	while((c=getopt(argc,argv,"NdoOps:unUCh"))!=-1)switch(c)
+	while((c=getopt(argc,argv,"NdoOps:unUCL:P:A:h"))!=-1)switch(c)
 	{
 	case 'N':
 		if(mode)usage();
@@ -72,8 +188,9 @@ int main(int argc,char *argv[])
 		mode=5;
 		break;
 	case 's':
-		if(serial!=NEOSC_ANY_YUBIKEY)usage();
+		if(total==MAXDEV||(serial!=NEOSC_ANY_YUBIKEY&&!total))usage();
 		if((serial=atoi(optarg))<=NEOSC_ANY_YUBIKEY)usage();
+		job[total++].serial=serial;
 		break;
 	case 'u':
 		if(serial!=NEOSC_ANY_YUBIKEY)usage();
@@ -92,42 +209,53 @@ int main(int argc,char *argv[])
 		serial=NEOSC_NOU2F_YUBIKEY4;
 		break;
 
+	case 'L':
+		if(lockd)usage();
+		lockd=optarg;
+		break;
+	case 'P':
+		if(prio!=-1)usage();
+		if((prio=atoi(optarg))<NEOSC_LOCKD_MINPRIO||
+			prio>NEOSC_LOCKD_MAXPRIO)usage();
+		break;
+
+	case 'A':
+		if(audit)usage();
+		if(!(audit=neosc_audit_open(optarg,1)))
+		{
+			fprintf(stderr,"cannot access audit log %s.\n",optarg);
+			return 1;
+		}
+		break;
+
 	case 'h':
 	default:usage();
 	}
 
 	if(!mode)usage();
 
-	if(neosc_pcsc_open(&ctx,serial))
+	if(total<2)
 	{
-		fprintf(stderr,"device open error.\n");
-		goto err1;
+		if((r=audited(serial,mode)))fprintf(stderr,"%s.\n",errtxt[r]);
+		return r?1:0;
 	}
 
-	if(neosc_pcsc_lock(ctx))
+	for(i=0;i<total;i++)
 	{
-		fprintf(stderr,"device lock error.\n");
-		goto err2;
+		job[i].mode=mode;
+		job[i].err=1;
+		job[i].running=0;
+		if(pthread_create(&job[i].tid,NULL,worker,&job[i]))
+			worker(&job[i]);
+		else job[i].running=1;
 	}
 
-	switch(mode)
+	for(i=0;i<total;i++)
 	{
-	case 1:	if(neosc_neo_select(ctx,NULL))goto err3;
-		break;
-	case 2:	if(neosc_ndef_select(ctx))goto err3;
-		break;
-	case 3:	if(neosc_oath_select(ctx,NULL))goto err3;
-		break;
-	case 4:	if(neosc_pgp_select(ctx))goto err3;
-		break;
-	case 5:	if(neosc_piv_select(ctx))goto err3;
-		break;
+		if(job[i].running)pthread_join(job[i].tid,NULL);
+		if(job[i].err)r=1;
+		printf("%d: %s\n",job[i].serial,errtxt[job[i].err]);
 	}
 
-	r=0;
-
-err3:	if(r)fprintf(stderr,"applet select error.\n");
-	neosc_pcsc_unlock(ctx);
-err2:	neosc_pcsc_close(ctx);
-err1:	return r;
+	return r;
 }
@@ -0,0 +1,154 @@
+/*
+ * neosc-audit - binary audit log in a shared memory mapped ring file
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include "neosc-audit.h"
+
+typedef struct
+{
+	size_t size;
+	NEOSC_AUDIT_HEADER *hdr;
+	NEOSC_AUDIT_RECORD *rec;
+} AUDIT;
+
+void *neosc_audit_open(char *path,int writer)
+{
+	int fd;
+	size_t size;
+	struct stat stb;
+	NEOSC_AUDIT_HEADER hdr;
+	AUDIT *log;
+
+	size=NEOSC_AUDIT_HDRSIZE+
+		(size_t)NEOSC_AUDIT_RECORDS*sizeof(NEOSC_AUDIT_RECORD);
+
+	if(!(log=malloc(sizeof(AUDIT))))goto err1;
+	if((fd=open(path,writer?O_RDWR|O_CREAT|O_CLOEXEC:O_RDONLY|O_CLOEXEC,
+		0600))==-1)goto err2;
+
+	if(writer)
+	{
+		if(flock(fd,LOCK_EX))goto err3;
+		if(fstat(fd,&stb))goto err3;
+		if(!stb.st_size)
+		{
+			memset(&hdr,0,sizeof(hdr));
+			hdr.magic=NEOSC_AUDIT_MAGIC;
+			hdr.recsize=sizeof(NEOSC_AUDIT_RECORD);
+			hdr.records=NEOSC_AUDIT_RECORDS;
+			if(ftruncate(fd,size))goto err3;
+			if(pwrite(fd,&hdr,sizeof(hdr),0)!=sizeof(hdr))goto err3;
+		}
+		flock(fd,LOCK_UN);
+	}
+
+	if(fstat(fd,&stb)||stb.st_size<NEOSC_AUDIT_HDRSIZE)goto err3;
+	if(pread(fd,&hdr,sizeof(hdr),0)!=sizeof(hdr))goto err3;
+	if(hdr.magic!=NEOSC_AUDIT_MAGIC||
+		hdr.recsize!=sizeof(NEOSC_AUDIT_RECORD)||!hdr.records)
+		goto err3;
+	size=NEOSC_AUDIT_HDRSIZE+(size_t)hdr.records*hdr.recsize;
+	if(stb.st_size<size)goto err3;
+
+	if((log->hdr=mmap(NULL,size,writer?PROT_READ|PROT_WRITE:PROT_READ,
+		MAP_SHARED,fd,0))==MAP_FAILED)goto err3;
+	close(fd);
+
+	log->size=size;
+	log->rec=(NEOSC_AUDIT_RECORD *)((char *)log->hdr+NEOSC_AUDIT_HDRSIZE);
+	return log;
+
+err3:	close(fd);
+err2:	free(log);
+err1:	return NULL;
+}
+
+void neosc_audit_close(void *log)
+{
+	AUDIT *a=log;
+
+	munmap(a->hdr,a->size);
+	free(a);
+}
+
+void neosc_audit_log(void *log,int serial,char *command,int slot,
+	int result,long long duration)
+{
+	uint64_t seq;
+	struct timeval tv;
+	NEOSC_AUDIT_RECORD *r;
+	AUDIT *a=log;
+
+	seq=__atomic_fetch_add(&a->hdr->head,1,__ATOMIC_RELAXED);
+	r=&a->rec[seq%a->hdr->records];
+
+	__atomic_store_n(&r->seq,0,__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	gettimeofday(&tv,NULL);
+	r->usec=(int64_t)tv.tv_sec*1000000+tv.tv_usec;
+	r->serial=serial;
+	r->slot=slot;
+	r->result=result;
+	r->duration=duration<0?0:duration>0xffffffffLL?0xffffffff:duration;
+	r->pid=getpid();
+	r->spare=0;
+	memset(r->command,0,sizeof(r->command));
+	strncpy(r->command,command,sizeof(r->command)-1);
+	__atomic_store_n(&r->seq,seq+1,__ATOMIC_RELEASE);
+}
+
+int neosc_audit_read(void *log,uint64_t seq,NEOSC_AUDIT_RECORD *rec)
+{
+	uint64_t s;
+	NEOSC_AUDIT_RECORD *r;
+	AUDIT *a=log;
+
+	r=&a->rec[seq%a->hdr->records];
+	if(__atomic_load_n(&r->seq,__ATOMIC_ACQUIRE)!=seq+1)return -1;
+	memcpy(rec,r,sizeof(NEOSC_AUDIT_RECORD));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	s=__atomic_load_n(&r->seq,__ATOMIC_RELAXED);
+	if(s!=seq+1)return -1;
+	rec->seq=seq;
+	rec->command[sizeof(rec->command)-1]=0;
+	return 0;
+}
+
+uint64_t neosc_audit_head(void *log)
+{
+	AUDIT *a=log;
+
+	return __atomic_load_n(&a->hdr->head,__ATOMIC_ACQUIRE);
+}
+
+uint32_t neosc_audit_records(void *log)
+{
+	AUDIT *a=log;
+
+	return a->hdr->records;
+}
@@ -0,0 +1,68 @@
+/*
+ * neosc-audit - binary audit log in a shared memory mapped ring file
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NEOSC_AUDIT_H
+#define _NEOSC_AUDIT_H
+
+#include <stdint.h>
+
+#define NEOSC_AUDIT_MAGIC	0x4e454f534341554cULL
+#define NEOSC_AUDIT_RECORDS	65536
+#define NEOSC_AUDIT_HDRSIZE	4096
+#define NEOSC_AUDIT_CMDLEN	32
+
+/*
+ * The file consists of a header page followed by a ring of fixed size
+ * records. A writer claims a record by incrementing 'head' and commits
+ * it by storing its sequence number plus one last, so readers skip
+ * records that are unused or still being written. Secrets are never
+ * logged, only the command name, slot, result and duration.
+ */
+
+typedef struct
+{
+	uint64_t magic;
+	uint32_t recsize;
+	uint32_t records;
+	uint64_t head;
+} NEOSC_AUDIT_HEADER;
+
+typedef struct
+{
+	uint64_t seq;
+	int64_t usec;
+	int32_t serial;
+	int32_t slot;
+	int32_t result;
+	uint32_t duration;
+	uint32_t pid;
+	uint32_t spare;
+	char command[NEOSC_AUDIT_CMDLEN];
+} NEOSC_AUDIT_RECORD;
+
+extern void *neosc_audit_open(char *path,int writer);
+extern void neosc_audit_close(void *log);
+extern void neosc_audit_log(void *log,int serial,char *command,int slot,
+	int result,long long duration);
+extern int neosc_audit_read(void *log,uint64_t seq,NEOSC_AUDIT_RECORD *rec);
+extern uint64_t neosc_audit_head(void *log);
+extern uint32_t neosc_audit_records(void *log);
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * neosc-auditlog - decode and filter the neosc-shell audit log
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "neosc-audit.h"
+
+static void usage(void)
+{
+	fprintf(stderr,"Usage: neosc-auditlog <options> <file>\n"
+	  "-s <serial>\tonly records of the given serial number\n"
+	  "-c <command>\tonly records of commands starting with <command>\n"
+	  "-p <pid>\tonly records of the given process\n"
+	  "-e\t\tonly failed operations\n"
+	  "-h\t\tthis help text\n");
+	exit(1);
+}
+
+int main(int argc,char *argv[])
+{
+	int c;
+	int errors=0;
+	int serial=0;
+	int pid=0;
+	char *cmd=NULL;
+	void *log;
+	uint64_t seq;
+	uint64_t head;
+	time_t t;
+	struct tm tm;
+	NEOSC_AUDIT_RECORD rec;
+	char stamp[32];
+
+	while((c=getopt(argc,argv,"s:c:p:eh"))!=-1)switch(c)
+	{
+	case 's':
+		if(serial||(serial=atoi(optarg))<=0)usage();
+		break;
+	case 'c':
+		if(cmd)usage();
+		cmd=optarg;
+		break;
+	case 'p':
+		if(pid||(pid=atoi(optarg))<=0)usage();
+		break;
+	case 'e':
+		if(errors)usage();
+		errors=1;
+		break;
+	case 'h':
+	default:usage();
+	}
+
+	if(optind!=argc-1)usage();
+
+	if(!(log=neosc_audit_open(argv[optind],0)))
+	{
+		fprintf(stderr,"cannot access audit log %s.\n",argv[optind]);
+		return 1;
+	}
+
+	head=neosc_audit_head(log);
+	seq=head>neosc_audit_records(log)?head-neosc_audit_records(log):0;
+
+	for(;seq<head;seq++)
+	{
+		if(neosc_audit_read(log,seq,&rec))continue;
+		if(serial&&rec.serial!=serial)continue;
+		if(pid&&rec.pid!=pid)continue;
+		if(errors&&!rec.result)continue;
+		if(cmd&&strncmp(rec.command,cmd,strlen(cmd)))continue;
+
+		t=rec.usec/1000000;
+		localtime_r(&t,&tm);
+		strftime(stamp,sizeof(stamp),"%Y-%m-%d %H:%M:%S",&tm);
+		printf("%s.%06d pid=%u serial=",stamp,(int)(rec.usec%1000000),
+			rec.pid);
+		if(rec.serial>0)printf("%d",rec.serial);
+		else printf("any");
+		printf(" command=\"%s\" slot=",rec.command);
+		if(rec.slot>=0)printf("%d",rec.slot);
+		else printf("-");
+		printf(" result=%d duration=%uus\n",rec.result,rec.duration);
+	}
+
+	neosc_audit_close(log);
+	return 0;
+}
@@ -0,0 +1,403 @@
+/*
+ * neosc-crypto - local HMAC-SHA1 and AES-128 for verification of slots
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include "neosc-crypto.h"
+
+#define memclear(a,b,c) \
+    do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
+
+#define ROL(a,n)	(((a)<<(n))|((a)>>(32-(n))))
+#define XT(a)		((unsigned char)(((a)<<1)^(((a)&0x80)?0x1b:0)))
+
+typedef struct
+{
+	unsigned int h[5];
+	unsigned int total;
+	int fill;
+	unsigned char bfr[64];
+} SHA1;
+
+static const unsigned char sbox[256]=
+{
+	0x63,0x7c,0x77,0x7b,0xf2,0x6b,0x6f,0xc5,0x30,0x01,0x67,0x2b,
+	0xfe,0xd7,0xab,0x76,0xca,0x82,0xc9,0x7d,0xfa,0x59,0x47,0xf0,
+	0xad,0xd4,0xa2,0xaf,0x9c,0xa4,0x72,0xc0,0xb7,0xfd,0x93,0x26,
+	0x36,0x3f,0xf7,0xcc,0x34,0xa5,0xe5,0xf1,0x71,0xd8,0x31,0x15,
+	0x04,0xc7,0x23,0xc3,0x18,0x96,0x05,0x9a,0x07,0x12,0x80,0xe2,
+	0xeb,0x27,0xb2,0x75,0x09,0x83,0x2c,0x1a,0x1b,0x6e,0x5a,0xa0,
+	0x52,0x3b,0xd6,0xb3,0x29,0xe3,0x2f,0x84,0x53,0xd1,0x00,0xed,
+	0x20,0xfc,0xb1,0x5b,0x6a,0xcb,0xbe,0x39,0x4a,0x4c,0x58,0xcf,
+	0xd0,0xef,0xaa,0xfb,0x43,0x4d,0x33,0x85,0x45,0xf9,0x02,0x7f,
+	0x50,0x3c,0x9f,0xa8,0x51,0xa3,0x40,0x8f,0x92,0x9d,0x38,0xf5,
+	0xbc,0xb6,0xda,0x21,0x10,0xff,0xf3,0xd2,0xcd,0x0c,0x13,0xec,
+	0x5f,0x97,0x44,0x17,0xc4,0xa7,0x7e,0x3d,0x64,0x5d,0x19,0x73,
+	0x60,0x81,0x4f,0xdc,0x22,0x2a,0x90,0x88,0x46,0xee,0xb8,0x14,
+	0xde,0x5e,0x0b,0xdb,0xe0,0x32,0x3a,0x0a,0x49,0x06,0x24,0x5c,
+	0xc2,0xd3,0xac,0x62,0x91,0x95,0xe4,0x79,0xe7,0xc8,0x37,0x6d,
+	0x8d,0xd5,0x4e,0xa9,0x6c,0x56,0xf4,0xea,0x65,0x7a,0xae,0x08,
+	0xba,0x78,0x25,0x2e,0x1c,0xa6,0xb4,0xc6,0xe8,0xdd,0x74,0x1f,
+	0x4b,0xbd,0x8b,0x8a,0x70,0x3e,0xb5,0x66,0x48,0x03,0xf6,0x0e,
+	0x61,0x35,0x57,0xb9,0x86,0xc1,0x1d,0x9e,0xe1,0xf8,0x98,0x11,
+	0x69,0xd9,0x8e,0x94,0x9b,0x1e,0x87,0xe9,0xce,0x55,0x28,0xdf,
+	0x8c,0xa1,0x89,0x0d,0xbf,0xe6,0x42,0x68,0x41,0x99,0x2d,0x0f,
+	0xb0,0x54,0xbb,0x16
+};
+
+static const unsigned char ibox[256]=
+{
+	0x52,0x09,0x6a,0xd5,0x30,0x36,0xa5,0x38,0xbf,0x40,0xa3,0x9e,
+	0x81,0xf3,0xd7,0xfb,0x7c,0xe3,0x39,0x82,0x9b,0x2f,0xff,0x87,
+	0x34,0x8e,0x43,0x44,0xc4,0xde,0xe9,0xcb,0x54,0x7b,0x94,0x32,
+	0xa6,0xc2,0x23,0x3d,0xee,0x4c,0x95,0x0b,0x42,0xfa,0xc3,0x4e,
+	0x08,0x2e,0xa1,0x66,0x28,0xd9,0x24,0xb2,0x76,0x5b,0xa2,0x49,
+	0x6d,0x8b,0xd1,0x25,0x72,0xf8,0xf6,0x64,0x86,0x68,0x98,0x16,
+	0xd4,0xa4,0x5c,0xcc,0x5d,0x65,0xb6,0x92,0x6c,0x70,0x48,0x50,
+	0xfd,0xed,0xb9,0xda,0x5e,0x15,0x46,0x57,0xa7,0x8d,0x9d,0x84,
+	0x90,0xd8,0xab,0x00,0x8c,0xbc,0xd3,0x0a,0xf7,0xe4,0x58,0x05,
+	0xb8,0xb3,0x45,0x06,0xd0,0x2c,0x1e,0x8f,0xca,0x3f,0x0f,0x02,
+	0xc1,0xaf,0xbd,0x03,0x01,0x13,0x8a,0x6b,0x3a,0x91,0x11,0x41,
+	0x4f,0x67,0xdc,0xea,0x97,0xf2,0xcf,0xce,0xf0,0xb4,0xe6,0x73,
+	0x96,0xac,0x74,0x22,0xe7,0xad,0x35,0x85,0xe2,0xf9,0x37,0xe8,
+	0x1c,0x75,0xdf,0x6e,0x47,0xf1,0x1a,0x71,0x1d,0x29,0xc5,0x89,
+	0x6f,0xb7,0x62,0x0e,0xaa,0x18,0xbe,0x1b,0xfc,0x56,0x3e,0x4b,
+	0xc6,0xd2,0x79,0x20,0x9a,0xdb,0xc0,0xfe,0x78,0xcd,0x5a,0xf4,
+	0x1f,0xdd,0xa8,0x33,0x88,0x07,0xc7,0x31,0xb1,0x12,0x10,0x59,
+	0x27,0x80,0xec,0x5f,0x60,0x51,0x7f,0xa9,0x19,0xb5,0x4a,0x0d,
+	0x2d,0xe5,0x7a,0x9f,0x93,0xc9,0x9c,0xef,0xa0,0xe0,0x3b,0x4d,
+	0xae,0x2a,0xf5,0xb0,0xc8,0xeb,0xbb,0x3c,0x83,0x53,0x99,0x61,
+	0x17,0x2b,0x04,0x7e,0xba,0x77,0xd6,0x26,0xe1,0x69,0x14,0x63,
+	0x55,0x21,0x0c,0x7d
+};
+
+static unsigned char mul(unsigned char a,unsigned char b)
+{
+	unsigned char r=0;
+
+	while(b)
+	{
+		if(b&1)r^=a;
+		a=XT(a);
+		b>>=1;
+	}
+	return r;
+}
+
+static void aesdecrypt(unsigned char *key,unsigned char *data)
+{
+	int i;
+	int j;
+	unsigned char rc=1;
+	unsigned char t[4];
+	unsigned char s[16];
+	unsigned char k[176];
+
+	memcpy(k,key,16);
+	for(i=16;i<176;i+=4)
+	{
+		memcpy(t,k+i-4,4);
+		if(!(i&15))
+		{
+			j=t[0];
+			t[0]=sbox[t[1]]^rc;
+			t[1]=sbox[t[2]];
+			t[2]=sbox[t[3]];
+			t[3]=sbox[j];
+			rc=XT(rc);
+		}
+		for(j=0;j<4;j++)k[i+j]=k[i+j-16]^t[j];
+	}
+
+	for(i=0;i<16;i++)data[i]^=k[160+i];
+
+	for(i=9;i>=0;i--)
+	{
+		for(j=0;j<16;j++)s[j]=ibox[data[(j+12*(j&3))&15]];
+		for(j=0;j<16;j++)s[j]^=k[16*i+j];
+		if(!i)
+		{
+			memcpy(data,s,16);
+			break;
+		}
+		for(j=0;j<16;j+=4)
+		{
+			data[j]=mul(s[j],14)^mul(s[j+1],11)^mul(s[j+2],13)^
+				mul(s[j+3],9);
+			data[j+1]=mul(s[j],9)^mul(s[j+1],14)^mul(s[j+2],11)^
+				mul(s[j+3],13);
+			data[j+2]=mul(s[j],13)^mul(s[j+1],9)^mul(s[j+2],14)^
+				mul(s[j+3],11);
+			data[j+3]=mul(s[j],11)^mul(s[j+1],13)^mul(s[j+2],9)^
+				mul(s[j+3],14);
+		}
+	}
+
+	memclear(t,0,sizeof(t));
+	memclear(s,0,sizeof(s));
+	memclear(k,0,sizeof(k));
+}
+
+static void block(SHA1 *s,unsigned char *p)
+{
+	int i;
+	unsigned int a,b,c,d,e,f,k,t;
+	unsigned int w[80];
+
+	for(i=0;i<16;i++)w[i]=(p[4*i]<<24)|(p[4*i+1]<<16)|(p[4*i+2]<<8)|
+		p[4*i+3];
+	for(;i<80;i++)w[i]=ROL(w[i-3]^w[i-8]^w[i-14]^w[i-16],1);
+
+	a=s->h[0];
+	b=s->h[1];
+	c=s->h[2];
+	d=s->h[3];
+	e=s->h[4];
+
+	for(i=0;i<80;i++)
+	{
+		if(i<20)
+		{
+			f=(b&c)|(~b&d);
+			k=0x5a827999;
+		}
+		else if(i<40)
+		{
+			f=b^c^d;
+			k=0x6ed9eba1;
+		}
+		else if(i<60)
+		{
+			f=(b&c)|(b&d)|(c&d);
+			k=0x8f1bbcdc;
+		}
+		else
+		{
+			f=b^c^d;
+			k=0xca62c1d6;
+		}
+		t=ROL(a,5)+f+e+k+w[i];
+		e=d;
+		d=c;
+		c=ROL(b,30);
+		b=a;
+		a=t;
+	}
+
+	s->h[0]+=a;
+	s->h[1]+=b;
+	s->h[2]+=c;
+	s->h[3]+=d;
+	s->h[4]+=e;
+
+	memclear(w,0,sizeof(w));
+}
+
+static void init(SHA1 *s)
+{
+	s->h[0]=0x67452301;
+	s->h[1]=0xefcdab89;
+	s->h[2]=0x98badcfe;
+	s->h[3]=0x10325476;
+	s->h[4]=0xc3d2e1f0;
+	s->total=0;
+	s->fill=0;
+}
+
+static void update(SHA1 *s,unsigned char *data,int len)
+{
+	int n;
+
+	s->total+=len;
+	while(len)
+	{
+		n=64-s->fill;
+		if(n>len)n=len;
+		memcpy(s->bfr+s->fill,data,n);
+		s->fill+=n;
+		data+=n;
+		len-=n;
+		if(s->fill==64)
+		{
+			block(s,s->bfr);
+			s->fill=0;
+		}
+	}
+}
+
+static void final(SHA1 *s,unsigned char *out)
+{
+	int i;
+	unsigned int hi=s->total>>29;
+	unsigned int lo=s->total<<3;
+	unsigned char pad[72];
+
+	memset(pad,0,sizeof(pad));
+	pad[0]=0x80;
+	i=(s->fill<56?56:120)-s->fill;
+	pad[i]=(unsigned char)(hi>>24);
+	pad[i+1]=(unsigned char)(hi>>16);
+	pad[i+2]=(unsigned char)(hi>>8);
+	pad[i+3]=(unsigned char)hi;
+	pad[i+4]=(unsigned char)(lo>>24);
+	pad[i+5]=(unsigned char)(lo>>16);
+	pad[i+6]=(unsigned char)(lo>>8);
+	pad[i+7]=(unsigned char)lo;
+	update(s,pad,i+8);
+
+	for(i=0;i<5;i++)
+	{
+		out[4*i]=(unsigned char)(s->h[i]>>24);
+		out[4*i+1]=(unsigned char)(s->h[i]>>16);
+		out[4*i+2]=(unsigned char)(s->h[i]>>8);
+		out[4*i+3]=(unsigned char)s->h[i];
+	}
+	memclear(s,0,sizeof(SHA1));
+}
+
+void neosc_crypto_hmac_sha1(unsigned char *key,int klen,
+	unsigned char *data,int len,unsigned char *out)
+{
+	int i;
+	SHA1 s;
+	unsigned char k[64];
+	unsigned char inner[NEOSC_CRYPTO_HMAC_SIZE];
+
+	memset(k,0,sizeof(k));
+	if(klen>64)
+	{
+		init(&s);
+		update(&s,key,klen);
+		final(&s,k);
+	}
+	else memcpy(k,key,klen);
+
+	for(i=0;i<64;i++)k[i]^=0x36;
+	init(&s);
+	update(&s,k,64);
+	update(&s,data,len);
+	final(&s,inner);
+
+	for(i=0;i<64;i++)k[i]^=0x36^0x5c;
+	init(&s);
+	update(&s,k,64);
+	update(&s,inner,NEOSC_CRYPTO_HMAC_SIZE);
+	final(&s,out);
+
+	memclear(k,0,sizeof(k));
+	memclear(inner,0,sizeof(inner));
+}
+
+int neosc_crypto_otp_check(unsigned char *key,unsigned char *uid,
+	unsigned char *otp)
+{
+	int i;
+	int j;
+	int r;
+	unsigned short crc=0xffff;
+	unsigned char bfr[NEOSC_CRYPTO_AES_SIZE];
+
+	memcpy(bfr,otp,sizeof(bfr));
+	aesdecrypt(key,bfr);
+
+	for(i=0;i<NEOSC_CRYPTO_AES_SIZE;i++)
+	{
+		crc^=bfr[i];
+		for(j=0;j<8;j++)crc=(crc&1)?(crc>>1)^0x8408:crc>>1;
+	}
+
+	r=(crc!=0xf0b8||memcmp(bfr,uid,NEOSC_CRYPTO_UID_SIZE))?-1:0;
+	memclear(bfr,0,sizeof(bfr));
+	return r;
+}
+
+int neosc_crypto_hkdf_sha1(unsigned char *salt,int saltlen,
+	unsigned char *ikm,int ikmlen,unsigned char *info,int infolen,
+	unsigned char *out,int len)
+{
+	int i;
+	int n;
+	unsigned char prk[NEOSC_CRYPTO_HMAC_SIZE];
+	unsigned char t[NEOSC_CRYPTO_HMAC_SIZE+NEOSC_CRYPTO_HKDF_INFO+1];
+
+	if(len<=0||len>255*NEOSC_CRYPTO_HMAC_SIZE||infolen<0||
+		infolen>NEOSC_CRYPTO_HKDF_INFO)return -1;
+
+	if(!salt)
+	{
+		memset(t,0,NEOSC_CRYPTO_HMAC_SIZE);
+		salt=t;
+		saltlen=NEOSC_CRYPTO_HMAC_SIZE;
+	}
+	neosc_crypto_hmac_sha1(salt,saltlen,ikm,ikmlen,prk);
+
+	for(n=0,i=1;len;i++)
+	{
+		memcpy(t+n,info,infolen);
+		t[n+infolen]=(unsigned char)i;
+		neosc_crypto_hmac_sha1(prk,NEOSC_CRYPTO_HMAC_SIZE,t,
+			n+infolen+1,t);
+		n=len<NEOSC_CRYPTO_HMAC_SIZE?len:NEOSC_CRYPTO_HMAC_SIZE;
+		memcpy(out,t,n);
+		out+=n;
+		len-=n;
+		n=NEOSC_CRYPTO_HMAC_SIZE;
+	}
+
+	memclear(prk,0,sizeof(prk));
+	memclear(t,0,sizeof(t));
+	return 0;
+}
+
+int neosc_crypto_derive(unsigned char *master,int mlen,char *name,
+	int serial,int slot,unsigned char *out,int len)
+{
+	int n;
+	unsigned char info[NEOSC_CRYPTO_HKDF_INFO];
+
+	if((n=strlen(name))>NEOSC_CRYPTO_HKDF_INFO-6)return -1;
+	memcpy(info,name,n);
+	info[n++]=0;
+	info[n++]=(unsigned char)(serial>>24);
+	info[n++]=(unsigned char)(serial>>16);
+	info[n++]=(unsigned char)(serial>>8);
+	info[n++]=(unsigned char)serial;
+	info[n++]=(unsigned char)(slot<0?0xff:slot);
+	return neosc_crypto_hkdf_sha1(NULL,0,master,mlen,info,n,out,len);
+}
+
+int neosc_crypto_loadkey(char *path,unsigned char *key)
+{
+	int fd;
+	int n;
+	int l;
+	unsigned char bfr[NEOSC_CRYPTO_MAXKEY+1];
+
+	if((fd=open(path,O_RDONLY|O_CLOEXEC))==-1)return -1;
+	for(n=0;n<sizeof(bfr);n+=l)if((l=read(fd,bfr+n,sizeof(bfr)-n))<=0)
+		break;
+	close(fd);
+
+	if(l<0||n<NEOSC_CRYPTO_MINKEY||n>NEOSC_CRYPTO_MAXKEY)n=-1;
+	else memcpy(key,bfr,n);
+	memclear(bfr,0,sizeof(bfr));
+	return n;
+}
@@ -0,0 +1,52 @@
+/*
+ * neosc-crypto - local HMAC-SHA1 and AES-128 for verification of slots
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NEOSC_CRYPTO_H
+#define _NEOSC_CRYPTO_H
+
+#define NEOSC_CRYPTO_HMAC_SIZE	20
+#define NEOSC_CRYPTO_AES_SIZE	16
+#define NEOSC_CRYPTO_UID_SIZE	6
+#define NEOSC_CRYPTO_HKDF_INFO	64
+#define NEOSC_CRYPTO_MINKEY	16
+#define NEOSC_CRYPTO_MAXKEY	64
+
+/*
+ * Per device secrets are derived with HKDF-SHA1 (RFC 5869) without salt
+ * from the master key and the info string
+ *
+ *	<variable name> 0x00 <serial, 32 bit big endian> <slot, 8 bit>
+ *
+ * where the slot is 0xff if not applicable. A master key file holds
+ * NEOSC_CRYPTO_MINKEY to NEOSC_CRYPTO_MAXKEY raw bytes.
+ */
+
+extern void neosc_crypto_hmac_sha1(unsigned char *key,int klen,
+	unsigned char *data,int len,unsigned char *out);
+extern int neosc_crypto_otp_check(unsigned char *key,unsigned char *uid,
+	unsigned char *otp);
+extern int neosc_crypto_hkdf_sha1(unsigned char *salt,int saltlen,
+	unsigned char *ikm,int ikmlen,unsigned char *info,int infolen,
+	unsigned char *out,int len);
+extern int neosc_crypto_derive(unsigned char *master,int mlen,char *name,
+	int serial,int slot,unsigned char *out,int len);
+extern int neosc_crypto_loadkey(char *path,unsigned char *key);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * neosc-derive - offline derivation of per device keys from a master key
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "neosc-crypto.h"
+
+#define MAXNAMES	8
+#define MAXOUT		64
+
+#define memclear(a,b,c) \
+    do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
+
+typedef struct
+{
+	char *name;
+	int len;
+} NAME;
+
+typedef struct
+{
+	unsigned char master[NEOSC_CRYPTO_MAXKEY];
+	unsigned char out[MAXOUT];
+} SECRET;
+
+static NAME defnames[]=
+{
+	{"secretkey",20},
+	{"accesscode",6},
+	{"privateid",6},
+};
+
+static void usage(void)
+{
+	fprintf(stderr,"Usage: neosc-derive <options> [<name>[:<length>]...]\n"
+	  "-k <file>\tmaster key file (required)\n"
+	  "-s <first>[-<last>]\tserial number or range (required)\n"
+	  "-l <slot>\tslot 0 or 1 (default none)\n"
+	  "-h\t\tthis help text\n"
+	  "default names are secretkey:20 accesscode:6 privateid:6\n");
+	exit(1);
+}
+
+int main(int argc,char *argv[])
+{
+	int c;
+	int i;
+	int j;
+	int r=1;
+	int mlen;
+	int total;
+	int slot=-1;
+	long long first=0;
+	long long last=0;
+	long long serial;
+	char *key=NULL;
+	char *eptr;
+	NAME *names=defnames;
+	NAME list[MAXNAMES];
+	SECRET *s;
+
+	while((c=getopt(argc,argv,"k:s:l:h"))!=-1)switch(c)
+	{
+	case 'k':
+		if(key)usage();
+		key=optarg;
+		break;
+	case 's':
+		if(first)usage();
+		first=strtoll(optarg,&eptr,10);
+		if(eptr==optarg)usage();
+		if(*eptr=='-')
+		{
+			last=strtoll(eptr+1,&eptr,10);
+			if(*eptr)usage();
+		}
+		else if(*eptr)usage();
+		else last=first;
+		if(first<=0||last<first||last>0x7fffffff)usage();
+		break;
+	case 'l':
+		if(slot!=-1)usage();
+		if((slot=atoi(optarg))<0||slot>1)usage();
+		break;
+	case 'h':
+	default:usage();
+	}
+
+	if(!key||!first||argc-optind>MAXNAMES)usage();
+
+	if(optind<argc)
+	{
+		for(total=0;optind<argc;optind++,total++)
+		{
+			list[total].name=argv[optind];
+			list[total].len=20;
+			if((eptr=strchr(argv[optind],':')))
+			{
+				*eptr++=0;
+				list[total].len=atoi(eptr);
+			}
+			if(!*list[total].name||list[total].len<=0||
+				list[total].len>MAXOUT)usage();
+		}
+		names=list;
+	}
+	else total=sizeof(defnames)/sizeof(NAME);
+
+	if((s=mmap(NULL,sizeof(SECRET),PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS,-1,0))==MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+	if(mlock(s,sizeof(SECRET)))
+	{
+		fprintf(stderr,"cannot lock memory.\n");
+		goto err1;
+	}
+	madvise(s,sizeof(SECRET),MADV_DONTDUMP);
+
+	if((mlen=neosc_crypto_loadkey(key,s->master))==-1)
+	{
+		fprintf(stderr,"cannot load master key %s.\n",key);
+		goto err2;
+	}
+
+	for(serial=first;serial<=last;serial++)
+	{
+		printf("serial=%lld",serial);
+		for(i=0;i<total;i++)
+		{
+			if(neosc_crypto_derive(s->master,mlen,names[i].name,
+				(int)serial,slot,s->out,names[i].len))
+			{
+				printf("\n");
+				fprintf(stderr,"derivation failed.\n");
+				goto err2;
+			}
+			printf(" %s=",names[i].name);
+			for(j=0;j<names[i].len;j++)printf("%02x",s->out[j]);
+		}
+		printf("\n");
+	}
+
+	r=0;
+
+err2:	memclear(s,0,sizeof(SECRET));
+	munlock(s,sizeof(SECRET));
+err1:	munmap(s,sizeof(SECRET));
+	return r;
+}
@@ -0,0 +1,487 @@
+/*
+ * neosc-inventory - memory mapped inventory of provisioned devices
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include "neosc-inventory.h"
+
+#define ALIGN(a)	(((a)+7)&~((size_t)7))
+
+typedef struct
+{
+	NEOSC_INV_RECORD rec;
+	int total;
+	NEOSC_INV_NAME *names;
+} PENDING;
+
+typedef struct
+{
+	char *path;
+	int total;
+	int last;
+	long long committed;
+	PENDING *pend;
+} WRITER;
+
+static long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec*1000LL+ts.tv_nsec/1000000;
+}
+
+static int pendcmp(const void *p1,const void *p2)
+{
+	const PENDING *e1=p1;
+	const PENDING *e2=p2;
+
+	if(e1->rec.serial==e2->rec.serial)return 0;
+	return e1->rec.serial<e2->rec.serial?-1:1;
+}
+
+static int vercmp(const void *p1,const void *p2,void *arg)
+{
+	const NEOSC_INV_RECORD *r1=(NEOSC_INV_RECORD *)arg+*(uint32_t *)p1;
+	const NEOSC_INV_RECORD *r2=(NEOSC_INV_RECORD *)arg+*(uint32_t *)p2;
+
+	if((r1->valid^r2->valid)&NEOSC_INV_DEVICE)
+		return (r1->valid&NEOSC_INV_DEVICE)?-1:1;
+	if(r1->major!=r2->major)return r1->major<r2->major?-1:1;
+	if(r1->minor!=r2->minor)return r1->minor<r2->minor?-1:1;
+	if(r1->build!=r2->build)return r1->build<r2->build?-1:1;
+	if(r1->serial!=r2->serial)return r1->serial<r2->serial?-1:1;
+	return 0;
+}
+
+static int namecmp(const void *p1,const void *p2,void *arg)
+{
+	int r;
+	const NEOSC_INV_NAME *n1=(NEOSC_INV_NAME *)arg+*(uint32_t *)p1;
+	const NEOSC_INV_NAME *n2=(NEOSC_INV_NAME *)arg+*(uint32_t *)p2;
+
+	if((r=strcmp(n1->name,n2->name)))return r;
+	if(n1->record!=n2->record)return n1->record<n2->record?-1:1;
+	return 0;
+}
+
+static PENDING *pending(WRITER *w,int serial)
+{
+	int i;
+	PENDING *p;
+
+	if(w->last<w->total&&w->pend[w->last].rec.serial==serial)
+		return &w->pend[w->last];
+	for(i=0;i<w->total;i++)if(w->pend[i].rec.serial==serial)
+		return &w->pend[(w->last=i)];
+
+	if(!(w->total&63))
+	{
+		if(!(p=realloc(w->pend,(w->total+64)*sizeof(PENDING))))
+			return NULL;
+		w->pend=p;
+	}
+	p=&w->pend[(w->last=w->total++)];
+	memset(p,0,sizeof(PENDING));
+	p->rec.serial=serial;
+	return p;
+}
+
+static void pendfree(WRITER *w)
+{
+	int i;
+
+	for(i=0;i<w->total;i++)if(w->pend[i].names)free(w->pend[i].names);
+	if(w->pend)free(w->pend);
+	w->pend=NULL;
+	w->total=0;
+	w->last=0;
+}
+
+void *neosc_inventory_open(char *path)
+{
+	WRITER *w;
+
+	if(!(w=malloc(sizeof(WRITER))))goto err1;
+	memset(w,0,sizeof(WRITER));
+	if(!(w->path=strdup(path)))goto err2;
+	w->committed=now();
+	return w;
+
+err2:	free(w);
+err1:	return NULL;
+}
+
+void neosc_inventory_device(void *inv,int serial,int major,int minor,
+	int build,int pgmseq,int slots)
+{
+	PENDING *p;
+
+	if(serial<=0||!(p=pending(inv,serial)))return;
+	p->rec.major=major;
+	p->rec.minor=minor;
+	p->rec.build=build;
+	p->rec.pgmseq=pgmseq;
+	p->rec.slots=slots;
+	p->rec.valid|=NEOSC_INV_DEVICE;
+	p->rec.updated=time(NULL);
+}
+
+void neosc_inventory_mode(void *inv,int serial,int mode)
+{
+	PENDING *p;
+
+	if(serial<=0||!(p=pending(inv,serial)))return;
+	p->rec.mode=mode;
+	p->rec.valid|=NEOSC_INV_MODE;
+	p->rec.updated=time(NULL);
+}
+
+/*
+ * A NULL name starts a new, complete list of OATH entries of the device,
+ * every following call adds an entry to it.
+ */
+void neosc_inventory_oath(void *inv,int serial,char *name)
+{
+	PENDING *p;
+	NEOSC_INV_NAME *n;
+
+	if(serial<=0||!(p=pending(inv,serial)))return;
+	p->rec.valid|=NEOSC_INV_OATH;
+	p->rec.updated=time(NULL);
+
+	if(!name)
+	{
+		if(p->names)free(p->names);
+		p->names=NULL;
+		p->total=0;
+		return;
+	}
+
+	if(!(p->total&15))
+	{
+		if(!(n=realloc(p->names,(p->total+16)*sizeof(NEOSC_INV_NAME))))
+			return;
+		p->names=n;
+	}
+	n=&p->names[p->total++];
+	memset(n,0,sizeof(NEOSC_INV_NAME));
+	strncpy(n->name,name,NEOSC_INV_NAMELEN-1);
+}
+
+static int merge(WRITER *w,NEOSC_INVENTORY *old,char *tmp)
+{
+	int i;
+	int j;
+	int fd;
+	uint32_t k;
+	uint32_t n;
+	uint32_t l;
+	uint32_t nrec=0;
+	uint32_t nname=0;
+	size_t size;
+	size_t len;
+	ssize_t wr;
+	char *data;
+	NEOSC_INV_HEADER *hdr;
+	NEOSC_INV_RECORD *rec;
+	NEOSC_INV_RECORD *o;
+	NEOSC_INV_NAME *name;
+	PENDING *p;
+
+	for(i=0,j=0;i<(old?old->hdr->records:0)||j<w->total;nrec++)
+	{
+		o=(old&&i<old->hdr->records)?&old->rec[i]:NULL;
+		p=j<w->total?&w->pend[j]:NULL;
+		if(p&&o&&o->serial!=p->rec.serial)
+		{
+			if(o->serial<p->rec.serial)p=NULL;
+			else o=NULL;
+		}
+		if(o)i++;
+		if(p)j++;
+		if(p&&(p->rec.valid&NEOSC_INV_OATH))nname+=p->total;
+		else if(o)nname+=o->oathcount;
+	}
+
+	size=ALIGN(sizeof(NEOSC_INV_HEADER))+
+		ALIGN((size_t)nrec*sizeof(NEOSC_INV_RECORD))+
+		ALIGN((size_t)nname*sizeof(NEOSC_INV_NAME))+
+		ALIGN((size_t)nrec*sizeof(uint32_t))+
+		ALIGN((size_t)nname*sizeof(uint32_t));
+	if(!(data=malloc(size)))goto err1;
+	memset(data,0,size);
+
+	hdr=(NEOSC_INV_HEADER *)data;
+	hdr->magic=NEOSC_INV_MAGIC;
+	hdr->version=NEOSC_INV_VERSION;
+	hdr->records=nrec;
+	hdr->names=nname;
+	hdr->generation=old?old->hdr->generation+1:1;
+	hdr->recoff=ALIGN(sizeof(NEOSC_INV_HEADER));
+	hdr->nameoff=hdr->recoff+ALIGN((size_t)nrec*sizeof(NEOSC_INV_RECORD));
+	hdr->veroff=hdr->nameoff+ALIGN((size_t)nname*sizeof(NEOSC_INV_NAME));
+	hdr->idxoff=hdr->veroff+ALIGN((size_t)nrec*sizeof(uint32_t));
+	rec=(NEOSC_INV_RECORD *)(data+hdr->recoff);
+	name=(NEOSC_INV_NAME *)(data+hdr->nameoff);
+
+	for(i=0,j=0,k=0,n=0;k<nrec;k++)
+	{
+		o=(old&&i<old->hdr->records)?&old->rec[i]:NULL;
+		p=j<w->total?&w->pend[j]:NULL;
+		if(p&&o&&o->serial!=p->rec.serial)
+		{
+			if(o->serial<p->rec.serial)p=NULL;
+			else o=NULL;
+		}
+		if(o)i++;
+		if(p)j++;
+
+		if(o)rec[k]=*o;
+		else rec[k].serial=p->rec.serial;
+		rec[k].oathfirst=n;
+		rec[k].oathcount=0;
+
+		if(p)
+		{
+			if(p->rec.valid&NEOSC_INV_DEVICE)
+			{
+				rec[k].major=p->rec.major;
+				rec[k].minor=p->rec.minor;
+				rec[k].build=p->rec.build;
+				rec[k].pgmseq=p->rec.pgmseq;
+				rec[k].slots=p->rec.slots;
+			}
+			if(p->rec.valid&NEOSC_INV_MODE)rec[k].mode=p->rec.mode;
+			rec[k].valid|=p->rec.valid;
+			rec[k].updated=p->rec.updated;
+		}
+
+		if(p&&(p->rec.valid&NEOSC_INV_OATH))for(l=0;l<p->total;l++)
+		{
+			name[n]=p->names[l];
+			name[n++].record=k;
+		}
+		else if(o)for(l=0;l<o->oathcount;l++)
+		{
+			name[n]=old->name[o->oathfirst+l];
+			name[n++].record=k;
+		}
+		rec[k].oathcount=n-rec[k].oathfirst;
+	}
+
+	for(k=0;k<nrec;k++)((uint32_t *)(data+hdr->veroff))[k]=k;
+	qsort_r(data+hdr->veroff,nrec,sizeof(uint32_t),vercmp,rec);
+	for(k=0;k<nname;k++)((uint32_t *)(data+hdr->idxoff))[k]=k;
+	qsort_r(data+hdr->idxoff,nname,sizeof(uint32_t),namecmp,name);
+
+	if((fd=open(tmp,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644))==-1)
+		goto err2;
+	for(len=0;len<size;len+=wr)
+		if((wr=write(fd,data+len,size-len))<=0)goto err3;
+	if(fsync(fd))goto err3;
+	close(fd);
+	free(data);
+	return 0;
+
+err3:	close(fd);
+	unlink(tmp);
+err2:	free(data);
+err1:	return -1;
+}
+
+int neosc_inventory_commit(void *inv)
+{
+	int r=-1;
+	int fd;
+	WRITER *w=inv;
+	NEOSC_INVENTORY *old;
+	char tmp[PATH_MAX];
+
+	if(!w->total)return 0;
+
+	if(snprintf(tmp,sizeof(tmp),"%s.lock",w->path)>=sizeof(tmp))goto err1;
+	if((fd=open(tmp,O_RDWR|O_CREAT|O_CLOEXEC,0644))==-1)goto err1;
+	if(flock(fd,LOCK_EX))goto err2;
+
+	if(!(old=neosc_inventory_map(w->path))&&errno!=ENOENT)goto err2;
+
+	qsort(w->pend,w->total,sizeof(PENDING),pendcmp);
+	snprintf(tmp,sizeof(tmp),"%s.tmp",w->path);
+	if(merge(w,old,tmp))goto err3;
+	if(rename(tmp,w->path))
+	{
+		unlink(tmp);
+		goto err3;
+	}
+
+	pendfree(w);
+	w->committed=now();
+	r=0;
+
+err3:	if(old)neosc_inventory_unmap(old);
+err2:	close(fd);
+err1:	return r;
+}
+
+int neosc_inventory_sync(void *inv)
+{
+	WRITER *w=inv;
+
+	if(w->total<NEOSC_INV_BATCH&&now()-w->committed<1000)return 0;
+	return neosc_inventory_commit(w);
+}
+
+void neosc_inventory_close(void *inv)
+{
+	WRITER *w=inv;
+
+	neosc_inventory_commit(w);
+	pendfree(w);
+	free(w->path);
+	free(w);
+}
+
+NEOSC_INVENTORY *neosc_inventory_map(char *path)
+{
+	int fd;
+	uint32_t i;
+	struct stat stb;
+	NEOSC_INV_HEADER *hdr;
+	NEOSC_INVENTORY *db;
+
+	if(!(db=malloc(sizeof(NEOSC_INVENTORY))))goto err1;
+	if((fd=open(path,O_RDONLY|O_CLOEXEC))==-1)goto err2;
+	if(fstat(fd,&stb))goto err3;
+	if(stb.st_size<sizeof(NEOSC_INV_HEADER))goto err4;
+	db->size=stb.st_size;
+	if((hdr=mmap(NULL,db->size,PROT_READ,MAP_SHARED,fd,0))==MAP_FAILED)
+		goto err3;
+	close(fd);
+
+	if(hdr->magic!=NEOSC_INV_MAGIC||hdr->version!=NEOSC_INV_VERSION)
+		goto err5;
+	if(hdr->recoff+(uint64_t)hdr->records*sizeof(NEOSC_INV_RECORD)>
+		db->size||hdr->nameoff+(uint64_t)hdr->names*
+		sizeof(NEOSC_INV_NAME)>db->size||hdr->veroff+
+		(uint64_t)hdr->records*sizeof(uint32_t)>db->size||
+		hdr->idxoff+(uint64_t)hdr->names*sizeof(uint32_t)>db->size||
+		((hdr->recoff|hdr->nameoff|hdr->veroff|hdr->idxoff)&7))
+		goto err5;
+
+	db->hdr=hdr;
+	db->rec=(NEOSC_INV_RECORD *)((char *)hdr+hdr->recoff);
+	db->name=(NEOSC_INV_NAME *)((char *)hdr+hdr->nameoff);
+	db->veridx=(uint32_t *)((char *)hdr+hdr->veroff);
+	db->nameidx=(uint32_t *)((char *)hdr+hdr->idxoff);
+
+	for(i=0;i<hdr->records;i++)if(db->veridx[i]>=hdr->records||
+		db->rec[i].oathfirst>hdr->names||
+		db->rec[i].oathcount>hdr->names-db->rec[i].oathfirst)goto err5;
+	for(i=0;i<hdr->names;i++)if(db->nameidx[i]>=hdr->names||
+		db->name[i].record>=hdr->records||
+		db->name[i].name[NEOSC_INV_NAMELEN-1])goto err5;
+
+	return db;
+
+err5:	munmap(hdr,db->size);
+	free(db);
+	errno=EINVAL;
+	return NULL;
+err4:	errno=EINVAL;
+err3:	close(fd);
+err2:	free(db);
+err1:	return NULL;
+}
+
+void neosc_inventory_unmap(NEOSC_INVENTORY *db)
+{
+	munmap(db->hdr,db->size);
+	free(db);
+}
+
+NEOSC_INV_RECORD *neosc_inventory_find(NEOSC_INVENTORY *db,int serial)
+{
+	uint32_t l;
+	uint32_t h;
+	uint32_t m;
+
+	for(l=0,h=db->hdr->records;l<h;)
+	{
+		m=(l+h)>>1;
+		if(db->rec[m].serial==serial)return &db->rec[m];
+		if(db->rec[m].serial<serial)l=m+1;
+		else h=m;
+	}
+	return NULL;
+}
+
+uint32_t neosc_inventory_below(NEOSC_INVENTORY *db,int major,int minor,
+	int build)
+{
+	uint32_t l;
+	uint32_t h;
+	uint32_t m;
+	NEOSC_INV_RECORD *r;
+
+	for(l=0,h=db->hdr->records;l<h;)
+	{
+		m=(l+h)>>1;
+		r=&db->rec[db->veridx[m]];
+		if((r->valid&NEOSC_INV_DEVICE)&&(r->major<major||
+			(r->major==major&&(r->minor<minor||
+			(r->minor==minor&&r->build<build)))))l=m+1;
+		else h=m;
+	}
+	return l;
+}
+
+uint32_t neosc_inventory_named(NEOSC_INVENTORY *db,char *name,
+	uint32_t *first)
+{
+	uint32_t l;
+	uint32_t h;
+	uint32_t m;
+
+	for(l=0,h=db->hdr->names;l<h;)
+	{
+		m=(l+h)>>1;
+		if(strcmp(db->name[db->nameidx[m]].name,name)<0)l=m+1;
+		else h=m;
+	}
+	*first=l;
+	for(h=db->hdr->names;l<h;)
+	{
+		m=(l+h)>>1;
+		if(strcmp(db->name[db->nameidx[m]].name,name)<=0)l=m+1;
+		else h=m;
+	}
+	return l-*first;
+}
@@ -0,0 +1,120 @@
+/*
+ * neosc-inventory - memory mapped inventory of provisioned devices
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NEOSC_INVENTORY_H
+#define _NEOSC_INVENTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NEOSC_INV_MAGIC		0x4e454f5343494e56ULL
+#define NEOSC_INV_VERSION	1
+#define NEOSC_INV_NAMELEN	68
+#define NEOSC_INV_BATCH		16
+
+#define NEOSC_INV_DEVICE	0x01
+#define NEOSC_INV_MODE		0x02
+#define NEOSC_INV_OATH		0x04
+
+#define NEOSC_INV_SLOT1		0x01
+#define NEOSC_INV_SLOT2		0x02
+#define NEOSC_INV_TOUCH1	0x04
+#define NEOSC_INV_TOUCH2	0x08
+
+/*
+ * The file consists of a header followed by four arrays, each aligned
+ * to 8 bytes: the device records sorted by serial number, the OATH
+ * entry names grouped by record, an index of the records sorted by
+ * firmware version and an index of the names sorted by name. All
+ * lookups are binary searches on the mapped file. The file is never
+ * modified in place, a writer merges its updates into a new file and
+ * renames it over the old one. No secrets are stored.
+ *
+ * neosc_inventory_sync() merges once NEOSC_INV_BATCH devices are
+ * pending or the last merge is at least a second old, call it only
+ * after a complete update of a device.
+ */
+
+typedef struct
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t records;
+	uint32_t names;
+	uint32_t spare;
+	uint64_t generation;
+	uint64_t recoff;
+	uint64_t nameoff;
+	uint64_t veroff;
+	uint64_t idxoff;
+} NEOSC_INV_HEADER;
+
+typedef struct
+{
+	int32_t serial;
+	uint8_t major;
+	uint8_t minor;
+	uint8_t build;
+	uint8_t pgmseq;
+	uint8_t mode;
+	uint8_t slots;
+	uint8_t valid;
+	uint8_t spare;
+	uint32_t oathfirst;
+	uint32_t oathcount;
+	uint32_t spare2;
+	int64_t updated;
+} NEOSC_INV_RECORD;
+
+typedef struct
+{
+	uint32_t record;
+	char name[NEOSC_INV_NAMELEN];
+} NEOSC_INV_NAME;
+
+typedef struct
+{
+	size_t size;
+	NEOSC_INV_HEADER *hdr;
+	NEOSC_INV_RECORD *rec;
+	NEOSC_INV_NAME *name;
+	uint32_t *veridx;
+	uint32_t *nameidx;
+} NEOSC_INVENTORY;
+
+extern void *neosc_inventory_open(char *path);
+extern void neosc_inventory_device(void *inv,int serial,int major,int minor,
+	int build,int pgmseq,int slots);
+extern void neosc_inventory_mode(void *inv,int serial,int mode);
+extern void neosc_inventory_oath(void *inv,int serial,char *name);
+extern int neosc_inventory_commit(void *inv);
+extern int neosc_inventory_sync(void *inv);
+extern void neosc_inventory_close(void *inv);
+
+extern NEOSC_INVENTORY *neosc_inventory_map(char *path);
+extern void neosc_inventory_unmap(NEOSC_INVENTORY *db);
+extern NEOSC_INV_RECORD *neosc_inventory_find(NEOSC_INVENTORY *db,
+	int serial);
+extern uint32_t neosc_inventory_below(NEOSC_INVENTORY *db,int major,
+	int minor,int build);
+extern uint32_t neosc_inventory_named(NEOSC_INVENTORY *db,char *name,
+	uint32_t *first);
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * neosc-journal - append-only step journal for resumable batch runs
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "neosc-journal.h"
+
+typedef struct
+{
+	int serial;
+	int step;
+	int state;
+	int pgmseq;
+	int seq;
+} ENTRY;
+
+typedef struct
+{
+	int fd;
+	int pending;
+	int total;
+	long long synced;
+	ENTRY *entry;
+} JOURNAL;
+
+static long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec*1000LL+ts.tv_nsec/1000000;
+}
+
+static int cmp(const void *p1,const void *p2)
+{
+	const ENTRY *e1=p1;
+	const ENTRY *e2=p2;
+
+	if(e1->serial!=e2->serial)return e1->serial<e2->serial?-1:1;
+	if(e1->step!=e2->step)return e1->step<e2->step?-1:1;
+	if(e1->seq!=e2->seq)return e1->seq<e2->seq?-1:1;
+	return 0;
+}
+
+static int parse(JOURNAL *j,char *line)
+{
+	int n;
+	int len;
+	ENTRY *e;
+
+	if(!(j->total&255))
+	{
+		if(!(e=realloc(j->entry,(j->total+256)*sizeof(ENTRY))))
+			return -1;
+		j->entry=e;
+	}
+	e=&j->entry[j->total];
+	memset(e,0,sizeof(ENTRY));
+	e->seq=j->total;
+	len=strlen(line);
+
+	if(sscanf(line,"B %d %d %d%n",&e->serial,&e->step,&e->pgmseq,&n)==3&&
+		n==len)e->state=NEOSC_JOURNAL_BEGUN;
+	else if(sscanf(line,"D %d %d%n",&e->serial,&e->step,&n)==2&&n==len)
+		e->state=NEOSC_JOURNAL_DONE;
+	else if(sscanf(line,"F %d %d%n",&e->serial,&e->step,&n)==2&&n==len)
+		e->state=NEOSC_JOURNAL_NONE;
+	else return -1;
+
+	j->total++;
+	return 0;
+}
+
+static int load(JOURNAL *j)
+{
+	int i;
+	int n;
+	off_t len;
+	off_t valid;
+	char *p;
+	char *q;
+	char *data;
+	struct stat stb;
+
+	if(fstat(j->fd,&stb))goto err1;
+	if(!stb.st_size)return 0;
+	if(!(data=malloc(stb.st_size+1)))goto err1;
+	for(len=0;len<stb.st_size;len+=n)if((n=pread(j->fd,data+len,
+		stb.st_size-len,len))<=0)goto err2;
+	data[len]=0;
+
+	for(p=data;(q=strchr(p,'\n'));p=q+1)
+	{
+		*q=0;
+		if(parse(j,p))goto err2;
+	}
+
+	valid=p-data;
+	free(data);
+
+	if(valid!=len)if(ftruncate(j->fd,valid))return -1;
+
+	qsort(j->entry,j->total,sizeof(ENTRY),cmp);
+	for(n=0,i=0;i<j->total;i++)
+	{
+		if(n&&j->entry[n-1].serial==j->entry[i].serial&&
+			j->entry[n-1].step==j->entry[i].step)
+		{
+			if(j->entry[i].state==NEOSC_JOURNAL_BEGUN)
+				j->entry[n-1].pgmseq=j->entry[i].pgmseq;
+			j->entry[n-1].state=j->entry[i].state;
+		}
+		else j->entry[n++]=j->entry[i];
+	}
+	j->total=n;
+	return 0;
+
+err2:	free(data);
+err1:	return -1;
+}
+
+static void append(JOURNAL *j,char *line,int len)
+{
+	long long t;
+
+	if(write(j->fd,line,len)!=len)return;
+	t=now();
+	if(++j->pending<NEOSC_JOURNAL_BATCH&&t-j->synced<1000)return;
+	fdatasync(j->fd);
+	j->pending=0;
+	j->synced=t;
+}
+
+void *neosc_journal_open(char *path,int resume)
+{
+	JOURNAL *j;
+
+	if(!(j=malloc(sizeof(JOURNAL))))goto err1;
+	memset(j,0,sizeof(JOURNAL));
+	if((j->fd=open(path,resume?O_RDWR|O_APPEND|O_CLOEXEC:
+		O_WRONLY|O_APPEND|O_CREAT|O_EXCL|O_CLOEXEC,0600))==-1)
+		goto err2;
+	if(flock(j->fd,LOCK_EX|LOCK_NB))goto err3;
+	if(resume)if(load(j))goto err4;
+	j->synced=now();
+	return j;
+
+err4:	if(j->entry)free(j->entry);
+err3:	close(j->fd);
+err2:	free(j);
+err1:	return NULL;
+}
+
+void neosc_journal_close(void *journal)
+{
+	JOURNAL *j=journal;
+
+	if(j->pending)fdatasync(j->fd);
+	close(j->fd);
+	if(j->entry)free(j->entry);
+	free(j);
+}
+
+int neosc_journal_state(void *journal,int serial,int step,int *pgmseq)
+{
+	int l;
+	int h;
+	int m;
+	ENTRY *e;
+	JOURNAL *j=journal;
+
+	for(l=0,h=j->total-1;l<=h;)
+	{
+		m=(l+h)>>1;
+		e=&j->entry[m];
+		if(e->serial==serial&&e->step==step)
+		{
+			*pgmseq=e->pgmseq;
+			return e->state;
+		}
+		if(e->serial<serial||(e->serial==serial&&e->step<step))l=m+1;
+		else h=m-1;
+	}
+	return NEOSC_JOURNAL_NONE;
+}
+
+void neosc_journal_begin(void *journal,int serial,int step,int pgmseq)
+{
+	int len;
+	char bfr[64];
+
+	len=snprintf(bfr,sizeof(bfr),"B %d %d %d\n",serial,step,pgmseq);
+	append(journal,bfr,len);
+}
+
+void neosc_journal_end(void *journal,int serial,int step,int result)
+{
+	int len;
+	char bfr[64];
+
+	len=snprintf(bfr,sizeof(bfr),"%c %d %d\n",result?'F':'D',serial,step);
+	append(journal,bfr,len);
+}
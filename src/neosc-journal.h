@@ -0,0 +1,49 @@
+/*
+ * neosc-journal - append-only step journal for resumable batch runs
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NEOSC_JOURNAL_H
+#define _NEOSC_JOURNAL_H
+
+#define NEOSC_JOURNAL_NONE	0
+#define NEOSC_JOURNAL_BEGUN	1
+#define NEOSC_JOURNAL_DONE	2
+
+#define NEOSC_JOURNAL_BATCH	16
+
+/*
+ * The journal is a text file of one record per line, keyed by serial
+ * number and script step:
+ *
+ *	B <serial> <step> <pgmseq>	a slot write is about to be sent
+ *	D <serial> <step>		the step completed successfully
+ *	F <serial> <step>		the step failed
+ *
+ * Records are appended with a single write each and synced every
+ * NEOSC_JOURNAL_BATCH records, at least once per second and on close.
+ * A record lost to a power failure only causes the step to be repeated.
+ */
+
+extern void *neosc_journal_open(char *path,int resume);
+extern void neosc_journal_close(void *journal);
+extern int neosc_journal_state(void *journal,int serial,int step,int *pgmseq);
+extern void neosc_journal_begin(void *journal,int serial,int step,int pgmseq);
+extern void neosc_journal_end(void *journal,int serial,int step,int result);
+
+#endif
@@ -0,0 +1,530 @@
+/*
+ * neosc-loadgen - concurrent load generator for the neosc-shell engine
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <libneosc.h>
+#include "libneoscshell.h"
+#include "neosc-lock.h"
+
+#define MAXCLIENTS	256
+#define MAXSERIALS	16
+#define MAXMIX		16
+#define MAXSETUP	32
+#define LINELEN		256
+#define BUCKETS		296
+#define CODES		8
+
+#define memclear(a,b,c) \
+    do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
+
+typedef struct
+{
+	int weight;
+	char line[LINELEN];
+} MIX;
+
+/*
+ * Every client owns its block and is its only writer, so processes and
+ * threads update the shared mapping without locks. Latencies are kept in
+ * log-linear buckets of 8 per power of two (at most 12.5% off).
+ */
+typedef struct
+{
+	int code;
+	unsigned int count;
+} CODE;
+
+typedef struct
+{
+	unsigned int count;
+	unsigned int errors;
+	unsigned int other;
+	unsigned int lat[BUCKETS];
+	unsigned int lock[BUCKETS];
+	CODE codes[CODES];
+} STAT;
+
+typedef struct
+{
+	int serial;
+	int done;
+	STAT stat[MAXMIX];
+} CLIENT;
+
+typedef struct
+{
+	volatile int stop;
+	long long start;
+	long long end;
+	CLIENT client[MAXCLIENTS];
+} SHARED;
+
+static SHARED *shm;
+static MIX mix[MAXMIX];
+static int mixes=0;
+static int weights=0;
+static char *setup[MAXSETUP];
+static int setups=0;
+static int serials[MAXSERIALS];
+static int nserials=0;
+static int requests=0;
+static int keepoath=0;
+static int prio=-1;
+static char *lockd=NULL;
+static int gofd[2];
+static int readyfd[2];
+
+static void sighandler(int sig)
+{
+	shm->stop=1;
+}
+
+static long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec*1000000LL+ts.tv_nsec/1000;
+}
+
+static void ready(void)
+{
+	if(write(readyfd[1],"",1));
+}
+
+static int bucket(long long v)
+{
+	int e;
+
+	if(v<16)return v<0?0:(int)v;
+	e=63-__builtin_clzll((unsigned long long)v);
+	v=(e-3)*8+(v>>(e-3));
+	return v>=BUCKETS?BUCKETS-1:(int)v;
+}
+
+static long long upper(int idx)
+{
+	int e;
+
+	if(idx<16)return idx;
+	e=idx/8+2;
+	return ((long long)(idx%8+9)<<(e-3))-1;
+}
+
+static void tally(STAT *st,int code,unsigned int n)
+{
+	int i;
+
+	for(i=0;i<CODES&&st->codes[i].count;i++)
+		if(st->codes[i].code==code)break;
+	if(i==CODES)st->other+=n;
+	else
+	{
+		st->codes[i].code=code;
+		st->codes[i].count+=n;
+	}
+}
+
+static double pct(unsigned int *h,unsigned int total,int p)
+{
+	int i;
+	unsigned long long n=0;
+	unsigned long long want;
+
+	if(!total)return 0;
+	want=((unsigned long long)total*p+99)/100;
+	for(i=0;i<BUCKETS;i++)if((n+=h[i])>=want)break;
+	return upper(i<BUCKETS?i:BUCKETS-1)/1000.0;
+}
+
+static int readmix(char *file)
+{
+	int l;
+	int w;
+	char *p;
+	char bfr[LINELEN+16];
+	FILE *fp;
+
+	if(!(fp=fopen(file,"re")))return -1;
+	while(fgets(bfr,sizeof(bfr),fp))
+	{
+		if((l=strlen(bfr))&&bfr[l-1]=='\n')bfr[--l]=0;
+		else if(!feof(fp))goto err;
+		for(p=bfr;*p==' '||*p=='\t';p++);
+		if(!*p||*p=='#')continue;
+		if((w=strtol(p,&p,10))<=0||(*p!=' '&&*p!='\t'))goto err;
+		for(;*p==' '||*p=='\t';p++);
+		if(!*p||strlen(p)>=LINELEN||mixes==MAXMIX)goto err;
+		mix[mixes].weight=w;
+		strcpy(mix[mixes++].line,p);
+		weights+=w;
+	}
+	fclose(fp);
+	return mixes?0:-1;
+
+err:	fclose(fp);
+	return -1;
+}
+
+static int readsetup(void)
+{
+	int l;
+	char bfr[LINELEN];
+
+	while(fgets(bfr,sizeof(bfr),stdin))
+	{
+		if((l=strlen(bfr))&&bfr[l-1]=='\n')bfr[--l]=0;
+		if(!l||*bfr=='#')continue;
+		if(setups==MAXSETUP||!(setup[setups++]=strdup(bfr)))
+		{
+			memclear(bfr,0,sizeof(bfr));
+			return -1;
+		}
+	}
+	memclear(bfr,0,sizeof(bfr));
+	return 0;
+}
+
+static void *client(void *arg)
+{
+	int i;
+	int w;
+	int r;
+	int n=0;
+	long long t;
+	unsigned int seed;
+	char c;
+	char line[LINELEN];
+	void *ctx;
+	FILE *null;
+	CLIENT *cl=arg;
+
+	seed=(unsigned int)(now()^(cl-shm->client));
+
+	if(neosc_shell_create(&ctx,0))goto err1;
+	if(!(null=fopen("/dev/null","we")))goto err2;
+	if(cl->serial)neosc_shell_serial(ctx,cl->serial);
+	if(keepoath)neosc_shell_keepoath(ctx,1);
+	if(lockd||prio!=-1)if(neosc_shell_lockd(ctx,lockd,
+		prio!=-1?prio:NEOSC_LOCKD_DEFPRIO))goto err3;
+	for(i=0;i<setups;i++)
+	{
+		strcpy(line,setup[i]);
+		r=neosc_shell_exec(ctx,null,line);
+		memclear(line,0,sizeof(line));
+		if(r)goto err3;
+	}
+
+	ready();
+	if(read(gofd[0],&c,1)!=0)goto out;
+
+	while(!shm->stop&&(requests?n++<requests:now()<shm->end))
+	{
+		for(w=rand_r(&seed)%weights,i=0;w>=mix[i].weight;i++)
+			w-=mix[i].weight;
+		strcpy(line,mix[i].line);
+		t=now();
+		r=neosc_shell_exec(ctx,null,line);
+		t=now()-t;
+		cl->stat[i].count++;
+		if(r)
+		{
+			cl->stat[i].errors++;
+			tally(&cl->stat[i],r,1);
+		}
+		cl->stat[i].lat[bucket(t)]++;
+		cl->stat[i].lock[bucket(neosc_shell_locktime(ctx))]++;
+	}
+
+out:	memclear(line,0,sizeof(line));
+	fclose(null);
+	neosc_shell_destroy(ctx);
+	cl->done=1;
+	return NULL;
+
+err3:	fclose(null);
+err2:	neosc_shell_destroy(ctx);
+err1:	cl->done=-1;
+	ready();
+	return NULL;
+}
+
+static void report(int clients,int threads)
+{
+	int i;
+	int j;
+	int k;
+	int failed=0;
+	double secs;
+	unsigned int cnt;
+	unsigned int err;
+	static STAT sum;
+	static STAT all;
+	static STAT cmd[MAXMIX];
+
+	secs=(now()-shm->start)/1000000.0;
+	if(secs<=0)secs=0.000001;
+	memset(&all,0,sizeof(all));
+
+	for(i=0;i<clients;i++)if(shm->client[i].done!=1)failed++;
+
+	printf("%-32s %8s %7s %9s %9s %9s %9s %9s %9s\n","command","count",
+		"errors","p50ms","p90ms","p99ms","maxms","lock50ms","lock99ms");
+	for(j=0;j<=mixes;j++)
+	{
+		if(j<mixes)
+		{
+			memset(&sum,0,sizeof(sum));
+			for(i=0;i<clients;i++)
+			{
+				sum.count+=shm->client[i].stat[j].count;
+				sum.errors+=shm->client[i].stat[j].errors;
+				sum.other+=shm->client[i].stat[j].other;
+				for(k=0;k<CODES;k++)if(shm->client[i]
+					.stat[j].codes[k].count)tally(&sum,
+					shm->client[i].stat[j].codes[k].code,
+					shm->client[i].stat[j].codes[k].count);
+				for(k=0;k<BUCKETS;k++)
+				{
+					sum.lat[k]+=
+					    shm->client[i].stat[j].lat[k];
+					sum.lock[k]+=
+					    shm->client[i].stat[j].lock[k];
+				}
+			}
+			cmd[j]=sum;
+			all.count+=sum.count;
+			all.errors+=sum.errors;
+			for(k=0;k<BUCKETS;k++)
+			{
+				all.lat[k]+=sum.lat[k];
+				all.lock[k]+=sum.lock[k];
+			}
+		}
+		else sum=all;
+		printf("%-32.32s %8u %7u %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+			j<mixes?mix[j].line:"total",sum.count,sum.errors,
+			pct(sum.lat,sum.count,50),pct(sum.lat,sum.count,90),
+			pct(sum.lat,sum.count,99),pct(sum.lat,sum.count,100),
+			pct(sum.lock,sum.count,50),pct(sum.lock,sum.count,99));
+	}
+
+	printf("\nclients=%d (%s) failed-setup=%d duration=%.2fs "
+		"requests=%u errors=%u throughput=%.1f/s\n",clients,
+		threads?"threads":"processes",failed,secs,all.count,all.errors,
+		all.count/secs);
+
+	printf("\nreturn codes by command (code:count):\n");
+	for(j=0;j<mixes;j++)
+	{
+		printf("  %-32.32s 0:%u",mix[j].line,
+			cmd[j].count-cmd[j].errors);
+		for(k=0;k<CODES&&cmd[j].codes[k].count;k++)
+			printf(" %d:%u",cmd[j].codes[k].code,
+				cmd[j].codes[k].count);
+		if(cmd[j].other)printf(" other:%u",cmd[j].other);
+		printf("\n");
+	}
+
+	printf("\nby serial:\n");
+	for(i=0;i<(nserials?nserials:1);i++)
+	{
+		for(cnt=0,err=0,j=i;j<clients;j+=(nserials?nserials:1))
+			for(k=0;k<mixes;k++)
+		{
+			cnt+=shm->client[j].stat[k].count;
+			err+=shm->client[j].stat[k].errors;
+		}
+		if(nserials)printf("  %-10d",serials[i]);
+		else printf("  %-10s","any");
+		printf(" requests=%u throughput=%.1f/s errors=%u (%.1f%%)\n",
+			cnt,cnt/secs,err,cnt?100.0*err/cnt:0.0);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,"Usage: neosc-loadgen <options> <mixfile>\n"
+	  "-c <clients>\tnumber of concurrent clients (default 10)\n"
+	  "-t\t\tclients are threads of one process (default processes)\n"
+	  "-s <serial>[,<serial>...]\tdevices, assigned round robin\n"
+	  "-d <seconds>\trun time (default 10)\n"
+	  "-n <count>\trequests per client instead of a run time\n"
+	  "-L <socket>\tserialize card access through the neosc-lockd broker\n"
+	  "-P <prio>\tbroker priority (0-9, lower is served first, default 5)\n"
+	  "-k\t\tkeep an unlocked OATH applet unlocked between commands\n"
+	  "-h\t\tthis help text\n"
+	  "mixfile lines: <weight> <command>, stdin: setup commands\n");
+	exit(1);
+}
+
+int main(int argc,char *argv[])
+{
+	int c;
+	int i;
+	int clients=10;
+	int threads=0;
+	int duration=0;
+	int n;
+	char go;
+	char *p;
+	char *eptr;
+	pid_t pid[MAXCLIENTS];
+	pthread_t tid[MAXCLIENTS];
+	struct sigaction sa;
+
+	while((c=getopt(argc,argv,"c:ts:d:n:L:P:kh"))!=-1)switch(c)
+	{
+	case 'c':
+		if((clients=atoi(optarg))<1||clients>MAXCLIENTS)usage();
+		break;
+	case 't':
+		if(threads)usage();
+		threads=1;
+		break;
+	case 's':
+		if(nserials)usage();
+		for(p=optarg;;p=eptr+1)
+		{
+			if(nserials==MAXSERIALS)usage();
+			if((serials[nserials++]=strtol(p,&eptr,10))<=0)usage();
+			if(!*eptr)break;
+			if(*eptr!=',')usage();
+		}
+		break;
+	case 'd':
+		if(duration||requests)usage();
+		if((duration=atoi(optarg))<=0)usage();
+		break;
+	case 'n':
+		if(duration||requests)usage();
+		if((requests=atoi(optarg))<=0)usage();
+		break;
+	case 'L':
+		if(lockd)usage();
+		lockd=optarg;
+		break;
+	case 'P':
+		if(prio!=-1)usage();
+		if((prio=atoi(optarg))<NEOSC_LOCKD_MINPRIO||
+			prio>NEOSC_LOCKD_MAXPRIO)usage();
+		break;
+	case 'k':
+		if(keepoath)usage();
+		keepoath=1;
+		break;
+	case 'h':
+	default:usage();
+	}
+
+	if(optind!=argc-1)usage();
+	if(!duration)duration=10;
+
+	if(readmix(argv[optind]))
+	{
+		fprintf(stderr,"cannot read command mix %s.\n",argv[optind]);
+		return 1;
+	}
+	if(readsetup())
+	{
+		fprintf(stderr,"too many setup commands.\n");
+		return 1;
+	}
+
+	if((shm=mmap(NULL,sizeof(SHARED),PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS,-1,0))==MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+	for(i=0;i<clients;i++)
+		shm->client[i].serial=nserials?serials[i%nserials]:0;
+
+	if(pipe(gofd)||pipe(readyfd))
+	{
+		perror("pipe");
+		return 1;
+	}
+
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler=sighandler;
+	sigaction(SIGINT,&sa,NULL);
+	sigaction(SIGTERM,&sa,NULL);
+	signal(SIGPIPE,SIG_IGN);
+
+	for(i=0;i<clients;i++)
+	{
+		if(threads)
+		{
+			if(pthread_create(&tid[i],NULL,client,&shm->client[i]))
+				break;
+		}
+		else if(!(pid[i]=fork()))
+		{
+			close(gofd[1]);
+			close(readyfd[0]);
+			client(&shm->client[i]);
+			_exit(0);
+		}
+		else if(pid[i]==-1)break;
+	}
+	if(i<clients)
+	{
+		perror("cannot start clients");
+		shm->stop=1;
+		clients=i;
+	}
+
+	/*
+	 * clients report ready once set up and then wait for EOF on the go
+	 * pipe, so device opens and unlocks of the setup are not measured
+	 */
+
+	if(!threads)close(readyfd[1]);
+	for(n=0;n<clients;n++)if(read(readyfd[0],&go,1)!=1)break;
+
+	shm->start=now();
+	shm->end=shm->start+duration*1000000LL;
+	close(gofd[1]);
+
+	for(i=0;i<clients;i++)
+	{
+		if(threads)pthread_join(tid[i],NULL);
+		else waitpid(pid[i],NULL,0);
+	}
+
+	report(clients,threads);
+
+	for(i=0;i<setups;i++)
+	{
+		memclear(setup[i],0,strlen(setup[i]));
+		free(setup[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * neosc-lock - client side of the neosc-lockd card lock broker
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "neosc-lock.h"
+
+int neosc_lockd_acquire(char *path,int serial,int prio,long *waited)
+{
+	int s;
+	int len;
+	int l;
+	char *eptr;
+	struct sockaddr_un a;
+	char bfr[64];
+
+	if(!path)path=NEOSC_LOCKD_SOCKET;
+	if(strlen(path)>=sizeof(a.sun_path))goto err1;
+	if(prio<NEOSC_LOCKD_MINPRIO||prio>NEOSC_LOCKD_MAXPRIO)goto err1;
+
+	memset(&a,0,sizeof(a));
+	a.sun_family=AF_UNIX;
+	strcpy(a.sun_path,path);
+
+	if((s=socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0))==-1)goto err1;
+	if(connect(s,(struct sockaddr *)&a,sizeof(a)))goto err2;
+
+	len=snprintf(bfr,sizeof(bfr),"LOCK %d %d\n",serial,prio);
+	if(write(s,bfr,len)!=len)goto err2;
+
+	for(len=0;!len||bfr[len-1]!='\n';len+=l)
+	{
+		if(len==sizeof(bfr)-1)goto err2;
+		if((l=read(s,bfr+len,sizeof(bfr)-1-len))<=0)goto err2;
+	}
+	bfr[len]=0;
+
+	if(strncmp(bfr,"GRANT ",6))goto err2;
+	*waited=strtol(bfr+6,&eptr,10);
+	if(eptr==bfr+6||*eptr!='\n')goto err2;
+
+	return s;
+
+err2:	close(s);
+err1:	return -1;
+}
+
+void neosc_lockd_release(int handle)
+{
+	if(handle!=-1)close(handle);
+}
@@ -0,0 +1,41 @@
+/*
+ * neosc-lock - client side of the neosc-lockd card lock broker
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NEOSC_LOCK_H
+#define _NEOSC_LOCK_H
+
+#define NEOSC_LOCKD_SOCKET	"/run/neosc-lockd.sock"
+
+#define NEOSC_LOCKD_MINPRIO	0
+#define NEOSC_LOCKD_MAXPRIO	9
+#define NEOSC_LOCKD_DEFPRIO	5
+
+/*
+ * The broker queues lock requests per serial, lower priority values
+ * are served first, requests of equal priority in FIFO order. The lock
+ * is held until neosc_lockd_release() is called or the process exits.
+ * neosc_lockd_acquire() returns a handle >=0 on success and -1 on error,
+ * the time spent waiting in the queue is returned in microseconds.
+ */
+
+extern int neosc_lockd_acquire(char *path,int serial,int prio,long *waited);
+extern void neosc_lockd_release(int handle);
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * neosc-lockd - a fair card lock broker for YubiKey NEO(-N)/4 users
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include "neosc-lock.h"
+
+#define MAXCLIENTS	256
+#define LINELEN		64
+#define DEFHOLD		60
+
+#define IDLE		0
+#define WAITING		1
+#define HOLDING		2
+
+typedef struct
+{
+	int fd;
+	int state;
+	int serial;
+	int prio;
+	int fill;
+	unsigned long seq;
+	long long stamp;
+	char line[LINELEN];
+} CLIENT;
+
+static CLIENT client[MAXCLIENTS];
+static int clients=0;
+static unsigned long seq=0;
+static unsigned long grants=0;
+static long long waitsum=0;
+static long long waitmax=0;
+static long long holdsum=0;
+static long long holdmax=0;
+static volatile int stop=0;
+
+static void sighandler(int sig)
+{
+	stop=1;
+}
+
+static long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec*1000000LL+ts.tv_nsec/1000;
+}
+
+static void drop(int idx)
+{
+	long long t;
+
+	if(client[idx].state==HOLDING)
+	{
+		t=now()-client[idx].stamp;
+		holdsum+=t;
+		if(t>holdmax)holdmax=t;
+	}
+	close(client[idx].fd);
+	if(idx!=--clients)client[idx]=client[clients];
+}
+
+/*
+ * Clients without a serial number (any, first USB or NFC device) may use
+ * any device, so they exclude and are excluded by every other client.
+ */
+static int conflict(int a,int b)
+{
+	return a==b||!a||!b;
+}
+
+static void schedule(void)
+{
+	int i;
+	int j;
+	int best;
+	long long t;
+	char bfr[LINELEN];
+
+	for(i=0;i<clients;i++)
+	{
+		if(client[i].state!=WAITING)continue;
+
+		for(best=i,j=0;j<clients;j++)
+		{
+			if(!conflict(client[j].serial,client[i].serial))
+				continue;
+			if(client[j].state==HOLDING)break;
+			if(client[j].state!=WAITING)continue;
+			if(client[j].prio<client[best].prio||
+			    (client[j].prio==client[best].prio&&
+			    client[j].seq<client[best].seq))best=j;
+		}
+		if(j<clients||best!=i)continue;
+
+		t=now();
+		client[i].state=HOLDING;
+		client[i].stamp=t-client[i].stamp;
+		grants++;
+		waitsum+=client[i].stamp;
+		if(client[i].stamp>waitmax)waitmax=client[i].stamp;
+		j=snprintf(bfr,sizeof(bfr),"GRANT %lld\n",client[i].stamp);
+		client[i].stamp=t;
+		if(write(client[i].fd,bfr,j)!=j)
+		{
+			drop(i);
+			i=-1;
+		}
+	}
+}
+
+static int request(int idx)
+{
+	int i;
+	int waiting=0;
+	int holding=0;
+	char *eptr;
+	char bfr[256];
+
+	if(!strncmp(client[idx].line,"LOCK ",5))
+	{
+		if(client[idx].state!=IDLE)return -1;
+		client[idx].serial=strtol(client[idx].line+5,&eptr,10);
+		if(eptr==client[idx].line+5||*eptr!=' ')return -1;
+		client[idx].prio=strtol(eptr+1,&eptr,10);
+		if(*eptr)return -1;
+		if(client[idx].prio<NEOSC_LOCKD_MINPRIO||
+			client[idx].prio>NEOSC_LOCKD_MAXPRIO)return -1;
+		if(client[idx].serial<0)client[idx].serial=0;
+		client[idx].state=WAITING;
+		client[idx].seq=seq++;
+		client[idx].stamp=now();
+		return 0;
+	}
+	else if(!strcmp(client[idx].line,"STATS"))
+	{
+		for(i=0;i<clients;i++)if(client[i].state==WAITING)waiting++;
+		else if(client[i].state==HOLDING)holding++;
+		i=snprintf(bfr,sizeof(bfr),"grants=%lu waiting=%d holding=%d "
+			"waitavg=%lld waitmax=%lld holdavg=%lld holdmax=%lld\n",
+			grants,waiting,holding,grants?waitsum/grants:0,waitmax,
+			grants?holdsum/grants:0,holdmax);
+		if(write(client[idx].fd,bfr,i)!=i)return -1;
+		return 0;
+	}
+	return -1;
+}
+
+static int input(int idx)
+{
+	int l;
+	char *p;
+
+	if((l=read(client[idx].fd,client[idx].line+client[idx].fill,
+		LINELEN-1-client[idx].fill))<=0)return -1;
+	client[idx].fill+=l;
+	client[idx].line[client[idx].fill]=0;
+
+	while((p=strchr(client[idx].line,'\n')))
+	{
+		*p++=0;
+		if(request(idx))return -1;
+		l=client[idx].fill-(p-client[idx].line);
+		memmove(client[idx].line,p,l+1);
+		client[idx].fill=l;
+	}
+
+	if(client[idx].fill==LINELEN-1)return -1;
+	return 0;
+}
+
+static int stats(char *path)
+{
+	int s;
+	int l;
+	struct sockaddr_un a;
+	char bfr[256];
+
+	memset(&a,0,sizeof(a));
+	a.sun_family=AF_UNIX;
+	strcpy(a.sun_path,path);
+
+	if((s=socket(AF_UNIX,SOCK_STREAM,0))==-1)goto err1;
+	if(connect(s,(struct sockaddr *)&a,sizeof(a)))goto err2;
+	if(write(s,"STATS\n",6)!=6)goto err2;
+	if((l=read(s,bfr,sizeof(bfr)-1))<=0)goto err2;
+	bfr[l]=0;
+	printf("%s",bfr);
+	close(s);
+	return 0;
+
+err2:	close(s);
+err1:	fprintf(stderr,"cannot query broker.\n");
+	return 1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,"Usage: neosc-lockd <options>\n"
+	  "-S <socket>\tbroker socket (default " NEOSC_LOCKD_SOCKET ")\n"
+	  "-t <seconds>\tmaximum lock hold time (default 60, 0 unlimited)\n"
+	  "-i\t\tprint statistics of a running broker\n"
+	  "-h\t\tthis help text\n");
+	exit(1);
+}
+
+int main(int argc,char *argv[])
+{
+	int c;
+	int s;
+	int i;
+	int info=0;
+	int maxhold=DEFHOLD;
+	long long t;
+	char *path=NEOSC_LOCKD_SOCKET;
+	struct sockaddr_un a;
+	struct sigaction sa;
+	struct pollfd p[MAXCLIENTS+1];
+
+	while((c=getopt(argc,argv,"S:t:ih"))!=-1)switch(c)
+	{
+	case 'S':
+		path=optarg;
+		break;
+	case 't':
+		if((maxhold=atoi(optarg))<0)usage();
+		break;
+	case 'i':
+		if(info)usage();
+		info=1;
+		break;
+	case 'h':
+	default:usage();
+	}
+
+	if(strlen(path)>=sizeof(a.sun_path))usage();
+
+	if(info)return stats(path);
+
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler=sighandler;
+	sigaction(SIGINT,&sa,NULL);
+	sigaction(SIGTERM,&sa,NULL);
+	sigaction(SIGHUP,&sa,NULL);
+	signal(SIGPIPE,SIG_IGN);
+
+	memset(&a,0,sizeof(a));
+	a.sun_family=AF_UNIX;
+	strcpy(a.sun_path,path);
+
+	if((s=socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0))==-1)
+	{
+		perror("socket");
+		return 1;
+	}
+	unlink(path);
+	if(bind(s,(struct sockaddr *)&a,sizeof(a))||listen(s,16))
+	{
+		perror("bind");
+		close(s);
+		return 1;
+	}
+	chmod(path,0666);
+
+	while(!stop)
+	{
+		p[0].fd=s;
+		p[0].events=clients<MAXCLIENTS?POLLIN:0;
+		for(i=0;i<clients;i++)
+		{
+			p[i+1].fd=client[i].fd;
+			p[i+1].events=POLLIN;
+		}
+
+		if(poll(p,clients+1,maxhold?1000:-1)<0)continue;
+
+		for(i=clients-1;i>=0;i--)if(p[i+1].revents)if(input(i))drop(i);
+
+		if(maxhold)for(t=now(),i=clients-1;i>=0;i--)
+			if(client[i].state==HOLDING&&
+			    t-client[i].stamp>maxhold*1000000LL)drop(i);
+
+		if(p[0].revents&POLLIN)
+		{
+			if((c=accept4(s,NULL,NULL,SOCK_CLOEXEC))!=-1)
+			{
+				memset(&client[clients],0,sizeof(CLIENT));
+				client[clients++].fd=c;
+			}
+		}
+
+		schedule();
+	}
+
+	for(i=clients-1;i>=0;i--)drop(i);
+	close(s);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,309 @@
+/*
+ * neosc-metrics - latency and error counters in Prometheus text format
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include "neosc-metrics.h"
+
+#define MAXSERIES	128
+#define MAXLABEL	32
+#define NBUCKETS	12
+#define TIMED		6
+
+typedef struct
+{
+	int kind;
+	int serial;
+	int code;
+	char label[MAXLABEL];
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long bucket[NBUCKETS];
+} SERIES;
+
+typedef struct metrics
+{
+	struct metrics *next;
+	struct metrics *prev;
+	int total;
+	SERIES series[MAXSERIES];
+} METRICS;
+
+static const long long bound[NBUCKETS]=
+{
+	1000,5000,10000,25000,50000,100000,
+	250000,500000,1000000,2500000,5000000,10000000
+};
+
+static const char *phase[NEOSC_METRIC_COMMAND]=
+{
+	"lockwait","open","lock","select"
+};
+
+static pthread_mutex_t mtx=PTHREAD_MUTEX_INITIALIZER;
+static METRICS *head=NULL;
+static METRICS retired;
+static long long last=0;
+static int pending=0;
+
+static void add(unsigned long long *v,unsigned long long n)
+{
+	__atomic_store_n(v,*v+n,__ATOMIC_RELAXED);
+}
+
+static SERIES *lookup(METRICS *m,int kind,int serial,char *label,int code,
+	int create)
+{
+	int i;
+	SERIES *s;
+
+	if(serial<=0)serial=0;
+	if(!label)label="";
+
+	for(i=0;i<m->total;i++)
+	{
+		s=&m->series[i];
+		if(s->kind==kind&&s->serial==serial&&s->code==code&&
+			!strcmp(s->label,label))return s;
+	}
+	if(!create||m->total==MAXSERIES)return NULL;
+
+	s=&m->series[m->total];
+	memset(s,0,sizeof(SERIES));
+	s->kind=kind;
+	s->serial=serial;
+	s->code=code;
+	strncpy(s->label,label,MAXLABEL-1);
+	__atomic_store_n(&m->total,m->total+1,__ATOMIC_RELEASE);
+	return s;
+}
+
+static void merge(METRICS *dst,METRICS *src)
+{
+	int i;
+	int j;
+	int total;
+	SERIES *s;
+	SERIES *d;
+
+	total=__atomic_load_n(&src->total,__ATOMIC_ACQUIRE);
+	for(i=0;i<total;i++)
+	{
+		s=&src->series[i];
+		if(!(d=lookup(dst,s->kind,s->serial,s->label,s->code,1)))
+			continue;
+		d->count+=__atomic_load_n(&s->count,__ATOMIC_RELAXED);
+		d->sum+=__atomic_load_n(&s->sum,__ATOMIC_RELAXED);
+		for(j=0;j<NBUCKETS;j++)d->bucket[j]+=
+			__atomic_load_n(&s->bucket[j],__ATOMIC_RELAXED);
+	}
+}
+
+static void labels(FILE *fp,SERIES *s)
+{
+	if(s->serial)fprintf(fp,"{serial=\"%d\"",s->serial);
+	else fprintf(fp,"{serial=\"any\"");
+	switch(s->kind)
+	{
+	case NEOSC_METRIC_COMMAND:
+	case NEOSC_METRIC_RECOVERY:
+		fprintf(fp,",command=\"%s\"",s->label);
+		break;
+	case NEOSC_METRIC_QUEUE:
+		fprintf(fp,",class=\"%s\"",s->label);
+		break;
+	case NEOSC_METRIC_ERROR:
+		fprintf(fp,",command=\"%s\",code=\"%d\"",s->label,s->code);
+		break;
+	case NEOSC_METRIC_HIT:
+	case NEOSC_METRIC_MISS:
+		fprintf(fp,",cache=\"%s\"",s->label);
+		break;
+	default:fprintf(fp,",phase=\"%s\"",phase[s->kind]);
+		break;
+	}
+}
+
+static void histogram(FILE *fp,char *name,SERIES *s)
+{
+	int i;
+
+	for(i=0;i<NBUCKETS;i++)
+	{
+		fprintf(fp,"%s_bucket",name);
+		labels(fp,s);
+		fprintf(fp,",le=\"%g\"} %llu\n",bound[i]/1000000.0,
+			s->bucket[i]);
+	}
+	fprintf(fp,"%s_bucket",name);
+	labels(fp,s);
+	fprintf(fp,",le=\"+Inf\"} %llu\n",s->count);
+	fprintf(fp,"%s_sum",name);
+	labels(fp,s);
+	fprintf(fp,"} %.6f\n",s->sum/1000000.0);
+	fprintf(fp,"%s_count",name);
+	labels(fp,s);
+	fprintf(fp,"} %llu\n",s->count);
+}
+
+static void family(FILE *fp,METRICS *m,int kind,int last,char *name,
+	char *type,char *help)
+{
+	int i;
+	int hdr=0;
+
+	for(i=0;i<m->total;i++)
+	{
+		if(m->series[i].kind<kind||m->series[i].kind>last)continue;
+		if(!hdr++)fprintf(fp,"# HELP %s %s\n# TYPE %s %s\n",
+			name,help,name,type);
+		if(kind<TIMED)histogram(fp,name,&m->series[i]);
+		else
+		{
+			fprintf(fp,"%s",name);
+			labels(fp,&m->series[i]);
+			fprintf(fp,"} %llu\n",m->series[i].count);
+		}
+	}
+}
+
+void *neosc_metrics_create(void)
+{
+	METRICS *m;
+
+	if(!(m=malloc(sizeof(METRICS))))return NULL;
+	memset(m,0,sizeof(METRICS));
+	pthread_mutex_lock(&mtx);
+	if((m->next=head))head->prev=m;
+	head=m;
+	pthread_mutex_unlock(&mtx);
+	return m;
+}
+
+void neosc_metrics_destroy(void *m)
+{
+	METRICS *mm=m;
+
+	pthread_mutex_lock(&mtx);
+	if(mm->next)mm->next->prev=mm->prev;
+	if(mm->prev)mm->prev->next=mm->next;
+	else head=mm->next;
+	merge(&retired,mm);
+	pthread_mutex_unlock(&mtx);
+	free(mm);
+}
+
+long long neosc_metrics_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec*1000000LL+ts.tv_nsec/1000;
+}
+
+void neosc_metrics_time(void *m,int kind,int serial,char *label,
+	long long usec)
+{
+	int i;
+	SERIES *s;
+
+	if(!(s=lookup(m,kind,serial,label,0,1)))return;
+	if(usec<0)usec=0;
+	for(i=0;i<NBUCKETS;i++)if(usec<=bound[i])add(&s->bucket[i],1);
+	add(&s->sum,usec);
+	add(&s->count,1);
+}
+
+void neosc_metrics_count(void *m,int kind,int serial,char *label,int code)
+{
+	SERIES *s;
+
+	if((s=lookup(m,kind,serial,label,code,1)))add(&s->count,1);
+}
+
+int neosc_metrics_export(char *file,int force)
+{
+	long long t;
+	FILE *fp;
+	METRICS *m;
+	METRICS *sum;
+	char tmp[PATH_MAX];
+
+	t=neosc_metrics_now();
+	if(!force&&t-__atomic_load_n(&last,__ATOMIC_RELAXED)<1000000)
+	{
+		__atomic_store_n(&pending,1,__ATOMIC_RELAXED);
+		return 0;
+	}
+	if(snprintf(tmp,sizeof(tmp),"%s.tmp",file)>=sizeof(tmp))goto err1;
+	if(!(sum=malloc(sizeof(METRICS))))goto err1;
+	memset(sum,0,sizeof(METRICS));
+
+	pthread_mutex_lock(&mtx);
+	__atomic_store_n(&last,t,__ATOMIC_RELAXED);
+	__atomic_store_n(&pending,0,__ATOMIC_RELAXED);
+	merge(sum,&retired);
+	for(m=head;m;m=m->next)merge(sum,m);
+
+	if(!(fp=fopen(tmp,"we")))goto err2;
+	family(fp,sum,NEOSC_METRIC_LOCKWAIT,NEOSC_METRIC_SELECT,
+		"neosc_phase_seconds","histogram",
+		"Duration of the device access phases.");
+	family(fp,sum,NEOSC_METRIC_COMMAND,NEOSC_METRIC_COMMAND,
+		"neosc_command_seconds","histogram",
+		"Duration of device commands including all phases.");
+	family(fp,sum,NEOSC_METRIC_QUEUE,NEOSC_METRIC_QUEUE,
+		"neosc_queue_wait_seconds","histogram",
+		"Time commands waited in the engine queue by class.");
+	family(fp,sum,NEOSC_METRIC_ERROR,NEOSC_METRIC_ERROR,
+		"neosc_command_errors_total","counter",
+		"Failed device commands by return code.");
+	family(fp,sum,NEOSC_METRIC_HIT,NEOSC_METRIC_HIT,
+		"neosc_cache_hits_total","counter",
+		"Results served from a cache.");
+	family(fp,sum,NEOSC_METRIC_MISS,NEOSC_METRIC_MISS,
+		"neosc_cache_misses_total","counter",
+		"Results that had to be read from the device.");
+	family(fp,sum,NEOSC_METRIC_RECOVERY,NEOSC_METRIC_RECOVERY,
+		"neosc_nfc_recoveries_total","counter",
+		"Commands that succeeded after reopening an NFC card.");
+	if(fclose(fp)||rename(tmp,file))goto err3;
+
+	pthread_mutex_unlock(&mtx);
+	free(sum);
+	return 0;
+
+err3:	unlink(tmp);
+err2:	pthread_mutex_unlock(&mtx);
+	free(sum);
+err1:	return -1;
+}
+
+int neosc_metrics_flush(char *file)
+{
+	if(!__atomic_load_n(&pending,__ATOMIC_RELAXED))return 0;
+	return neosc_metrics_export(file,0);
+}
@@ -0,0 +1,62 @@
+/*
+ * neosc-metrics - latency and error counters in Prometheus text format
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NEOSC_METRICS_H
+#define _NEOSC_METRICS_H
+
+/* timed metric kinds */
+
+#define NEOSC_METRIC_LOCKWAIT	0	/* broker queue wait  */
+#define NEOSC_METRIC_OPEN	1	/* device open        */
+#define NEOSC_METRIC_LOCK	2	/* PC/SC transaction  */
+#define NEOSC_METRIC_SELECT	3	/* applet select      */
+#define NEOSC_METRIC_COMMAND	4	/* complete command   */
+#define NEOSC_METRIC_QUEUE	5	/* engine queue wait  */
+
+/* counted metric kinds */
+
+#define NEOSC_METRIC_ERROR	6	/* command errors     */
+#define NEOSC_METRIC_HIT	7	/* cache hits         */
+#define NEOSC_METRIC_MISS	8	/* cache misses       */
+#define NEOSC_METRIC_RECOVERY	9	/* NFC recoveries     */
+
+/*
+ * Every thread owns its block from neosc_metrics_create() and is the
+ * only writer of it, so updates need neither locks nor atomic read-
+ * modify-write. neosc_metrics_export() sums all live blocks and those
+ * already destroyed and atomically replaces 'file' via rename(), unless
+ * 'force' is zero and the last export is less than a second ago. Such
+ * a suppressed export is done by the next neosc_metrics_flush() at least
+ * a second after the last one, which an idle caller should run
+ * periodically. A serial <=0 is labelled "any", 'label' is the command,
+ * queue class or cache name.
+ */
+
+extern void *neosc_metrics_create(void);
+extern void neosc_metrics_destroy(void *m);
+extern long long neosc_metrics_now(void);
+extern void neosc_metrics_time(void *m,int kind,int serial,char *label,
+	long long usec);
+extern void neosc_metrics_count(void *m,int kind,int serial,char *label,
+	int code);
+extern int neosc_metrics_export(char *file,int force);
+extern int neosc_metrics_flush(char *file);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * neosc-query - query the inventory database of neosc-shell
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "neosc-inventory.h"
+
+static void show(NEOSC_INVENTORY *db,NEOSC_INV_RECORD *r,int names)
+{
+	uint32_t i;
+	time_t t;
+	struct tm tm;
+	char stamp[32];
+
+	t=r->updated;
+	localtime_r(&t,&tm);
+	strftime(stamp,sizeof(stamp),"%Y-%m-%d %H:%M:%S",&tm);
+
+	printf("serial=%d",r->serial);
+	if(r->valid&NEOSC_INV_DEVICE)printf(" version=%d.%d.%d pgmseq=%d "
+		"slot1=%s slot2=%s",r->major,r->minor,r->build,r->pgmseq,
+		(r->slots&NEOSC_INV_SLOT1)?((r->slots&NEOSC_INV_TOUCH1)?
+		"touch":"yes"):"no",(r->slots&NEOSC_INV_SLOT2)?
+		((r->slots&NEOSC_INV_TOUCH2)?"touch":"yes"):"no");
+	if(r->valid&NEOSC_INV_MODE)printf(" mode=%d",r->mode);
+	if(r->valid&NEOSC_INV_OATH)printf(" oath=%u",r->oathcount);
+	printf(" updated=%s\n",stamp);
+
+	if(names)for(i=0;i<r->oathcount;i++)
+		printf("\toath: %s\n",db->name[r->oathfirst+i].name);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,"Usage: neosc-query <options> <file>\n"
+	  "-s <serial>\tshow the device with the given serial number\n"
+	  "-V <version>\tlist devices with firmware below <version>\n"
+	  "-o <name>\tlist devices holding the OATH entry <name>\n"
+	  "-h\t\tthis help text\n");
+	exit(1);
+}
+
+int main(int argc,char *argv[])
+{
+	int c;
+	int r=0;
+	int serial=0;
+	int major=-1;
+	int minor=0;
+	int build=0;
+	char *name=NULL;
+	uint32_t i;
+	uint32_t n;
+	uint32_t first;
+	NEOSC_INVENTORY *db;
+	NEOSC_INV_RECORD *rec;
+
+	while((c=getopt(argc,argv,"s:V:o:h"))!=-1)switch(c)
+	{
+	case 's':
+		if(serial||major!=-1||name)usage();
+		if((serial=atoi(optarg))<=0)usage();
+		break;
+	case 'V':
+		if(serial||major!=-1||name)usage();
+		if(sscanf(optarg,"%d.%d.%d",&major,&minor,&build)<1||
+			major<0)usage();
+		break;
+	case 'o':
+		if(serial||major!=-1||name)usage();
+		name=optarg;
+		break;
+	case 'h':
+	default:usage();
+	}
+
+	if(optind!=argc-1)usage();
+
+	if(!(db=neosc_inventory_map(argv[optind])))
+	{
+		fprintf(stderr,"cannot access inventory %s.\n",argv[optind]);
+		return 1;
+	}
+
+	if(serial)
+	{
+		if((rec=neosc_inventory_find(db,serial)))show(db,rec,1);
+		else r=1;
+	}
+	else if(major!=-1)
+	{
+		n=neosc_inventory_below(db,major,minor,build);
+		for(i=0;i<n;i++)show(db,&db->rec[db->veridx[i]],0);
+	}
+	else if(name)
+	{
+		n=neosc_inventory_named(db,name,&first);
+		for(i=first;i<first+n;i++)
+			show(db,&db->rec[db->name[db->nameidx[i]].record],0);
+	}
+	else for(i=0;i<db->hdr->records;i++)show(db,&db->rec[i],0);
+
+	neosc_inventory_unmap(db);
+	return r;
+}
@@ -0,0 +1,157 @@
+/*
+ * neosc-queue - per device command queue with priority classes
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "neosc-queue.h"
+
+typedef struct entry
+{
+	struct entry *next;
+	struct device *dev;
+	int cls;
+	int granted;
+	pthread_cond_t cond;
+} ENTRY;
+
+typedef struct device
+{
+	struct device *next;
+	int serial;
+	int busy;
+	ENTRY *head[NEOSC_QUEUE_CLASSES];
+	ENTRY *tail[NEOSC_QUEUE_CLASSES];
+} DEVICE;
+
+static pthread_mutex_t mtx=PTHREAD_MUTEX_INITIALIZER;
+static DEVICE *devices=NULL;
+static unsigned long grants[NEOSC_QUEUE_CLASSES];
+static long long waitsum[NEOSC_QUEUE_CLASSES];
+static long long waitmax[NEOSC_QUEUE_CLASSES];
+
+static char *names[NEOSC_QUEUE_CLASSES]=
+{
+	"interactive","normal","bulk"
+};
+
+static long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec*1000000LL+ts.tv_nsec/1000;
+}
+
+long long neosc_queue_enter(int serial,int cls,void **entry)
+{
+	long long t;
+	DEVICE *d;
+	ENTRY *e;
+
+	if(cls<0||cls>=NEOSC_QUEUE_CLASSES)goto err1;
+	if(!(e=malloc(sizeof(ENTRY))))goto err1;
+	memset(e,0,sizeof(ENTRY));
+	e->cls=cls;
+	t=now();
+
+	pthread_mutex_lock(&mtx);
+	for(d=devices;d;d=d->next)if(d->serial==serial)break;
+	if(!d)
+	{
+		if(!(d=malloc(sizeof(DEVICE))))goto err2;
+		memset(d,0,sizeof(DEVICE));
+		d->serial=serial;
+		d->next=devices;
+		devices=d;
+	}
+	e->dev=d;
+
+	if(d->busy)
+	{
+		pthread_cond_init(&e->cond,NULL);
+		if(d->tail[cls])d->tail[cls]->next=e;
+		else d->head[cls]=e;
+		d->tail[cls]=e;
+		while(!e->granted)pthread_cond_wait(&e->cond,&mtx);
+		pthread_cond_destroy(&e->cond);
+	}
+	else d->busy=1;
+
+	t=now()-t;
+	grants[cls]++;
+	waitsum[cls]+=t;
+	if(t>waitmax[cls])waitmax[cls]=t;
+	pthread_mutex_unlock(&mtx);
+
+	*entry=e;
+	return t;
+
+err2:	pthread_mutex_unlock(&mtx);
+	free(e);
+err1:	*entry=NULL;
+	return -1;
+}
+
+void neosc_queue_leave(void *entry)
+{
+	int i;
+	ENTRY *e=entry;
+	ENTRY *n;
+	DEVICE *d;
+	DEVICE **dd;
+
+	if(!e)return;
+	d=e->dev;
+	free(e);
+
+	pthread_mutex_lock(&mtx);
+	for(i=0;i<NEOSC_QUEUE_CLASSES;i++)if((n=d->head[i]))
+	{
+		if(!(d->head[i]=n->next))d->tail[i]=NULL;
+		n->granted=1;
+		pthread_cond_signal(&n->cond);
+		break;
+	}
+	if(i==NEOSC_QUEUE_CLASSES)
+	{
+		for(dd=&devices;*dd!=d;dd=&(*dd)->next);
+		*dd=d->next;
+		free(d);
+	}
+	pthread_mutex_unlock(&mtx);
+}
+
+void neosc_queue_stats(int cls,unsigned long *grant,long long *sum,
+	long long *max)
+{
+	pthread_mutex_lock(&mtx);
+	*grant=grants[cls];
+	*sum=waitsum[cls];
+	*max=waitmax[cls];
+	pthread_mutex_unlock(&mtx);
+}
+
+char *neosc_queue_name(int cls)
+{
+	return names[cls];
+}
@@ -0,0 +1,46 @@
+/*
+ * neosc-queue - per device command queue with priority classes
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NEOSC_QUEUE_H
+#define _NEOSC_QUEUE_H
+
+#define NEOSC_QUEUE_INTERACTIVE	0
+#define NEOSC_QUEUE_NORMAL	1
+#define NEOSC_QUEUE_BULK	2
+
+#define NEOSC_QUEUE_CLASSES	3
+
+/*
+ * All commands of a process for the same serial number pass through one
+ * queue. A command holds the device from neosc_queue_enter() until
+ * neosc_queue_leave(), then the oldest waiter of the highest class, i.e.
+ * the lowest class number, is granted the device. Commands are never
+ * preempted, a higher class only jumps ahead at command boundaries.
+ * neosc_queue_enter() returns the wait time in microseconds or -1 if the
+ * device could not be queued, in which case the command runs unqueued.
+ */
+
+extern long long neosc_queue_enter(int serial,int cls,void **entry);
+extern void neosc_queue_leave(void *entry);
+extern void neosc_queue_stats(int cls,unsigned long *grants,
+	long long *waitsum,long long *waitmax);
+extern char *neosc_queue_name(int cls);
+
+#endif
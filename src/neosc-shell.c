@@ -18,1458 +18,346 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#define _XOPEN_SOURCE 600
+#define _XOPEN_SOURCE 700
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/un.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <libneosc.h>
+#include "libneoscshell.h"
+#include "neosc-lock.h"
 
 #define memclear(a,b,c) \
     do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
 
-#define MAXLEN	128
-
-#define INT1	0
-#define INT2	1
-#define INT3	2
-#define INT4	3
-#define ARR	4
-
-#define SERIAL		0
-#define SLOT		1
-#define CHALLENGE	2
-#define URL		3
-#define	TEXT		4
-#define LANG		5
-#define SCANMAP		6
-#define MODE		7
-#define CRTIMEOUT	8
-#define AUTOEJECTTIME	9
-#define TICKETFLAGS	10
-#define CONFIGFLAGS	11
-#define EXTENDEDFLAGS	12
-#define ACCESSCODE	13
-#define NEWACCESSCODE	14
-#define SECRETKEY	15
-#define PRIVATEID	16
-#define PUBLICID	17
-#define OMP		18
-#define TT		19
-#define MUI		20
-#define IMF		21
-#define PASSWORD	22
-#define NEWPASSWORD	23
-#define OTPNAME		24
-#define OTPMODE		25
-#define SHAMODE		26
-#define OTPDIGITS	27
-
-#define TOTALVARS	28
+#define MAXFRAME	4096
+#define TOTPSTEP	30
+#define MAXJOBS		16
+#define WDSTEP		3600000
+#define FLUSHSTEP	1000
+#define MAXTAPLINES	32
+#define TAPWAIT		1000
 
 typedef struct
 {
-	char *name;
-	int type;
-	int valid;
-	int len;
-	union
-	{
-		int value;
-		unsigned char data[MAXLEN+1];
-	};
-} VAR;
-
-static int enable=0;
-
-static VAR var[TOTALVARS]=
-{
-	{"serial",INT4,0,0},
-	{"slot",INT1,0,0},
-	{"challenge",ARR,0,0},
-	{"url",ARR,0,0},
-	{"text",ARR,0,0},
-	{"lang",ARR,0,0},
-	{"scanmap",ARR,0,0},
-	{"mode",INT1,0,0},
-	{"crtimeout",INT1,0,0},
-	{"autoejecttime",INT2,0,0},
-	{"ticketflags",INT1,0,0},
-	{"configflags",INT1,0,0},
-	{"extendedflags",INT1,0,0},
-	{"accesscode",ARR,0,0},
-	{"newaccesscode",ARR,0,0},
-	{"secretkey",ARR,0,0},
-	{"privateid",ARR,0,0},
-	{"publicid",ARR,0,0},
-	{"omp",INT1,0,0},
-	{"tt",INT1,0,0},
-	{"mui",INT4,0,0},
-	{"imf",INT4,0,0},
-	{"password",ARR,0,0},
-	{"newpassword",ARR,0,0},
-	{"otpname",ARR,0,0},
-	{"otpmode",INT1,0,0},
-	{"shamode",INT1,0,0},
-	{"otpdigits",INT1,0,0},
-};
-
-static void varhelp(void)
-{
-	int i;
-
-	printf("Variables:\n\n");
-	for(i=0;i<TOTALVARS;i++)printf("\t%s (%s)\n",var[i].name,
-		var[i].type==ARR?"array":"number");
-	printf("\n"
-	"Commands working with variables:\n"
-	"\n"
-	"set <variable> <value>\n"
-	"\n"
-	"\tSets a variable to the specified value.\n"
-	"\tThe value may be prefixed by a modifier.\n"
-	"\tIf no modifier is specified the value must be a decimal number.\n"
-	"\tModifier are:\n"
-	"\n"
-	"\th:\t\ta hexadecimal number\n"
-	"\tm:\t\ta modified hexadecimal (modhex) number\n"
-	"\tb32:\t\ta base32 encoded number\n"
-	"\tb64:\t\ta base64 encoded number\n"
-	"\tt:<time>\ta time value, either 'now' for the current time or\n"
-	"\t\t\ta time specified as 'yyyy-mm-dd HH:MM:SS'\n"
-	"\t\t\t(array only)\n"
-	"\ts:\t\ta character string (array only)\n"
-	"\tr:<digits>\ta random of <digits> length (array only)\n"
-	"\n"
-	"clear <variable>\n"
-	"\n"
-	"\tUnsets a variable.\n"
-	"\n"
-	"show <variable>\n"
-	"\n"
-	"\tPrints a variable as hexadecimal number.\n"
-	"\n"
-	"print <variable>\n"
-	"\n"
-	"\tPrints a variable as decimal number (number only).\n"
-	"\n"
-	"modhex <variable>\n"
-	"\n"
-	"\tPrints a variable as modified hexadecimal number (array only).\n"
-	"\n"
-	"base32 <variable>\n"
-	"\n"
-	"\tPrints a variable base32 encoded (array only).\n"
-	"\n"
-	"base64 <variable>\n"
-	"\n"
-	"\tPrints a variable base64 encoded (array only).\n");
-}
-
-static void neohelp(void)
-{
-	printf("NEO Applet (CCID mode):\n\n"
-	"Usage: neo <command>\n\n"
-	"\tshow-info\t\tshow applet info\n"
-	"\tshow-status\t\tshow applet status\n"
-	"\tshow-serial\t\tshow device serial number\n"
-	"\tshow-ndef\t\tshow ndef data (NFC only)\n"
-	"\tcalc-yubiotp\t\tcalculate Yubico OTP (NFC only)\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\tcalc-hmac\t\tcalculate HMCA_SHA1 challenge-response\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tchallenge\trequired, 1 to 64 bytes\n"
-	"\t\totpdigits\toptional, if set (6-8) print otp format\n"
-	"\tcalc-otp\t\tcalcuate Yubico OTP challenge-response\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tchallenge\trequired, 6 bytes\n"
-	"\tset-ndef\t\tconfigure NDEF message\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\turl\t\t(this or 'text' and 'lang'), the url to store\n"
-	"\t\ttext\t\t(this and 'lang' or 'url'), the text to store\n"
-	"\t\tlang\t\t(this and 'text' or 'url'), language to store\n"
-	"\tset-scanmap\t\tconfigure device scan code map\n"
-	"\t\tscanmap\t\toptional, 45 byte scan map\n"
-	"\tset-mode\t\tconfigure device operation mode (YubiKey NEO)\n"
-	"\tset-mode-mgr\t\tconfigure device operation mode (YubiKey 4)\n"
-	"\t\tmode\t\trequired, operation mode (0-6)\n"
-	"\t\tcrtimeout\trequired, challenge-response timeout\n"
-	"\t\tautoejecttime\trequired, auto eject time\n"
-	"\treset-slot\t\treset configuration of a slot\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\tswap-slots\t\texchange both slots\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tupdate-slot\t\tupdate configuration options for a slot\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tticketflags\trequired, ticket flags\n"
-	"\t\tconfigflags\trequired, configuration flags\n"
-	"\t\textendedflags\trequired, extended flags\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tconfig-hmac\t\tconfigure HMAC-SHA1 challenge-response\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tsecretkey\trequired, hash secret key (20 bytes)\n"
-	"\t\tticketflags\trequired, ticket flags\n"
-	"\t\tconfigflags\trequired, configuration flags\n"
-	"\t\textendedflags\trequired, extended flags\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tconfig-otp\t\tconfigure Yubico OTP challenge-response\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
-	"\t\tticketflags\trequired, ticket flags\n"
-	"\t\tconfigflags\trequired, configuration flags\n"
-	"\t\textendedflags\trequired, extended flags\n"
-	"\t\tprivateid\toptional, private identity (6 bytes)\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tconfig-hotp\t\tconfigure HOTP for a slot\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tsecretkey\trequired, hash secret key (20 bytes)\n"
-	"\t\tomp\t\trequired, (0-255, 0 if not used)\n"
-	"\t\ttt\t\trequired, (0-255, 0 if not used)\n"
-	"\t\tmui\t\trequired, (0-99999999, -1 if not used)\n"
-	"\t\timf\t\trequired, (0-0xffff0, increments of 16)\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tconfig-yubiotp\t\tconfigure Yubico OTP for a slot\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
-	"\t\tticketflags\trequired, ticket flags\n"
-	"\t\tconfigflags\trequired, configuration flags\n"
-	"\t\textendedflags\trequired, extended flags\n"
-	"\t\tprivateid\toptional, private identity (6 bytes)\n"
-	"\t\tpublicid\toptional, public identity (1-16 bytes)\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tconfig-password\t\tconfigure static password for a slot\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
-	"\t\tticketflags\trequired, ticket flags\n"
-	"\t\tconfigflags\trequired, configuration flags\n"
-	"\t\textendedflags\trequired, extended flags\n"
-	"\t\tprivateid\trequired, private identity (6 bytes)\n"
-	"\t\tpublicid\toptional, public identity (1-16 bytes)\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n");
-}
-
-static void ndefhelp(void)
-{
-	printf("NDEF Applet (CCID mode):\n\n"
-	"Usage: ndef <command>\n\n"
-	"\tshow-cc\t\t\tshow ndef cc data (NFC only)\n"
-	"\tshow-ndef\t\tshow ndef data (NFC only)\n");
-}
-
-static void oathhelp(void)
+	int id;
+	int done;
+	int result;
+	void *ctx;
+	pthread_t tid;
+	long long deadline;
+	FILE *out;
+	char *data;
+	size_t size;
+	char *line;
+	char cmd[32];
+} JOB;
+
+static int cancelfd[2];
+static int busy=0;
+static int publishing=0;
+static int listening=0;
+static int flushing=0;
+static long long cmddeadline=0;
+static long long deadline=0;
+static void *wdctx;
+static pthread_mutex_t wdmtx=PTHREAD_MUTEX_INITIALIZER;
+static JOB job[MAXJOBS];
+
+static long long now(void)
 {
-	printf("OATH Applet (CCID mode):\n\n"
-	"Usage: oath <command>\n\n"
-	"\tshow-info\t\tshow applet info\n"
-	"\treset-all\t\treset applet\n"
-	"\tset-password\t\tset/change/clear applet password\n"
-	"\t\tpassword\toptional, current password (if any)\n"
-	"\t\tnewpassword\toptional, new password (if any)\n"
-	"\tcalc-otp\t\tcalculate named OTP entry\n"
-	"\t\totpname\t\trequired, name of entry to be processed\n"
-	"\t\tpassword\toptional, current password (if any)\n"
-	"\tcalc-all-totp\t\tcalculate all TOTP entries\n"
-	"\t\tpassword\toptional, current password (if any)\n"
-	"\tlist-all\t\tlist all OTP entries\n"
-	"\t\tpassword\toptional, current password (if any)\n"
-	"\tdelete-entry\t\tdelete an OTP entry\n"
-	"\t\totpname\t\trequired, name of entry to be processed\n"
-	"\t\tpassword\toptional, current password (if any)\n"
-	"\tadd-change-entry\tadd or modify an OTP entry\n"
-	"\t\totpname\t\trequired, name of entry to be processed\n"
-	"\t\totpmode\t\trequired, 0 for HOTP, 1 for TOTP\n"
-	"\t\tshamode\t\trequired, 0 for SHA1, 1 for SHA256\n"
-	"\t\totpdigits\trequired, output digit amount (6-8)\n"
-	"\t\timf\t\trequired, initial moving factor for HOTP\n"
-	"\t\tsecretkey\trequired, 20 bytes for SHA1, 32 for SHA256\n"
-	"\t\tpassword\toptional, current password (if any)\n");
-}
+	struct timespec ts;
 
-static void usbhelp(void)
-{
-	printf("NEO Applet (OTP mode):\n\n"
-	"Usage: usb <command>\n\n"
-	"\tshow-status\t\tshow applet status\n"
-	"\tshow-serial\t\tshow device serial number\n"
-	"\tcalc-hmac\t\tcalculate HMCA_SHA1 challenge-response\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tchallenge\trequired, 1 to 64 bytes\n"
-	"\t\totpdigits\toptional, if set (6-8) print otp format\n"
-	"\tcalc-otp\t\tcalcuate Yubico OTP challenge-response\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tchallenge\trequired, 6 bytes\n"
-	"\tset-ndef\t\tconfigure NDEF message\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\turl\t\t(this or 'text' and 'lang'), the url to store\n"
-	"\t\ttext\t\t(this and 'lang' or 'url'), the text to store\n"
-	"\t\tlang\t\t(this and 'text' or 'url'), language to store\n"
-	"\tset-scanmap\t\tconfigure device scan code map\n"
-	"\t\tscanmap\t\toptional, 45 byte scan map\n"
-	"\tset-mode\t\tconfigure device operation mode\n"
-	"\t\tmode\t\trequired, operation mode (0-6)\n"
-	"\t\tcrtimeout\trequired, challenge-response timeout\n"
-	"\t\tautoejecttime\trequired, auto eject time\n"
-	"\treset-slot\t\treset configuration of a slot\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\tswap-slots\t\texchange both slots\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tupdate-slot\t\tupdate configuration options for a slot\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tticketflags\trequired, ticket flags\n"
-	"\t\tconfigflags\trequired, configuration flags\n"
-	"\t\textendedflags\trequired, extended flags\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tconfig-hmac\t\tconfigure HMAC-SHA1 challenge-response\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tsecretkey\trequired, hash secret key (20 bytes)\n"
-	"\t\tticketflags\trequired, ticket flags\n"
-	"\t\tconfigflags\trequired, configuration flags\n"
-	"\t\textendedflags\trequired, extended flags\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tconfig-otp\t\tconfigure Yubico OTP challenge-response\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
-	"\t\tticketflags\trequired, ticket flags\n"
-	"\t\tconfigflags\trequired, configuration flags\n"
-	"\t\textendedflags\trequired, extended flags\n"
-	"\t\tprivateid\toptional, private identity (6 bytes)\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tconfig-hotp\t\tconfigure HOTP for a slot\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tsecretkey\trequired, hash secret key (20 bytes)\n"
-	"\t\tomp\t\trequired, (0-255, 0 if not used)\n"
-	"\t\ttt\t\trequired, (0-255, 0 if not used)\n"
-	"\t\tmui\t\trequired, (0-99999999, -1 if not used)\n"
-	"\t\timf\t\trequired, (0-0xffff0, increments of 16)\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tconfig-yubiotp\t\tconfigure Yubico OTP for a slot\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
-	"\t\tticketflags\trequired, ticket flags\n"
-	"\t\tconfigflags\trequired, configuration flags\n"
-	"\t\textendedflags\trequired, extended flags\n"
-	"\t\tprivateid\toptional, private identity (6 bytes)\n"
-	"\t\tpublicid\toptional, public identity (1-16 bytes)\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n"
-	"\tconfig-password\t\tconfigure static password for a slot\n"
-	"\t\tslot\t\trequired, slot number(0 or 1)\n"
-	"\t\tsecretkey\trequired, hash secret key (16 bytes)\n"
-	"\t\tticketflags\trequired, ticket flags\n"
-	"\t\tconfigflags\trequired, configuration flags\n"
-	"\t\textendedflags\trequired, extended flags\n"
-	"\t\tprivateid\trequired, private identity (6 bytes)\n"
-	"\t\tpublicid\toptional, public identity (1-16 bytes)\n"
-	"\t\taccesscode\toptional, current access code (6 bytes)\n"
-	"\t\tnewaccesscode\toptional, new access code (6 bytes)\n");
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec*1000LL+ts.tv_nsec/1000000;
 }
 
-static void help(char *item)
+static void sighandler(int sig)
 {
-	if(item)
-	{
-		if(!strcmp(item,"var"))varhelp();
-		else if(!strcmp(item,"neo"))neohelp();
-		else if(!strcmp(item,"ndef"))ndefhelp();
-		else if(!strcmp(item,"oath"))oathhelp();
-		else if(!strcmp(item,"usb"))usbhelp();
-		else item=NULL;
-	}
+	unsigned char c=(unsigned char)sig;
 
-	if(!item)
-	{
-		printf("Help items:\n"
-		"\n"
-		"var\thelp related to variables\n"
-		"neo\thelp for neo applet commands (ccid mode)\n"
-		"ndef\thelp for ndef applet commands (ccid mode)\n"
-		"oath\thelp for oath applet commands (ccid mode)\n"
-		"usb\thelp for usb related commands (otp mode)\n");
-		return;
-	}
+	if(write(cancelfd[1],&c,1));
 }
 
-static int varhandler(int mode,char *name,char *value)
+/*
+ * An operation stuck inside PC/SC or a HID transfer cannot be unwound,
+ * so cancellation wipes all secrets and terminates the process which
+ * makes PC/SC and the lock broker release the device. A context still
+ * executing a command is not wiped as the command could pick up half
+ * cleared secrets, its memory goes away with the process anyway, but its
+ * published codes are still removed and its inventory merged. Idle
+ * contexts cannot become busy as arm() blocks on the mutex held here.
+ */
+static void terminate(void)
 {
-	int r=-1;
 	int i;
-	int j;
-	int k;
-	int len=MAXLEN;
-	unsigned long long val;
-	char *eptr;
-	struct tm tm;
-	unsigned char bfr[2*MAXLEN+1];
-
-	for(i=0;i<TOTALVARS;i++)if(!strcmp(var[i].name,name))break;
-	if(i==TOTALVARS)goto fail;
-
-	switch(mode)
-	{
-	case 0:	if(!strncmp(value,"h:",2))
-		{
-			if(neosc_util_hex_decode(value+2,strlen(value+2),bfr,
-				&len))goto fail;
-		}
-		else if(!strncmp(value,"m:",2))
-		{
-			if(neosc_util_modhex_decode(value+2,strlen(value+2),bfr,
-				&len))goto fail;
-		}
-		else if(!strncmp(value,"b64:",4))
-		{
-			if(neosc_util_base64_decode(value+4,strlen(value+4),bfr,
-				&len))goto fail;
-		}
-		else if(!strncmp(value,"b32:",4))
-		{
-			if(neosc_util_base32_decode(value+4,strlen(value+4),bfr,
-				&len))goto fail;
-		}
-		else if(!strncmp(value,"t:",2))
-		{
-			if(var[i].type!=ARR)goto fail;
-			if(!strcmp(value+2,"now"))val=time(NULL);
-			else
-			{
-				memset(&tm,0,sizeof(tm));
-				if(strptime(value+2,"%n%Y-%m-%d%n%T",&tm))
-					goto fail;
-				val=mktime(&tm);
-			}
-			neosc_util_time_to_array((time_t)val,bfr,8);
-			len=8;
-		}
-		else if(!strncmp(value,"s:",2))
-		{
-			if(var[i].type!=ARR)goto fail;
-			if((len=strlen(value+2))>MAXLEN)goto fail;
-			strcpy((char *)bfr,value+2);
-		}
-		else if(!strncmp(value,"r:",2))
-		{
-			if(var[i].type!=ARR)goto fail;
-			val=strtoull(value+2,&eptr,10);
-			if(eptr==value+2||*eptr)goto fail;
-			if(val>MAXLEN)goto fail;
-			len=(int)val;
-			if(neosc_util_random(bfr,len))goto fail;
-		}
-		else
-		{
-			val=strtoull(value,&eptr,10);
-			if(eptr==value||*eptr)goto fail;
-			for(len=8,k=0,j=56;k<8;k++,j-=8)
-				bfr[k]=(unsigned char)(val>>j);
-		}
-		if(var[i].type==ARR)
-		{
-			memcpy(var[i].data,bfr,len);
-			var[i].len=len;
-			var[i].data[len]=0;
-		}
-		else
-		{
-			for(var[i].value=0,j=0;j<len;j++)
-			{
-				var[i].value<<=8;
-				var[i].value|=bfr[j];
-			}
-			switch(var[i].type)
-			{
-			case INT1:
-				j=~0xff;
-				break;
-			case INT2:
-				j=~0xffff;
-				break;
-			case INT3:
-				j=~0xffff;
-				break;
-			case INT4:
-				j=~0xffffff;
-				break;
-			}
-			if((*value=='-'?-var[i].value:var[i].value)&j)goto fail;
-		}
-		var[i].valid=1;
-		break;
-
-	case 1:	var[i].valid=0;
-		var[i].len=0;
-		break;
-
-	case 2:	if(!var[i].valid)strcpy((char *)bfr,"<undef>");
-		else switch(var[i].type)
-		{
-		case INT1:
-			sprintf((char *)bfr,"h:%02x",var[i].value);
-			break;
-		case INT2:
-			sprintf((char *)bfr,"h:%04x",var[i].value);
-			break;
-		case INT3:
-			sprintf((char *)bfr,"h:%06x",var[i].value);
-			break;
-		case INT4:
-			sprintf((char *)bfr,"h:%08x",var[i].value);
-			break;
-		case ARR:
-			strcpy((char *)bfr,"h:");
-			len=sizeof(bfr)-2;
-			if(neosc_util_hex_encode(var[i].data,var[i].len,
-				(char *)bfr+2,&len))goto fail;
-			break;
-		}
-		printf("%s\n",(char *)bfr);
-		break;
-
-	case 3:	if(var[i].type==ARR)goto fail;
-		else if(!var[i].valid)strcpy((char *)bfr,"<undef>");
-		else sprintf((char *)bfr,"%d",var[i].value);
-		printf("%s\n",(char *)bfr);
-		break;
-
-	case 4:	len=sizeof(bfr);
-		if(var[i].type!=ARR)goto fail;
-		else if(!var[i].valid)strcpy((char *)bfr,"<undef>");
-		else if(neosc_util_modhex_encode(var[i].data,var[i].len,
-			(char *)bfr,&len))goto fail;
-		printf("m:%s\n",(char *)bfr);
-		break;
-
-	case 5:	len=sizeof(bfr);
-		if(var[i].type!=ARR)goto fail;
-		else if(!var[i].valid)strcpy((char *)bfr,"<undef>");
-		else if(neosc_util_base32_encode(var[i].data,var[i].len,
-			(char *)bfr,&len))goto fail;
-		printf("b32:%s\n",(char *)bfr);
-		break;
-
-	case 6:	len=sizeof(bfr);
-		if(var[i].type!=ARR)goto fail;
-		else if(!var[i].valid)strcpy((char *)bfr,"<undef>");
-		else if(neosc_util_base64_encode(var[i].data,var[i].len,
-			(char *)bfr,&len))goto fail;
-		printf("b64:%s\n",(char *)bfr);
-		break;
-
-	default:goto fail;
-	}
-
-	r=0;
-
-fail:	memclear(&tm,0,sizeof(tm));
-	memclear(&val,0,sizeof(val));
-	memclear(bfr,0,sizeof(bfr));
-	return r;
-}
-
-static int neohandler(char *cmd)
-{
-	int mode=-1;
-	int serial=0;
-	int r=-1;
-	int val;
-	int len;
-	void *ctx;
-	NEOSC_NEO_INFO info;
-	NEOSC_STATUS status;
-	NEOSC_NDEF ndefdata;
-	unsigned char bfr[MAXLEN];
-	char txt[2*MAXLEN+1];
-
-	if(var[SERIAL].valid)serial=var[SERIAL].value;
-
-	if(!strcmp(cmd,"show-info"))mode=0;
-	else if(!strcmp(cmd,"show-status"))mode=1;
-	else if(!strcmp(cmd,"show-ndef"))mode=2;
-	else if(!strcmp(cmd,"calc-yubiotp"))
-	{
-		if(!var[SLOT].valid)goto err1;
-		mode=3;
-	}
-	else if(!strcmp(cmd,"calc-hmac"))
-	{
-		if(!var[SLOT].valid)goto err1;
-		if(!var[CHALLENGE].valid)goto err1;
-		mode=4;
-	}
-	else if(!strcmp(cmd,"calc-otp"))
-	{
-		if(!var[SLOT].valid)goto err1;
-		if(!var[CHALLENGE].valid)goto err1;
-		mode=5;
-	}
-	else if(!strcmp(cmd,"set-ndef"))
-	{
-		if(!var[SLOT].valid)goto err1;
-		mode=6;
-	}
-	else if(!strcmp(cmd,"set-scanmap"))mode=7;
-	else if(!strcmp(cmd,"set-mode"))
-	{
-		if(!var[MODE].valid)goto err1;
-		if(var[MODE].value==0x03&&enable<3)goto err1;
-		if(!var[CRTIMEOUT].valid)goto err1;
-		if(!var[AUTOEJECTTIME].valid)goto err1;
-		mode=8;
-	}
-	else if(!strcmp(cmd,"set-mode-mgr"))
-	{
-		if(!var[MODE].valid)goto err1;
-		if(var[MODE].value==0x03&&enable<3)goto err1;
-		if(!var[CRTIMEOUT].valid)goto err1;
-		if(!var[AUTOEJECTTIME].valid)goto err1;
-		mode=18;
-	}
-	else if(!strcmp(cmd,"reset-slot"))
-	{
-		if(!(enable&1))goto err1;
-		if(!var[SLOT].valid)goto err1;
-		mode=9;
-	}
-	else if(!strcmp(cmd,"swap-slots"))mode=10;
-	else if(!strcmp(cmd,"update-slot"))
-	{
-		if(!var[SLOT].valid)goto err1;
-		if(!var[TICKETFLAGS].valid)goto err1;
-		if(!var[CONFIGFLAGS].valid)goto err1;
-		if(!var[EXTENDEDFLAGS].valid)goto err1;
-		mode=11;
-	}
-	else if(!strcmp(cmd,"config-hmac"))
-	{
-		if(!var[SLOT].valid)goto err1;
-		if(!var[TICKETFLAGS].valid)goto err1;
-		if(!var[CONFIGFLAGS].valid)goto err1;
-		if(!var[EXTENDEDFLAGS].valid)goto err1;
-		mode=12;
-	}
-	else if(!strcmp(cmd,"config-otp"))
-	{
-		if(!var[SLOT].valid)goto err1;
-		if(!var[TICKETFLAGS].valid)goto err1;
-		if(!var[CONFIGFLAGS].valid)goto err1;
-		if(!var[EXTENDEDFLAGS].valid)goto err1;
-		mode=13;
-	}
-	else if(!strcmp(cmd,"config-hotp"))
-	{
-		if(!var[SLOT].valid)goto err1;
-		if(!var[TICKETFLAGS].valid)goto err1;
-		if(!var[CONFIGFLAGS].valid)goto err1;
-		if(!var[EXTENDEDFLAGS].valid)goto err1;
-		if(!var[OMP].valid)goto err1;
-		if(!var[TT].valid)goto err1;
-		if(!var[MUI].valid)goto err1;
-		if(!var[IMF].valid)goto err1;
-		mode=14;
-	}
-	else if(!strcmp(cmd,"config-yubiotp"))
-	{
-		if(!var[SLOT].valid)goto err1;
-		if(!var[TICKETFLAGS].valid)goto err1;
-		if(!var[CONFIGFLAGS].valid)goto err1;
-		if(!var[EXTENDEDFLAGS].valid)goto err1;
-		mode=15;
-	}
-	else if(!strcmp(cmd,"config-password"))
-	{
-		if(!var[SLOT].valid)goto err1;
-		if(!var[TICKETFLAGS].valid)goto err1;
-		if(!var[CONFIGFLAGS].valid)goto err1;
-		if(!var[EXTENDEDFLAGS].valid)goto err1;
-		mode=16;
-	}
-	else if(!strcmp(cmd,"show-serial"))mode=17;
-	else goto err1;
-
-	if(neosc_pcsc_open(&ctx,serial))goto err1;
-	if(neosc_pcsc_lock(ctx))goto err2;
-	if(mode==18)
-	{
-		if(neosc_neo_select_mgr(ctx))goto err3;
-	}
-	else if(neosc_neo_select(ctx,&info))goto err3;
-
-	switch(mode)
-	{
-	case 0:	printf("version: %d.%d.%d\n",info.major,info.minor,info.build);
-		printf("pgmseq: %d\n",info.pgmseq);
-		printf("touchlevel: %d\n",info.touchlevel);
-		printf("mode: %d\n",info.mode);
-		printf("crtimeout: %d\n",info.crtimeout);
-		printf("autoejecttime: %d\n",info.autoejecttime);
-		printf("config 1 valid: %s\n",info.config1?"yes":"no");
-		printf("config 2 valid: %s\n",info.config2?"yes":"no");
-		printf("config 1 needs button: %s\n",info.touch1?"yes":"no");
-		printf("config 2 needs button: %s\n",info.touch2?"yes":"no");
-		printf("led behaviour: %s\n",info.ledinv?"inverted":"normal");
-		r=0;
-		break;
-
-	case 1:	if((r=neosc_neo_read_status(ctx,&status)))break;
-		printf("version: %d.%d.%d\n",status.major,status.minor,
-			status.build);
-		printf("pgmseq: %d\n",status.pgmseq);
-		printf("touchlevel: %d\n",status.touchlevel);
-		printf("config 1 valid: %s\n",status.config1?"yes":"no");
-		printf("config 2 valid: %s\n",status.config2?"yes":"no");
-		printf("config 1 needs button: %s\n",status.touch1?"yes":"no");
-		printf("config 2 needs button: %s\n",status.touch2?"yes":"no");
-		printf("led behaviour: %s\n",status.ledinv?"inverted":"normal");
-		break;
-
-	case 2:	if((r=neosc_neo_read_ndef(ctx,&ndefdata)))break;
-		if(ndefdata.type==NEOSC_NDEF_TEXT)
-		{
-			printf("language: %s\n",ndefdata.language);
-			printf("text: %s\n",ndefdata.payload);
-		}
-		else printf("url: %s\n",ndefdata.payload);
-		break;
-
-	case 3:	if((r=neosc_neo_read_yubiotp(ctx,var[SLOT].value,txt,
-			sizeof(txt))))break;
-		printf("otp:%s\n",txt);
-		break;
-
-	case 4:	if((r=neosc_neo_read_hmac(ctx,var[SLOT].value,
-		    var[CHALLENGE].data,var[CHALLENGE].len,bfr,sizeof(bfr))))
-			break;
-		if(var[OTPDIGITS].valid)
-		{
-			if((r=neosc_util_sha1_to_otp(bfr,NEOSC_SHA1_SIZE,
-				var[OTPDIGITS].value,&val)))break;
-			switch(var[OTPDIGITS].value)
-			{
-			case 6:	printf("otp:%06d\n",val);
-				break;
-			case 7:	printf("otp:%07d\n",val);
-				break;
-			case 8:	printf("otp:%08d\n",val);
-				break;
-			default:r=-1;
-				break;
-			}
-		}
-		else
-		{
-			len=sizeof(txt);
-			if((r=neosc_util_hex_encode(bfr,NEOSC_SHA1_SIZE,txt,
-				&len)))break;
-			printf("h:%s\n",txt);
-		}
-		break;
-
-	case 5:	if((r=neosc_neo_read_otp(ctx,var[SLOT].value,
-		    var[CHALLENGE].data,var[CHALLENGE].len,bfr,sizeof(bfr))))
-			break;
-		len=sizeof(txt);
-		if((r=neosc_util_modhex_encode(bfr,16,txt,&len)))break;
-		printf("m:%s\n",txt);
-		break;
-
-	case 6:	r=neosc_neo_write_ndef(ctx,var[SLOT].value,
-			var[URL].valid?(char *)var[URL].data:NULL,
-			var[TEXT].valid?(char *)var[TEXT].data:NULL,
-			var[LANG].valid?(char *)var[LANG].data:NULL,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 7:	r=neosc_neo_write_scanmap(ctx,
-			var[SCANMAP].valid?var[SCANMAP].data:NULL,
-			var[SCANMAP].len);
-		break;
-
-	case 8:	r=neosc_neo_setmode(ctx,var[MODE].value,var[CRTIMEOUT].value,
-			var[AUTOEJECTTIME].value);
-		break;
-
-	case 9:	r=neosc_neo_reset(ctx,var[SLOT].value);
-		break;
-
-	case 10:r=neosc_neo_swap(ctx,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 11:r=neosc_neo_update(ctx,var[SLOT].value,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 12:r=neosc_neo_hmac(ctx,var[SLOT].value,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 13:r=neosc_neo_otp(ctx,var[SLOT].value,
-			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
-			var[PRIVATEID].len,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 14:r=neosc_neo_hotp(ctx,var[SLOT].value,var[OMP].value,
-			var[TT].value,var[MUI].value,var[IMF].value,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 15:r=neosc_neo_yubiotp(ctx,var[SLOT].value,
-			var[PUBLICID].valid?var[PUBLICID].data:NULL,
-			var[PUBLICID].len,
-			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
-			var[PRIVATEID].len,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 16:r=neosc_neo_passwd(ctx,var[SLOT].value,
-			var[PUBLICID].valid?var[PUBLICID].data:NULL,
-			var[PUBLICID].len,
-			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
-			var[PRIVATEID].len,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 17:if((r=neosc_neo_read_serial(ctx,&val)))break;
-		printf("serial: %d\n",val);
-		break;
-
-	case 18:r=neosc_neo_setmode_mgr(ctx,var[MODE].value,
-			var[CRTIMEOUT].value,var[AUTOEJECTTIME].value);
-		break;
-	}
+	HIST_ENTRY **l;
 
-err3:	neosc_pcsc_unlock(ctx);
-err2:	neosc_pcsc_close(ctx);
-err1:	memclear(&info,0,sizeof(info));
-	memclear(&status,0,sizeof(status));
-	memclear(&ndefdata,0,sizeof(ndefdata));
-	memclear(&serial,0,sizeof(serial));
-	memclear(&val,0,sizeof(val));
-	memclear(bfr,0,sizeof(bfr));
-	memclear(txt,0,sizeof(txt));
-	return r;
+	pthread_mutex_lock(&wdmtx);
+	if(wdctx&&!busy)neosc_shell_wipe(wdctx);
+	else if(wdctx)neosc_shell_release(wdctx);
+	for(i=0;i<MAXJOBS;i++)if(job[i].id&&job[i].done)
+		neosc_shell_wipe(job[i].ctx);
+	if((l=history_list()))for(;*l;l++)
+	    memclear((*l)->line,0,strlen((*l)->line));
+	_exit(2);
 }
 
-static int ndefhandler(char *cmd)
+static void *watchdog(void *unused)
 {
-	int r=-1;
-	int mode=-1;
-	int serial=0;
-	void *ctx;
-	NEOSC_NDEF_CC ccdata;
-	NEOSC_NDEF ndefdata;
-
-	if(var[SERIAL].valid)serial=var[SERIAL].value;
-
-	if(!strcmp(cmd,"show-cc"))mode=0;
-	else if(!strcmp(cmd,"show-ndef"))mode=1;
-	else goto err1;
-
-	if(neosc_pcsc_open(&ctx,serial))goto err1;
-	if(neosc_pcsc_lock(ctx))goto err2;
-	if(neosc_ndef_select(ctx))goto err3;
+	int i;
+	int b;
+	int f;
+	int w;
+	long long t;
+	long long d;
+	unsigned char c;
+	struct pollfd p;
 
-	switch(mode)
+	while(1)
 	{
-	case 0:	if((r=neosc_ndef_read_cc(ctx,&ccdata)))break;
-		printf("version: %02x\n",ccdata.version);
-		printf("mle: %04x\n",ccdata.mle);
-		printf("mlc: %04x\n",ccdata.mlc);
-		printf("fileid: %04x\n",ccdata.fileid);
-		printf("ndef_max: %04x\n",ccdata.ndef_max);
-		printf("rcond: %02x\n",ccdata.rcond);
-		printf("wcond: %02x\n",ccdata.wcond);
-		break;
-
-	case 1:	if((r=neosc_ndef_read_ndef(ctx,&ndefdata)))break;
-		if(ndefdata.type==NEOSC_NDEF_TEXT)
-		{
-			printf("language: %s\n",ndefdata.language);
-			printf("text: %s\n",ndefdata.payload);
-		}
-		else printf("url: %s\n",ndefdata.payload);
-		break;
+		pthread_mutex_lock(&wdmtx);
+		b=busy;
+		d=deadline;
+
+		/* metrics suppressed by the export rate limit are written here */
+
+		if((f=flushing&&wdctx))neosc_shell_flush(wdctx);
+		if(b&&cmddeadline&&(!d||cmddeadline<d))d=cmddeadline;
+		for(i=0;i<MAXJOBS;i++)if(job[i].id&&!job[i].done&&
+			job[i].deadline&&(!d||job[i].deadline<d))
+			d=job[i].deadline;
+		pthread_mutex_unlock(&wdmtx);
+
+		t=now();
+		if(d&&t>=d)terminate();
+
+		/* long deadlines are approached in steps, poll takes an int */
+
+		if(d&&d-t>WDSTEP)d=t+WDSTEP;
+		w=d?(int)(d-t):-1;
+		if(f&&(w==-1||w>FLUSHSTEP))w=FLUSHSTEP;
+		p.fd=cancelfd[0];
+		p.events=POLLIN;
+		if(poll(&p,1,w)<1)continue;
+		if(read(cancelfd[0],&c,1)!=1)continue;
+
+		/*
+		 * SIGINT only cancels a running command unless publishing
+		 * or listening for taps, 0 is a rearm
+		 */
+
+		if(!c||(c==SIGINT&&!b&&!publishing&&!listening))continue;
+		terminate();
 	}
-
-err3:	neosc_pcsc_unlock(ctx);
-err2:	neosc_pcsc_close(ctx);
-err1:	memclear(&serial,0,sizeof(serial));
-	memclear(&ccdata,0,sizeof(ccdata));
-	memclear(&ndefdata,0,sizeof(ndefdata));
-	return r;
+	return NULL;
 }
 
-static int oathhandler(char *cmd)
+static void arm(void *ctx,int on)
 {
-	int r=-1;
-	int mode=-1;
-	int serial=0;
-	int len;
-	int i;
-	int total;
-	void *ctx;
-	NEOSC_OATH_LIST *list;
-	NEOSC_OATH_RESPONSE *results;
-	NEOSC_OATH_RESPONSE result;
-	NEOSC_OATH_INFO info;
-	char txt[2*MAXLEN+1];
-
-	if(var[SERIAL].valid)serial=var[SERIAL].value;
-
-	if(!strcmp(cmd,"show-info"))mode=0;
-	else if(!strcmp(cmd,"reset-all"))
-	{
-		if(!(enable&1))goto err1;
-		mode=1;
-	}
-	else if(!strcmp(cmd,"set-password"))mode=2;
-	else if(!strcmp(cmd,"calc-otp"))mode=3;
-	else if(!strcmp(cmd,"calc-all-totp"))mode=4;
-	else if(!strcmp(cmd,"list-all"))mode=5;
-	else if(!strcmp(cmd,"delete-entry"))mode=6;
-	else if(!strcmp(cmd,"add-change-entry"))
-	{
-		if(!var[OTPMODE].valid)goto err1;
-		if(!var[SHAMODE].valid)goto err1;
-		if(!var[OTPDIGITS].valid)goto err1;
-		if(!var[IMF].valid)goto err1;
-		mode=7;
-	}
-	else goto err1;
-
-	if(neosc_pcsc_open(&ctx,serial))goto err1;
-	if(neosc_pcsc_lock(ctx))goto err2;
-	if(neosc_oath_select(ctx,&info))goto err3;
-
-	if(info.protected&&mode>1)
-	{
-		if(!var[PASSWORD].valid)goto err3;
-		if(neosc_oath_unlock(ctx,(char *)var[PASSWORD].data,&info))
-			goto err3;
-	}
-
-	switch(mode)
-	{
-	case 0:	len=sizeof(txt);
-		if(neosc_util_hex_encode(info.identity,8,txt,&len))break;
-		printf("version: %d.%d.%d\n",info.major,info.minor,info.build);
-		printf("identity: %s\n",txt);
-		printf("protected: %s\n",info.protected?"yes":"no");
-		r=0;
-		break;
-
-	case 1:	r=neosc_oath_reset(ctx);
-		break;
-
-	case 2:	r=neosc_oath_chgpass(ctx,
-			var[NEWPASSWORD].valid?(char *)var[NEWPASSWORD].data:"",
-			&info);
-		break;
-
-	case 3:	if((r=neosc_oath_calc_single(ctx,
-			var[OTPNAME].valid?(char *)var[OTPNAME].data:NULL,
-			time(NULL),&result)))break;
-		switch(result.digits)
-		{
-		case 6:	printf("otp: %06d\n",result.value);
-			break;
-		case 7:	printf("otp: %07d\n",result.value);
-			break;
-		case 8:	printf("otp: %08d\n",result.value);
-			break;
-		default:r=-1;
-			break;
-		}
-		break;
-
-	case 4:	if((r=neosc_oath_calc_all(ctx,time(NULL),&results,&total)))
-			break;
-		for(i=0;i<total;i++)
-		{
-			switch(results[i].digits)
-			{
-			case 6:	printf("totp: %06d %s\n",results[i].value,
-					results[i].name);
-				break;
-			case 7:	printf("totp: %07d %s\n",results[i].value,
-					results[i].name);
-				break;
-			case 8:	printf("totp: %08d %s\n",results[i].value,
-					results[i].name);
-				break;
-			default:r=-1;
-				break;
-			}
-			memclear(results[i].name,0,strlen(results[i].name));
-			memclear(&results[i].digits,0,
-				sizeof(results[i].digits));
-			memclear(&results[i].value,0,sizeof(results[i].value));
-		}
-		if(results)free(results);
-		break;
-
-	case 5:	if((r=neosc_oath_list_all(ctx,&list,&total)))break;
-		for(i=0;i<total;i++)
-		{
-			printf("%s-%s: %s\n",
-			    list[i].otpmode==NEOSC_OATH_HOTP?"hotp":"totp",
-			    list[i].shamode==NEOSC_OATH_SHA1?"sha1":"sha256",
-			    list[i].name);
-			memclear(list[i].name,0,sizeof(list[i].name));
-			memclear(&list[i].otpmode,0,sizeof(list[i].otpmode));
-			memclear(&list[i].shamode,0,sizeof(list[i].shamode));
-		}
-		if(list)free(list);
-		break;
-
-	case 6:	r=neosc_oath_delete(ctx,
-			var[OTPNAME].valid?(char *)var[OTPNAME].data:NULL);
-		break;
-
-	case 7:	if((r=neosc_oath_add(ctx,
-			var[OTPNAME].valid?(char *)var[OTPNAME].data:NULL,
-			var[OTPMODE].value,var[SHAMODE].value,
-			var[OTPDIGITS].value,(unsigned int)var[IMF].value,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len)))break;
-		if((r=neosc_util_qrurl(
-			var[OTPNAME].valid?(char *)var[OTPNAME].data:NULL,
-			var[OTPMODE].value,var[SHAMODE].value,
-			var[OTPDIGITS].value,(unsigned int)var[IMF].value,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len,txt,sizeof(txt))))break;
-		printf("url: %s\n",txt);
-		break;
-	}
-
-err3:	neosc_pcsc_unlock(ctx);
-err2:	neosc_pcsc_close(ctx);
-err1:	memclear(&serial,0,sizeof(serial));
-	memclear(&total,0,sizeof(total));
-	memclear(&info,0,sizeof(info));
-	memclear(&result,0,sizeof(result));
-	memclear(txt,0,sizeof(txt));
-	return r;
+	int t;
+
+	pthread_mutex_lock(&wdmtx);
+	busy=on;
+	if(on&&(t=neosc_shell_timeout(ctx)))cmddeadline=now()+t*1000LL;
+	else cmddeadline=0;
+	pthread_mutex_unlock(&wdmtx);
+	if(on)if(write(cancelfd[1],"",1));
 }
 
-static int usbhandler(char *cmd)
+static void *runjob(void *arg)
 {
-	int mode=-1;
-	int serial=0;
-	int r=-1;
-	int val;
-	int len;
-	int usbmode;
-	void *ctx;
-	NEOSC_STATUS status;
-	unsigned char bfr[MAXLEN];
-	char txt[2*MAXLEN+1];
-
-	if(var[SERIAL].valid)serial=var[SERIAL].value;
-
-	if(!strcmp(cmd,"show-status"))mode=1;
-	else if(!strcmp(cmd,"show-serial"))mode=2;
-	else if(!strcmp(cmd,"show-mode"))mode=3;
-	else if(!strcmp(cmd,"calc-hmac"))
-	{
-		if(!var[SLOT].valid)goto fail;
-		if(!var[CHALLENGE].valid)goto fail;
-		mode=4;
-	}
-	else if(!strcmp(cmd,"calc-otp"))
-	{
-		if(!var[SLOT].valid)goto fail;
-		if(!var[CHALLENGE].valid)goto fail;
-		mode=5;
-	}
-	else if(!strcmp(cmd,"set-ndef"))
-	{
-		if(!var[SLOT].valid)goto fail;
-		mode=6;
-	}
-	else if(!strcmp(cmd,"set-scanmap"))mode=7;
-	else if(!strcmp(cmd,"set-mode"))
-	{
-		if(!var[MODE].valid)goto fail;
-		if(var[MODE].value==0x03&&enable<3)goto fail;
-		if(!var[CRTIMEOUT].valid)goto fail;
-		if(!var[AUTOEJECTTIME].valid)goto fail;
-		mode=8;
-	}
-	else if(!strcmp(cmd,"reset-slot"))
-	{
-		if(!(enable&1))goto fail;
-		if(!var[SLOT].valid)goto fail;
-		mode=9;
-	}
-	else if(!strcmp(cmd,"swap-slots"))mode=10;
-	else if(!strcmp(cmd,"update-slot"))
-	{
-		if(!var[SLOT].valid)goto fail;
-		if(!var[TICKETFLAGS].valid)goto fail;
-		if(!var[CONFIGFLAGS].valid)goto fail;
-		if(!var[EXTENDEDFLAGS].valid)goto fail;
-		mode=11;
-	}
-	else if(!strcmp(cmd,"config-hmac"))
-	{
-		if(!var[SLOT].valid)goto fail;
-		if(!var[TICKETFLAGS].valid)goto fail;
-		if(!var[CONFIGFLAGS].valid)goto fail;
-		if(!var[EXTENDEDFLAGS].valid)goto fail;
-		mode=12;
-	}
-	else if(!strcmp(cmd,"config-otp"))
-	{
-		if(!var[SLOT].valid)goto fail;
-		if(!var[TICKETFLAGS].valid)goto fail;
-		if(!var[CONFIGFLAGS].valid)goto fail;
-		if(!var[EXTENDEDFLAGS].valid)goto fail;
-		mode=13;
-	}
-	else if(!strcmp(cmd,"config-hotp"))
-	{
-		if(!var[SLOT].valid)goto fail;
-		if(!var[TICKETFLAGS].valid)goto fail;
-		if(!var[CONFIGFLAGS].valid)goto fail;
-		if(!var[EXTENDEDFLAGS].valid)goto fail;
-		if(!var[OMP].valid)goto fail;
-		if(!var[TT].valid)goto fail;
-		if(!var[MUI].valid)goto fail;
-		if(!var[IMF].valid)goto fail;
-		mode=14;
-	}
-	else if(!strcmp(cmd,"config-yubiotp"))
-	{
-		if(!var[SLOT].valid)goto fail;
-		if(!var[TICKETFLAGS].valid)goto fail;
-		if(!var[CONFIGFLAGS].valid)goto fail;
-		if(!var[EXTENDEDFLAGS].valid)goto fail;
-		mode=15;
-	}
-	else if(!strcmp(cmd,"config-password"))
-	{
-		if(!var[SLOT].valid)goto fail;
-		if(!var[TICKETFLAGS].valid)goto fail;
-		if(!var[CONFIGFLAGS].valid)goto fail;
-		if(!var[EXTENDEDFLAGS].valid)goto fail;
-		mode=16;
-	}
-	else goto fail;
-
-	if(neosc_usb_open(&ctx,serial,&usbmode))goto fail;
-
-	switch(mode)
-	{
-	case 1:	if((r=neosc_usb_read_status(ctx,&status)))break;
-		printf("version: %d.%d.%d\n",status.major,status.minor,
-			status.build);
-		printf("pgmseq: %d\n",status.pgmseq);
-		printf("touchlevel: %d\n",status.touchlevel);
-		printf("config 1 valid: %s\n",status.config1?"yes":"no");
-		printf("config 2 valid: %s\n",status.config2?"yes":"no");
-		printf("config 1 needs button: %s\n",status.touch1?"yes":"no");
-		printf("config 2 needs button: %s\n",status.touch2?"yes":"no");
-		printf("led behaviour: %s\n",status.ledinv?"inverted":"normal");
-		break;
-
-	case 2:	if((r=neosc_usb_read_serial(ctx,&val)))break;
-		printf("serial: %d\n",val);
-		break;
-
-	case 3:	printf("mode: %d\n",usbmode);
-		r=0;
-		break;
-
-	case 4:	if((r=neosc_usb_read_hmac(ctx,var[SLOT].value,
-		    var[CHALLENGE].data,var[CHALLENGE].len,bfr,sizeof(bfr))))
-			break;
-		if(var[OTPDIGITS].valid)
-		{
-			if((r=neosc_util_sha1_to_otp(bfr,NEOSC_SHA1_SIZE,
-				var[OTPDIGITS].value,&val)))break;
-			switch(var[OTPDIGITS].value)
-			{
-			case 6:	printf("otp:%06d\n",val);
-				break;
-			case 7:	printf("otp:%07d\n",val);
-				break;
-			case 8:	printf("otp:%08d\n",val);
-				break;
-			default:r=-1;
-				break;
-			}
-		}
-		else
-		{
-			len=sizeof(txt);
-			if((r=neosc_util_hex_encode(bfr,NEOSC_SHA1_SIZE,txt,
-				&len)))break;
-			printf("h:%s\n",txt);
-		}
-		break;
-
-	case 5:	if((r=neosc_usb_read_otp(ctx,var[SLOT].value,
-		    var[CHALLENGE].data,var[CHALLENGE].len,bfr,sizeof(bfr))))
-			break;
-		len=sizeof(txt);
-		if((r=neosc_util_modhex_encode(bfr,16,txt,&len)))break;
-		printf("m:%s\n",txt);
-		break;
-
-	case 6:	r=neosc_usb_write_ndef(ctx,var[SLOT].value,
-			var[URL].valid?(char *)var[URL].data:NULL,
-			var[TEXT].valid?(char *)var[TEXT].data:NULL,
-			var[LANG].valid?(char *)var[LANG].data:NULL,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 7:	r=neosc_usb_write_scanmap(ctx,
-			var[SCANMAP].valid?var[SCANMAP].data:NULL,
-			var[SCANMAP].len);
-		break;
-
-	case 8:	r=neosc_usb_setmode(ctx,var[MODE].value,var[CRTIMEOUT].value,
-			var[AUTOEJECTTIME].value);
-		break;
-
-	case 9:	r=neosc_usb_reset(ctx,var[SLOT].value);
-		break;
-
-	case 10:r=neosc_usb_swap(ctx,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 11:r=neosc_usb_update(ctx,var[SLOT].value,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 12:r=neosc_usb_hmac(ctx,var[SLOT].value,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 13:r=neosc_usb_otp(ctx,var[SLOT].value,
-			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
-			var[PRIVATEID].len,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 14:r=neosc_usb_hotp(ctx,var[SLOT].value,var[OMP].value,
-			var[TT].value,var[MUI].value,var[IMF].value,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 15:r=neosc_usb_yubiotp(ctx,var[SLOT].value,
-			var[PUBLICID].valid?var[PUBLICID].data:NULL,
-			var[PUBLICID].len,
-			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
-			var[PRIVATEID].len,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-
-	case 16:r=neosc_usb_passwd(ctx,var[SLOT].value,
-			var[PUBLICID].valid?var[PUBLICID].data:NULL,
-			var[PUBLICID].len,
-			var[PRIVATEID].valid?var[PRIVATEID].data:NULL,
-			var[PRIVATEID].len,
-			var[SECRETKEY].valid?var[SECRETKEY].data:NULL,
-			var[SECRETKEY].len,var[TICKETFLAGS].value,
-			var[CONFIGFLAGS].value,var[EXTENDEDFLAGS].value,
-			var[NEWACCESSCODE].valid?var[NEWACCESSCODE].data:NULL,
-			var[NEWACCESSCODE].len,
-			var[ACCESSCODE].valid?var[ACCESSCODE].data:NULL,
-			var[ACCESSCODE].len);
-		break;
-	}
+	int r;
+	JOB *j=arg;
+
+	r=neosc_shell_exec(j->ctx,j->out,j->line);
+	fclose(j->out);
+	if(r==1)r=0;
+	memclear(j->line,0,strlen(j->line));
+	free(j->line);
+
+	pthread_mutex_lock(&wdmtx);
+	j->result=r;
+	j->done=1;
+	pthread_mutex_unlock(&wdmtx);
+	return NULL;
+}
 
-	neosc_usb_close(ctx);
+/*
+ * A background job runs in its own thread on a clone of the context,
+ * i.e. with a snapshot of all variables taken when it is started, and
+ * its own card handle. Its output is collected and printed tagged with
+ * the job id when the job is waited for or before the next prompt.
+ */
+static int startjob(void *ctx,char *line)
+{
+	int i;
+	int t;
+	JOB *j;
+
+	for(i=0;i<MAXJOBS;i++)if(!job[i].id)break;
+	if(i==MAXJOBS)goto err1;
+	j=&job[i];
+
+	if(neosc_shell_clone(ctx,&j->ctx))goto err1;
+	j->data=NULL;
+	j->size=0;
+	if(!(j->out=open_memstream(&j->data,&j->size)))goto err2;
+	if(!(j->line=strdup(line)))goto err3;
+	t=strspn(line," \t");
+	t+=strcspn(line+t," \t");
+	t+=strspn(line+t," \t");
+	t+=strcspn(line+t," \t");
+	snprintf(j->cmd,sizeof(j->cmd),"%.*s",t,line);
+	t=neosc_shell_timeout(j->ctx);
+
+	pthread_mutex_lock(&wdmtx);
+	j->id=i+1;
+	j->done=0;
+	j->deadline=t?now()+t*1000LL:0;
+	pthread_mutex_unlock(&wdmtx);
+
+	if(pthread_create(&j->tid,NULL,runjob,j))goto err4;
+	if(write(cancelfd[1],"",1));
+	printf("[%d]\n",j->id);
+	return 0;
 
-fail:	memclear(&status,0,sizeof(status));
-	memclear(&serial,0,sizeof(serial));
-	memclear(&val,0,sizeof(val));
-	memclear(bfr,0,sizeof(bfr));
-	memclear(txt,0,sizeof(txt));
-	return r;
+err4:	pthread_mutex_lock(&wdmtx);
+	j->id=0;
+	pthread_mutex_unlock(&wdmtx);
+	memclear(j->line,0,strlen(j->line));
+	free(j->line);
+err3:	fclose(j->out);
+	free(j->data);
+err2:	neosc_shell_destroy(j->ctx);
+err1:	return -1;
 }
 
-static int parseline(char *line)
+static int reap(JOB *j,int verbose,int quiet)
 {
-	char *cmd=NULL;
-	char *varname=NULL;
-	char *varvalue=NULL;
+	int r;
+	void *ctx;
+	char *p;
+	char *e;
 
-	if(!(cmd=strtok(line," \t\r\n")))return 0;
+	pthread_join(j->tid,NULL);
 
-	if(!strcmp(cmd,"set"))
-	{
-		if(!(varname=strtok(NULL," \t\r\n")))return -1;
-		if(!(varvalue=strtok(NULL,"\r\n")))return -1;
-		if(strtok(NULL,"\r\n"))return -1;
-		return varhandler(0,varname,varvalue);
-	}
-	else if(!strcmp(cmd,"clear"))
-	{
-		if(!(varname=strtok(NULL," \t\r\n")))return -1;
-		if(strtok(NULL,"\r\n"))return -1;
-		return varhandler(1,varname,varvalue);
-	}
-	else if(!strcmp(cmd,"show"))
-	{
-		if(!(varname=strtok(NULL," \t\r\n")))return -1;
-		if(strtok(NULL,"\r\n"))return -1;
-		return varhandler(2,varname,varvalue);
-	}
-	else if(!strcmp(cmd,"print"))
-	{
-		if(!(varname=strtok(NULL," \t\r\n")))return -1;
-		if(strtok(NULL,"\r\n"))return -1;
-		return varhandler(3,varname,varvalue);
-	}
-	else if(!strcmp(cmd,"modhex"))
+	for(p=j->data;p<j->data+j->size;p=e+1)
 	{
-		if(!(varname=strtok(NULL," \t\r\n")))return -1;
-		if(strtok(NULL,"\r\n"))return -1;
-		return varhandler(4,varname,varvalue);
+		if(!(e=memchr(p,'\n',j->data+j->size-p)))e=j->data+j->size;
+		printf("[%d] %.*s\n",j->id,(int)(e-p),p);
 	}
-	else if(!strcmp(cmd,"base32"))
+	if((r=j->result))
 	{
-		if(!(varname=strtok(NULL," \t\r\n")))return -1;
-		if(strtok(NULL,"\r\n"))return -1;
-		return varhandler(5,varname,varvalue);
+		if(!quiet)printf("[%d] ERROR\n",j->id);
 	}
-	else if(!strcmp(cmd,"base64"))
-	{
-		if(!(varname=strtok(NULL," \t\r\n")))return -1;
-		if(strtok(NULL,"\r\n"))return -1;
-		return varhandler(6,varname,varvalue);
-	}
-	else if(!strcmp(cmd,"neo"))
-	{
-		if(!(varname=strtok(NULL," \t\r\n")))return -1;
-		if(strtok(NULL,"\r\n"))return -1;
-		return neohandler(varname);
-	}
-	else if(!strcmp(cmd,"ndef"))
-	{
-		if(!(varname=strtok(NULL," \t\r\n")))return -1;
-		if(strtok(NULL,"\r\n"))return -1;
-		return ndefhandler(varname);
-	}
-	else if(!strcmp(cmd,"oath"))
+	else if(verbose)printf("[%d] OK\n",j->id);
+	memclear(j->data,0,j->size);
+	free(j->data);
+
+	pthread_mutex_lock(&wdmtx);
+	ctx=j->ctx;
+	j->id=0;
+	pthread_mutex_unlock(&wdmtx);
+	neosc_shell_destroy(ctx);
+	return r;
+}
+
+static int waitjobs(void *ctx,char *arg,int all,int verbose,int quiet)
+{
+	int i;
+	int id=0;
+	int r=0;
+
+	if(arg)
 	{
-		if(!(varname=strtok(NULL," \t\r\n")))return -1;
-		if(strtok(NULL,"\r\n"))return -1;
-		return oathhandler(varname);
+		if((id=atoi(arg))<1||id>MAXJOBS||!job[id-1].id)return -1;
 	}
-	else if(!strcmp(cmd,"usb"))
+	else if(!all)
 	{
-		if(!(varname=strtok(NULL," \t\r\n")))return -1;
-		if(strtok(NULL,"\r\n"))return -1;
-		return usbhandler(varname);
+		for(i=MAXJOBS-1;i>=0;i--)if(job[i].id)break;
+		if(i<0)return -1;
+		id=i+1;
 	}
-	else if(!strcmp(cmd,"help"))
+
+	arm(ctx,1);
+	for(i=0;i<MAXJOBS;i++)if(job[i].id&&(!id||id==i+1))
+		if(reap(&job[i],verbose,quiet))r=-1;
+	arm(ctx,0);
+	return r;
+}
+
+static int jobcmd(void *ctx,char *line,int verbose,int quiet)
+{
+	int i;
+	int done;
+	char *cmd;
+	char *arg;
+	char *p;
+
+	cmd=strtok_r(line," \t",&p);
+	arg=strtok_r(NULL," \t",&p);
+	if(strtok_r(NULL," \t",&p))return -1;
+
+	if(!strcmp(cmd,"jobs"))
 	{
-		varname=strtok(NULL," \t\r\n");
-		if(varname)if(strtok(NULL,"\r\n"))return -1;
-		help(varname);
+		if(arg)return -1;
+		for(i=0;i<MAXJOBS;i++)if(job[i].id)
+		{
+			pthread_mutex_lock(&wdmtx);
+			done=job[i].done;
+			pthread_mutex_unlock(&wdmtx);
+			printf("[%d] %s\t%s\n",job[i].id,
+				done?"Done   ":"Running",job[i].cmd);
+		}
 		return 0;
 	}
-	else if(!strcmp(cmd,"quit"))
+	return waitjobs(ctx,arg,!strcmp(cmd,"wait"),verbose,quiet);
+}
+
+static void notify(int verbose,int quiet,int *failed)
+{
+	int i;
+	int done;
+
+	for(i=0;i<MAXJOBS;i++)if(job[i].id)
 	{
-		if(strtok(NULL,"\r\n"))return -1;
-		return 1;
+		pthread_mutex_lock(&wdmtx);
+		done=job[i].done;
+		pthread_mutex_unlock(&wdmtx);
+		if(done&&reap(&job[i],verbose,quiet))*failed=1;
 	}
-	else return -1;
 }
 
-static int lineloop(char *prompt,int errmode,int verbose,int quiet)
+/*
+ * variable changes on a job would only reach its throwaway copy and job
+ * control has to run in the foreground
+ */
+static int jobless(char *line)
+{
+	int i;
+	int len=strcspn(line," \t");
+	static char *cmd[]={"set","clear","jobs","wait","fg",NULL};
+
+	for(i=0;cmd[i];i++)if(len==strlen(cmd[i])&&!strncmp(line,cmd[i],len))
+		return 1;
+	return 0;
+}
+
+static int lineloop(void *ctx,char *prompt,int errmode,int verbose,int quiet)
 {
+	int r;
 	int len;
+	int failed=0;
 	char *line;
 	HIST_ENTRY *h;
 	HIST_ENTRY **l;
@@ -1480,13 +368,21 @@ static int lineloop(char *prompt,int errmode,int verbose,int quiet)
 
 	while(1)
 	{
+		notify(verbose,quiet,&failed);
+		if(failed&&errmode)
+		{
+			waitjobs(ctx,NULL,1,verbose,quiet);
+			if((l=history_list()))for(;*l;l++)
+			    memclear((*l)->line,0,strlen((*l)->line));
+			return -1;
+		}
+
 		if(!(line=readline(prompt)))
 		{
+			waitjobs(ctx,NULL,1,verbose,quiet);
 			if(verbose)printf("BYE\n");
 			if((l=history_list()))for(;*l;l++)
 			    memclear((*l)->line,0,strlen((*l)->line));
-			for(len=0;len<TOTALVARS;len++)
-				memclear(&var[len],0,sizeof(var[len]));
 			return 0;
 		}
 		len=strlen(line);
@@ -1500,29 +396,45 @@ static int lineloop(char *prompt,int errmode,int verbose,int quiet)
 		}
 		else add_history(line);
 
-		switch(parseline(line))
+		if(len>1&&line[len-1]=='&'&&(line[len-2]==' '||
+			line[len-2]=='\t'))
+		{
+			line[--len]=0;
+			while(len)if(line[len-1]!=' '&&line[len-1]!='\t')break;
+			else line[--len]=0;
+			r=len&&!jobless(line)?startjob(ctx,line):-1;
+		}
+		else if(((r=strcspn(line," \t"))==4&&(!strncmp(line,"jobs",4)||
+			!strncmp(line,"wait",4)))||(r==2&&!strncmp(line,"fg",2)))
+			r=jobcmd(ctx,line,verbose,quiet);
+		else
+		{
+			arm(ctx,1);
+			r=neosc_shell_exec(ctx,stdout,line);
+			arm(ctx,0);
+		}
+
+		switch(r)
 		{
 		case 0:	if(verbose)printf("OK\n");
 			memclear(line,0,len);
 			free(line);
 			break;
-		case 1:	if(verbose)printf("BYE\n");
+		case 1:	waitjobs(ctx,NULL,1,verbose,quiet);
+			if(verbose)printf("BYE\n");
 			memclear(line,0,len);
 			free(line);
 			if((l=history_list()))for(;*l;l++)
 			    memclear((*l)->line,0,strlen((*l)->line));
-			for(len=0;len<TOTALVARS;len++)
-				memclear(&var[len],0,sizeof(var[len]));
 			return 0;
-		case -1:if(!quiet)printf("ERROR\n");
+		default:if(!quiet)printf("ERROR\n");
 			memclear(line,0,len);
 			free(line);
 			if(errmode)
 			{
+				waitjobs(ctx,NULL,1,verbose,quiet);
 				if((l=history_list()))for(;*l;l++)
 				    memclear((*l)->line,0,strlen((*l)->line));
-				for(len=0;len<TOTALVARS;len++)
-					memclear(&var[len],0,sizeof(var[len]));
 				return -1;
 			}
 			break;
@@ -1531,6 +443,314 @@ static int lineloop(char *prompt,int errmode,int verbose,int quiet)
 
 }
 
+static int readall(int fd,void *bfr,int len)
+{
+	int l;
+	unsigned char *p=bfr;
+
+	while(len)
+	{
+		if((l=read(fd,p,len))<=0)return -1;
+		p+=l;
+		len-=l;
+	}
+	return 0;
+}
+
+static int writeall(int fd,void *bfr,int len)
+{
+	int l;
+	unsigned char *p=bfr;
+
+	while(len)
+	{
+		if((l=write(fd,p,len))<=0)return -1;
+		p+=l;
+		len-=l;
+	}
+	return 0;
+}
+
+static void putbe32(unsigned char *p,unsigned int val)
+{
+	p[0]=(unsigned char)(val>>24);
+	p[1]=(unsigned char)(val>>16);
+	p[2]=(unsigned char)(val>>8);
+	p[3]=(unsigned char)val;
+}
+
+static unsigned int getbe32(unsigned char *p)
+{
+	return (p[0]<<24)|(p[1]<<16)|(p[2]<<8)|p[3];
+}
+
+/* an oversize request is skipped, its contents may be secret */
+
+static int discard(int len,char *bfr)
+{
+	int l;
+
+	for(;len;len-=l)
+	{
+		l=len>MAXFRAME?MAXFRAME:len;
+		if(readall(0,bfr,l))return -1;
+		memclear(bfr,0,l);
+	}
+	return 0;
+}
+
+/*
+ * co-process mode, all integers are 32 bit big endian:
+ *
+ * request:  <length> <id> <command line>
+ * response: <length> <id> <status> <key=value lines>
+ *
+ * length counts all following bytes of the frame, id is copied from
+ * the request to its response, status is 0 for success, -1 for a
+ * syntax or precondition error or the libneosc error code otherwise.
+ * A command line longer than 4096 bytes is skipped with status -1.
+ */
+static int coprocloop(void *ctx)
+{
+	int r=0;
+	int wr;
+	int len;
+	unsigned int id;
+	size_t size;
+	char *data;
+	FILE *out;
+	unsigned char hdr[12];
+	char line[MAXFRAME+1];
+
+	while(1)
+	{
+		if(readall(0,hdr,8))
+		{
+			r=0;
+			break;
+		}
+		len=(int)getbe32(hdr);
+		id=getbe32(hdr+4);
+		if(len<4)
+		{
+			r=-1;
+			break;
+		}
+		len-=4;
+		if(len>MAXFRAME)
+		{
+			if(discard(len,line))
+			{
+				r=-1;
+				break;
+			}
+			putbe32(hdr,8);
+			putbe32(hdr+4,id);
+			putbe32(hdr+8,(unsigned int)-1);
+			if(writeall(1,hdr,12))
+			{
+				r=-1;
+				break;
+			}
+			continue;
+		}
+		if(readall(0,line,len))
+		{
+			r=-1;
+			break;
+		}
+		line[len]=0;
+
+		data=NULL;
+		size=0;
+		if(!(out=open_memstream(&data,&size)))
+		{
+			memclear(line,0,len);
+			r=-1;
+			break;
+		}
+		arm(ctx,1);
+		r=neosc_shell_exec(ctx,out,line);
+		arm(ctx,0);
+		fclose(out);
+		memclear(line,0,len);
+
+		putbe32(hdr,(unsigned int)(size+8));
+		putbe32(hdr+4,id);
+		putbe32(hdr+8,(unsigned int)(r==1?0:r));
+		wr=writeall(1,hdr,12)||writeall(1,data,size);
+		memclear(data,0,size);
+		free(data);
+		if(wr)
+		{
+			r=-1;
+			break;
+		}
+		else if(r==1)
+		{
+			r=0;
+			break;
+		}
+	}
+
+	return r;
+}
+
+/*
+ * publisher mode, entered after the commands read from stdin have set
+ * up serial and password, the codes are refreshed right after every
+ * time step boundary and retried every second while the device is
+ * unavailable, in which case the segment is wiped by the engine
+ */
+static int publishloop(void *ctx,int quiet)
+{
+	int r;
+	time_t t;
+	char line[32];
+
+	while(1)
+	{
+		strcpy(line,"oath publish-totp");
+		arm(ctx,1);
+		r=neosc_shell_exec(ctx,stdout,line);
+		arm(ctx,0);
+		if(r&&!quiet)printf("ERROR\n");
+		fflush(stdout);
+
+		t=time(NULL);
+		sleep(r?1:TOTPSTEP-t%TOTPSTEP);
+	}
+	return 0;
+}
+
+static int readtap(char *file,char **lines)
+{
+	int n=0;
+	int l;
+	size_t size=0;
+	char *line=NULL;
+	FILE *fp;
+
+	if(!(fp=fopen(file,"re")))return -1;
+	while((l=getline(&line,&size,fp))!=-1)
+	{
+		while(l&&(line[l-1]=='\n'||line[l-1]=='\r'))line[--l]=0;
+		if(!l||*line=='#')continue;
+		if(n==MAXTAPLINES||!(lines[n]=strdup(line)))goto err;
+		n++;
+	}
+	if(!n)goto err;
+	free(line);
+	fclose(fp);
+	return n;
+
+err:	while(n--)free(lines[n]);
+	free(line);
+	fclose(fp);
+	return -1;
+}
+
+static int deliver(char *hook,char *sock,char *data,int len)
+{
+	int fd;
+	int p[2];
+	pid_t pid;
+	struct sockaddr_un a;
+
+	if(sock)
+	{
+		memset(&a,0,sizeof(a));
+		a.sun_family=AF_UNIX;
+		strcpy(a.sun_path,sock);
+		if((fd=socket(AF_UNIX,SOCK_STREAM,0))==-1)return -1;
+		if(connect(fd,(struct sockaddr *)&a,sizeof(a))||
+			writeall(fd,data,len))
+		{
+			close(fd);
+			return -1;
+		}
+		close(fd);
+		return 0;
+	}
+	else if(hook)
+	{
+		if(pipe(p))return -1;
+		switch((pid=fork()))
+		{
+		case -1:close(p[0]);
+			close(p[1]);
+			return -1;
+		case 0:	close(p[1]);
+			if(p[0])
+			{
+				dup2(p[0],0);
+				close(p[0]);
+			}
+			execl("/bin/sh","sh","-c",hook,(char *)NULL);
+			_exit(127);
+		}
+		close(p[0]);
+		fd=writeall(p[1],data,len);
+		close(p[1]);
+		return fd;
+	}
+
+	fd=writeall(1,data,len);
+	return fd;
+}
+
+/*
+ * tap listener mode, entered after the commands read from stdin have set
+ * up serial and password: PC/SC card events are waited for, the device
+ * is opened after each of them and the card handle that saw it is used right away for the read sequence of
+ * the tap file, whose collected output is passed on in one piece to the
+ * socket, the hook (as its stdin) or stdout, then the device has to go
+ * away before the next tap is served
+ */
+static int taploop(void *ctx,char **lines,int total,char *hook,char *sock,
+	int verbose,int quiet)
+{
+	int i;
+	int r;
+	long long t;
+	size_t size;
+	char *data;
+	FILE *out;
+
+	while(1)
+	{
+		if(neosc_shell_tap(ctx,1,TAPWAIT))return -1;
+		t=now();
+
+		data=NULL;
+		size=0;
+		if(!(out=open_memstream(&data,&size)))return -1;
+		for(i=0;i<total;i++)
+		{
+			arm(ctx,1);
+			r=neosc_shell_exec(ctx,out,lines[i]);
+			arm(ctx,0);
+			if(r)
+			{
+				fprintf(out,"ERROR\n");
+				break;
+			}
+		}
+		fclose(out);
+
+		r=deliver(hook,sock,data,(int)size);
+		memclear(data,0,size);
+		free(data);
+		if(r&&!quiet)fprintf(stderr,"cannot deliver tap result.\n");
+		if(verbose)fprintf(stderr,"tap served in %lld ms\n",now()-t);
+
+		while(waitpid(-1,NULL,WNOHANG)>0);
+
+		if(neosc_shell_tap(ctx,0,TAPWAIT))return -1;
+	}
+	return 0;
+}
+
 static void usage(void)
 {
 	fprintf(stderr,"Usage: neosc-shell <options>\n"
@@ -1545,6 +765,24 @@ static void usage(void)
 	  "-v\t\tbe more verbose\n"
 	  "-e\t\tterminate in case of error\n"
 	  "-N\t\tdo not print a prompt\n"
+	  "-c\t\tco-process mode (framed requests/responses on stdin/stdout)\n"
+	  "-L <socket>\tserialize card access through the neosc-lockd broker\n"
+	  "-P <prio>\tbroker priority (0-9, lower is served first, default 5)\n"
+	  "-D <dir>\tcache static device metadata per serial in <dir>\n"
+	  "-T <seconds>\tterminate after <seconds> (default unlimited)\n"
+	  "-M <file>\twrite Prometheus metrics to <file>\n"
+	  "-m <ttl>:<uses>\tmemoize HMAC responses (off by default)\n"
+	  "-H <applet>\treselect neo|ndef|oath|openpgp|piv after commands\n"
+	  "-k\t\tkeep an unlocked OATH applet unlocked between commands\n"
+	  "-A <file>\tlog all device commands to the audit ring <file>\n"
+	  "-j <file>\tjournal completed steps to the new file <file>\n"
+	  "-r <file>\tresume the run journaled in <file>\n"
+	  "-I <file>\trecord device inventory in the database <file>\n"
+	  "-O <name>\tpublish TOTP codes to the shared memory segment <name>\n"
+	  "-K <file>\tderive device keys from the master key in <file>\n"
+	  "-W <file>\trun the commands in <file> on every device tap\n"
+	  "-X <command>\tpass tap results to <command> on stdin\n"
+	  "-Y <socket>\tpass tap results to the unix stream <socket>\n"
 	  "-h\t\tthis help text\n");
 	exit(1);
 }
@@ -1552,19 +790,41 @@ static void usage(void)
 int main(int argc,char *argv[])
 {
 	int c;
+	int r;
+	int enable=0;
+	int coproc=0;
 	int verbose=0;
 	int quiet=0;
 	int errmode=0;
 	int noprompt=0;
 	int serial=NEOSC_ANY_YUBIKEY;
+	int prio=-1;
+	int timeout=0;
+	char *lockd=NULL;
+	char *cachedir=NULL;
+	int memottl=0;
+	int memouses=0;
+	int home=NEOSC_SHELL_APPLET_NONE;
+	int keepoath=0;
+	int resume=0;
+	char *metrics=NULL;
+	char *audit=NULL;
+	char *journal=NULL;
+	char *inventory=NULL;
+	char *publish=NULL;
+	char *master=NULL;
+	char *tapfile=NULL;
+	char *taphook=NULL;
+	char *tapsock=NULL;
+	int taps=0;
+	char *taplines[MAXTAPLINES];
+	void *ctx;
+	pthread_t tid;
+	struct sigaction sa;
 
-	signal(SIGHUP,SIG_IGN);
-	signal(SIGINT,SIG_IGN);
-	signal(SIGTERM,SIG_IGN);
-	signal(SIGQUIT,SIG_IGN);
 	signal(SIGPIPE,SIG_IGN);
 
-	while((c=getopt(argc,argv,"s:unUCfFqveNh"))!=-1)switch(c)
+	while((c=getopt(argc,argv,"s:unUCfFqveNcL:P:D:T:M:m:H:kA:j:r:I:O:K:W:X:Y:h"))!=-1)switch(c)
 	{
 	case 's':
 		if(serial!=NEOSC_ANY_YUBIKEY)usage();
@@ -1588,12 +848,12 @@ int main(int argc,char *argv[])
 		break;
 
 	case 'f':
-		if(enable&1)usage();
-		enable|=1;
+		if(enable&NEOSC_SHELL_RESET)usage();
+		enable|=NEOSC_SHELL_RESET;
 		break;
 	case 'F':
-		if(enable&2)usage();
-		enable|=2;
+		if(enable&NEOSC_SHELL_BRICK)usage();
+		enable|=NEOSC_SHELL_BRICK;
 		break;
 	case 'q':
 		if(quiet||verbose)usage();
@@ -1611,16 +871,213 @@ int main(int argc,char *argv[])
 		if(noprompt)usage();
 		noprompt=1;
 		break;
+	case 'c':
+		if(coproc)usage();
+		coproc=1;
+		break;
+	case 'L':
+		if(lockd)usage();
+		lockd=optarg;
+		break;
+	case 'P':
+		if(prio!=-1)usage();
+		if((prio=atoi(optarg))<NEOSC_LOCKD_MINPRIO||
+			prio>NEOSC_LOCKD_MAXPRIO)usage();
+		break;
+	case 'D':
+		if(cachedir)usage();
+		cachedir=optarg;
+		break;
+	case 'M':
+		if(metrics)usage();
+		metrics=optarg;
+		break;
+	case 'm':
+		if(memottl)usage();
+		if(sscanf(optarg,"%d:%d",&memottl,&memouses)!=2)usage();
+		if(memottl<=0||memouses<=0)usage();
+		break;
+	case 'H':
+		if(home)usage();
+		if(!strcmp(optarg,"neo"))home=NEOSC_SHELL_APPLET_NEO;
+		else if(!strcmp(optarg,"ndef"))home=NEOSC_SHELL_APPLET_NDEF;
+		else if(!strcmp(optarg,"oath"))home=NEOSC_SHELL_APPLET_OATH;
+		else if(!strcmp(optarg,"openpgp"))home=NEOSC_SHELL_APPLET_PGP;
+		else if(!strcmp(optarg,"piv"))home=NEOSC_SHELL_APPLET_PIV;
+		else usage();
+		break;
+	case 'k':
+		if(keepoath)usage();
+		keepoath=1;
+		break;
+	case 'A':
+		if(audit)usage();
+		audit=optarg;
+		break;
+	case 'j':
+	case 'r':
+		if(journal)usage();
+		journal=optarg;
+		resume=(c=='r');
+		break;
+	case 'I':
+		if(inventory)usage();
+		inventory=optarg;
+		break;
+	case 'O':
+		if(publish)usage();
+		publish=optarg;
+		break;
+	case 'K':
+		if(master)usage();
+		master=optarg;
+		break;
+	case 'W':
+		if(tapfile)usage();
+		tapfile=optarg;
+		break;
+	case 'X':
+		if(taphook||tapsock)usage();
+		taphook=optarg;
+		break;
+	case 'Y':
+		if(taphook||tapsock)usage();
+		tapsock=optarg;
+		if(strlen(tapsock)>=sizeof(((struct sockaddr_un *)0)->sun_path))
+			usage();
+		break;
+	case 'T':
+		if(timeout)usage();
+		if((timeout=atoi(optarg))<=0)usage();
+		break;
 	case 'h':
 	default:usage();
 	}
 
-	if(serial!=NEOSC_ANY_YUBIKEY)
+	if(publish&&coproc)usage();
+	if(tapfile&&(coproc||publish))usage();
+	if((taphook||tapsock)&&!tapfile)usage();
+
+	if(tapfile)if((taps=readtap(tapfile,taplines))==-1)
 	{
-		var[SERIAL].value=serial;
-		var[SERIAL].valid=1;
+		fprintf(stderr,"cannot read tap commands from %s.\n",tapfile);
+		return 1;
 	}
 
-	if(lineloop(noprompt?NULL:"> ",errmode,verbose,quiet))return 1;
-	return 0;
+	if(neosc_shell_create(&ctx,enable|(coproc?NEOSC_SHELL_KEYVALUE:0)))
+		return 1;
+	wdctx=ctx;
+	if(timeout)deadline=now()+timeout*1000LL;
+
+	if(pipe(cancelfd))
+	{
+		neosc_shell_destroy(ctx);
+		return 1;
+	}
+	if(pthread_create(&tid,NULL,watchdog,NULL))
+	{
+		neosc_shell_destroy(ctx);
+		return 1;
+	}
+
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler=sighandler;
+	sigaction(SIGHUP,&sa,NULL);
+	sigaction(SIGINT,&sa,NULL);
+	sigaction(SIGTERM,&sa,NULL);
+	sigaction(SIGQUIT,&sa,NULL);
+
+	if(serial!=NEOSC_ANY_YUBIKEY)neosc_shell_serial(ctx,serial);
+	if(home)neosc_shell_home(ctx,home);
+	if(keepoath)neosc_shell_keepoath(ctx,1);
+	if(lockd||prio!=-1)if(neosc_shell_lockd(ctx,lockd,
+		prio!=-1?prio:NEOSC_LOCKD_DEFPRIO))
+	{
+		neosc_shell_destroy(ctx);
+		return 1;
+	}
+	if(cachedir)if(neosc_shell_cache(ctx,cachedir))
+	{
+		neosc_shell_destroy(ctx);
+		return 1;
+	}
+	if(metrics)
+	{
+		if(neosc_shell_metrics(ctx,metrics))
+		{
+			neosc_shell_destroy(ctx);
+			return 1;
+		}
+		pthread_mutex_lock(&wdmtx);
+		flushing=1;
+		pthread_mutex_unlock(&wdmtx);
+	}
+	if(audit)if(neosc_shell_audit(ctx,audit))
+	{
+		fprintf(stderr,"cannot access audit log %s.\n",audit);
+		neosc_shell_destroy(ctx);
+		return 1;
+	}
+	if(journal)if(neosc_shell_journal(ctx,journal,resume))
+	{
+		fprintf(stderr,"cannot %s journal %s.\n",
+			resume?"resume from":"create",journal);
+		neosc_shell_destroy(ctx);
+		return 1;
+	}
+	if(inventory)if(neosc_shell_inventory(ctx,inventory))
+	{
+		neosc_shell_destroy(ctx);
+		return 1;
+	}
+	if(memottl)if(neosc_shell_memoize(ctx,memottl,memouses))
+	{
+		fprintf(stderr,"cannot lock memory for memoization.\n");
+		neosc_shell_destroy(ctx);
+		return 1;
+	}
+	if(master)if(neosc_shell_masterkey(ctx,master))
+	{
+		fprintf(stderr,"cannot load master key %s.\n",master);
+		neosc_shell_destroy(ctx);
+		return 1;
+	}
+	if(publish)if(neosc_shell_publish(ctx,publish))
+	{
+		fprintf(stderr,"cannot publish to %s.\n",publish);
+		neosc_shell_destroy(ctx);
+		return 1;
+	}
+
+	if(coproc)r=coprocloop(ctx);
+	else r=lineloop(ctx,noprompt?NULL:"> ",errmode,verbose,quiet);
+
+	if(publish&&!r)
+	{
+		publishing=1;
+		r=publishloop(ctx,quiet);
+	}
+	else if(tapfile&&!r)
+	{
+		listening=1;
+		r=taploop(ctx,taplines,taps,taphook,tapsock,verbose,quiet);
+	}
+	while(taps--)
+	{
+		memclear(taplines[taps],0,strlen(taplines[taps]));
+		free(taplines[taps]);
+	}
+
+	pthread_mutex_lock(&wdmtx);
+	wdctx=NULL;
+	pthread_mutex_unlock(&wdmtx);
+	if((c=neosc_shell_mismatches(ctx)))
+	{
+		fprintf(stderr,"%d slot(s) failed verification.\n",c);
+		r=1;
+	}
+	if(verbose&&(c=neosc_shell_recoveries(ctx)))
+		fprintf(stderr,"%d NFC command(s) recovered.\n",c);
+	neosc_shell_destroy(ctx);
+	return r?1:0;
 }
@@ -0,0 +1,213 @@
+/*
+ * neosc-totp - current TOTP codes published through shared memory
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include "neosc-totp.h"
+
+#define memclear(a,b,c) \
+    do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
+
+#define RETRIES	1000
+
+typedef struct
+{
+	int fd;
+	char *name;
+	NEOSC_TOTP_SEGMENT *seg;
+} WRITER;
+
+static void begin(NEOSC_TOTP_SEGMENT *seg)
+{
+	__atomic_store_n(&seg->seq,seg->seq+1,__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void end(NEOSC_TOTP_SEGMENT *seg)
+{
+	__atomic_store_n(&seg->seq,seg->seq+1,__ATOMIC_RELEASE);
+}
+
+/*
+ * The segment is locked for the lifetime of the publisher so that a
+ * second publisher fails instead of both overwriting each other, and it
+ * must be owned by the caller so nobody else can prepare a segment that
+ * lets them read the codes.
+ */
+void *neosc_totp_create(char *name,int mode)
+{
+	WRITER *w;
+	struct stat stb;
+
+	if(*name!='/'||strchr(name+1,'/'))goto err1;
+	if(!(w=malloc(sizeof(WRITER))))goto err1;
+	if(!(w->name=strdup(name)))goto err2;
+	if((w->fd=shm_open(name,O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC,mode))==-1)
+		goto err3;
+	if(flock(w->fd,LOCK_EX|LOCK_NB))goto err4;
+	if(fstat(w->fd,&stb)||stb.st_uid!=geteuid())goto err4;
+	if(fchmod(w->fd,mode))goto err4;
+	if(ftruncate(w->fd,sizeof(NEOSC_TOTP_SEGMENT)))goto err4;
+	if((w->seg=mmap(NULL,sizeof(NEOSC_TOTP_SEGMENT),PROT_READ|PROT_WRITE,
+		MAP_SHARED,w->fd,0))==MAP_FAILED)goto err4;
+	mlock(w->seg,sizeof(NEOSC_TOTP_SEGMENT));
+	madvise(w->seg,sizeof(NEOSC_TOTP_SEGMENT),MADV_DONTDUMP);
+
+	begin(w->seg);
+	memclear(w->seg->entry,0,sizeof(w->seg->entry));
+	w->seg->magic=NEOSC_TOTP_MAGIC;
+	w->seg->version=NEOSC_TOTP_VERSION;
+	w->seg->total=0;
+	w->seg->serial=0;
+	w->seg->period=0;
+	w->seg->expiry=0;
+	end(w->seg);
+	return w;
+
+err4:	close(w->fd);
+err3:	free(w->name);
+err2:	free(w);
+err1:	return NULL;
+}
+
+void neosc_totp_publish(void *totp,int serial,time_t expiry,int period,
+	NEOSC_TOTP_ENTRY *entry,int total)
+{
+	WRITER *w=totp;
+
+	if(total>NEOSC_TOTP_MAX)total=NEOSC_TOTP_MAX;
+	begin(w->seg);
+	memcpy(w->seg->entry,entry,total*sizeof(NEOSC_TOTP_ENTRY));
+	memclear(w->seg->entry+total,0,
+		(NEOSC_TOTP_MAX-total)*sizeof(NEOSC_TOTP_ENTRY));
+	w->seg->total=total;
+	w->seg->serial=serial;
+	w->seg->period=period;
+	w->seg->expiry=expiry;
+	end(w->seg);
+}
+
+void neosc_totp_clear(void *totp)
+{
+	WRITER *w=totp;
+
+	if(!w->seg->total&&!w->seg->expiry)return;
+	begin(w->seg);
+	memclear(w->seg->entry,0,sizeof(w->seg->entry));
+	w->seg->total=0;
+	w->seg->expiry=0;
+	end(w->seg);
+}
+
+void neosc_totp_wipe(void *totp)
+{
+	WRITER *w=totp;
+
+	neosc_totp_clear(w);
+	shm_unlink(w->name);
+}
+
+void neosc_totp_close(void *totp)
+{
+	WRITER *w=totp;
+
+	neosc_totp_wipe(w);
+	munmap(w->seg,sizeof(NEOSC_TOTP_SEGMENT));
+	close(w->fd);
+	free(w->name);
+	free(w);
+}
+
+NEOSC_TOTP_SEGMENT *neosc_totp_map(char *name)
+{
+	int fd;
+	struct stat stb;
+	NEOSC_TOTP_SEGMENT *seg;
+
+	if((fd=shm_open(name,O_RDONLY|O_NOFOLLOW|O_CLOEXEC,0))==-1)goto err1;
+	if(fstat(fd,&stb)||stb.st_size<sizeof(NEOSC_TOTP_SEGMENT))goto err2;
+	if((seg=mmap(NULL,sizeof(NEOSC_TOTP_SEGMENT),PROT_READ,MAP_SHARED,fd,
+		0))==MAP_FAILED)goto err2;
+	close(fd);
+	if(seg->magic!=NEOSC_TOTP_MAGIC||seg->version!=NEOSC_TOTP_VERSION)
+	{
+		munmap(seg,sizeof(NEOSC_TOTP_SEGMENT));
+		goto err1;
+	}
+	return seg;
+
+err2:	close(fd);
+err1:	return NULL;
+}
+
+void neosc_totp_unmap(NEOSC_TOTP_SEGMENT *seg)
+{
+	munmap(seg,sizeof(NEOSC_TOTP_SEGMENT));
+}
+
+/*
+ * Copies the codes valid at 'now' to entry, the next field is cleared.
+ * Returns the number of codes, 0 if the segment holds no valid codes
+ * or -1 if no consistent copy could be taken.  No system call is made.
+ */
+int neosc_totp_read(NEOSC_TOTP_SEGMENT *seg,time_t now,
+	NEOSC_TOTP_ENTRY *entry,int max,int *serial,int *left)
+{
+	int i;
+	int total;
+	int period;
+	int64_t expiry;
+	uint32_t seq;
+
+	for(i=0;i<RETRIES;i++)
+	{
+		if((seq=__atomic_load_n(&seg->seq,__ATOMIC_ACQUIRE))&1)continue;
+		total=seg->total;
+		period=seg->period;
+		expiry=seg->expiry;
+		if(total<0||total>NEOSC_TOTP_MAX)total=0;
+		if(total>max)total=max;
+		memcpy(entry,(void *)seg->entry,total*sizeof(NEOSC_TOTP_ENTRY));
+		if(serial)*serial=seg->serial;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&seg->seq,__ATOMIC_RELAXED)==seq)break;
+	}
+	if(i==RETRIES)return -1;
+
+	if(total&&now>=expiry&&now<expiry+period)
+	{
+		for(i=0;i<total;i++)entry[i].value=entry[i].next;
+		expiry+=period;
+	}
+	if(now<expiry-period||now>=expiry)
+	{
+		if(total)memclear(entry,0,total*sizeof(NEOSC_TOTP_ENTRY));
+		total=0;
+	}
+	for(i=0;i<total;i++)entry[i].next=0;
+	if(left)*left=total?(int)(expiry-now):0;
+	return total;
+}
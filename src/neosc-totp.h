@@ -0,0 +1,75 @@
+/*
+ * neosc-totp - current TOTP codes published through shared memory
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _NEOSC_TOTP_H
+#define _NEOSC_TOTP_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define NEOSC_TOTP_SHM		"/neosc-totp"
+#define NEOSC_TOTP_MAGIC	0x50544f54
+#define NEOSC_TOTP_VERSION	1
+#define NEOSC_TOTP_MAX		64
+#define NEOSC_TOTP_NAMELEN	68
+
+/*
+ * The segment holds the codes of the current and of the next time step
+ * so that readers are served across a step boundary while the publisher
+ * refreshes.  The writer makes seq odd before and even again after an
+ * update, a reader copies the segment and retries if seq was odd or has
+ * changed meanwhile.  A segment of total 0 or whose steps have expired
+ * holds no valid codes, it is wiped that way on exit or device removal.
+ */
+
+typedef struct
+{
+	char name[NEOSC_TOTP_NAMELEN];
+	int32_t digits;
+	int32_t value;
+	int32_t next;
+	int32_t spare;
+} NEOSC_TOTP_ENTRY;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;
+	int32_t total;
+	int32_t serial;
+	int32_t period;
+	int64_t expiry;
+	NEOSC_TOTP_ENTRY entry[NEOSC_TOTP_MAX];
+} NEOSC_TOTP_SEGMENT;
+
+extern void *neosc_totp_create(char *name,int mode);
+extern void neosc_totp_publish(void *totp,int serial,time_t expiry,
+	int period,NEOSC_TOTP_ENTRY *entry,int total);
+extern void neosc_totp_clear(void *totp);
+extern void neosc_totp_wipe(void *totp);
+extern void neosc_totp_close(void *totp);
+
+extern NEOSC_TOTP_SEGMENT *neosc_totp_map(char *name);
+extern void neosc_totp_unmap(NEOSC_TOTP_SEGMENT *seg);
+extern int neosc_totp_read(NEOSC_TOTP_SEGMENT *seg,time_t now,
+	NEOSC_TOTP_ENTRY *entry,int max,int *serial,int *left);
+
+#endif
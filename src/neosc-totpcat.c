@@ -0,0 +1,95 @@
+/*
+ * neosc-totpcat - print the TOTP codes published by neosc-shell
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "neosc-totp.h"
+
+#define memclear(a,b,c) \
+    do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
+
+static void usage(void)
+{
+	fprintf(stderr,"Usage: neosc-totpcat <options> [<name>]\n"
+	  "-O <name>\tshared memory segment (default " NEOSC_TOTP_SHM ")\n"
+	  "-v\t\tprint serial number and remaining validity too\n"
+	  "-h\t\tthis help text\n");
+	exit(1);
+}
+
+int main(int argc,char *argv[])
+{
+	int c;
+	int i;
+	int n;
+	int r=1;
+	int left;
+	int serial;
+	int verbose=0;
+	char *name=NEOSC_TOTP_SHM;
+	NEOSC_TOTP_SEGMENT *seg;
+	NEOSC_TOTP_ENTRY entry[NEOSC_TOTP_MAX];
+
+	while((c=getopt(argc,argv,"O:vh"))!=-1)switch(c)
+	{
+	case 'O':
+		name=optarg;
+		break;
+	case 'v':
+		if(verbose)usage();
+		verbose=1;
+		break;
+	case 'h':
+	default:usage();
+	}
+
+	if(optind<argc-1)usage();
+
+	if(!(seg=neosc_totp_map(name)))
+	{
+		fprintf(stderr,"cannot access %s.\n",name);
+		return 1;
+	}
+
+	if((n=neosc_totp_read(seg,time(NULL),entry,NEOSC_TOTP_MAX,&serial,
+		&left))<=0)
+	{
+		fprintf(stderr,"no current codes published.\n");
+		goto out;
+	}
+
+	if(verbose)printf("serial: %d\nvalid: %d\n",serial,left);
+	for(i=0;i<n;i++)
+	{
+		if(optind<argc&&strcmp(entry[i].name,argv[optind]))continue;
+		if(optind<argc)printf("%0*d\n",entry[i].digits,entry[i].value);
+		else printf("%0*d %s\n",entry[i].digits,entry[i].value,
+			entry[i].name);
+		r=0;
+	}
+
+out:	memclear(entry,0,sizeof(entry));
+	neosc_totp_unmap(seg);
+	return r;
+}